@@ -1,15 +1,42 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 // TODO: dyn
 #define TABLOID_VERSION     "0.0.1"
 
 #define DEFAULT_TAB_SZ      8
 #define DEFAULT_LINE_PREFIX "~"
 
+// Lines past the viewport to index before the first paint of a file
+#define DEFAULT_INDEX_MARGIN 1024
+
+// Max redraws per second; bursts of input are handled in between
+#define DEFAULT_FRAME_RATE  60
+
+// Bytes of undo history bookkeeping kept in memory, a few hundred per edit;
+// older edits are spilled to disk. The text they refer to stays in the add
+// buffer regardless.
+#define DEFAULT_UNDO_META_BUDGET (1 << 20)
+
+// Keep undo history in a file beside the one being edited, across sessions
+#define DEFAULT_UNDO_FILE   true
+
+// Log every change to a swap file beside the one being edited, synced this
+// often, so a crash loses at most that much
+#define DEFAULT_SWAP_FILE    true
+#define DEFAULT_SWAP_SYNC_MS 1000
+
 typedef struct {
   unsigned short tab_sz;
+  unsigned short frame_rate;
   char*          ln_prefix;
+  size_t         undo_meta_budget;
+  bool           undo_file;
+  bool           swap_file;
+  unsigned int   swap_sync_ms;
 } config_t;
 
 #endif /* CONFIG_H */
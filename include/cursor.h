@@ -3,7 +3,7 @@
 
 #include <stdbool.h>
 
-#include "libutil/libutil.h"
+#include "frame_buffer.h"
 #include "line_editor.h"
 
 // TODO: Move me
@@ -110,10 +110,8 @@ cursor_set_is_active (line_editor_t *self, bool next) {
   self->curs.select_active = next;
 }
 
-void cursor_set_position(line_editor_t *self, buffer_t *buf);
-void cursor_set_position_command_bar(line_editor_t *self, buffer_t *buf);
-
-cursor_t *cursor_create_copy(line_editor_t *self);
+void cursor_set_position(line_editor_t *self, frame_buffer_t *buf);
+void cursor_set_position_command_bar(line_editor_t *self, frame_buffer_t *buf);
 
 void cursor_move_down(line_editor_t *self);
 void cursor_move_up(line_editor_t *self);
@@ -1,34 +1,71 @@
 #ifndef EDITOR_H
 #define EDITOR_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #include "command_bar.h"
 #include "config.h"
 #include "file.h"
+#include "frame_buffer.h"
 #include "line_editor.h"
 #include "mode.h"
+#include "screen.h"
 #include "status_bar.h"
+#include "swap_file.h"
 #include "tty.h"
 #include "window.h"
 
+// A write running in the background; see `editor_save_async`
+typedef struct {
+  pthread_t               thread;
+  // Whether `thread` was started; if not, the write was done in place
+  bool                    threaded;
+  char*                   filepath;
+  piece_table_snapshot_t* snapshot;
+  io_write_all_result     result;
+  size_t                  n_bytes;
+  // Changes in the swap file as of the snapshot
+  unsigned int            swap_mark;
+  // Permissions new files don't get
+  mode_t                  mask;
+  atomic_bool             done;
+} save_job_t;
+
 // TODO: no more global state
 // TODO: pointers or no? either way, be consistent.
 // Read: https://stackoverflow.com/questions/24452323/whats-the-difference-between-pointer-and-value-in-struct
 typedef struct {
-  window_t       win;
-  tty_t          tty;
-  config_t       conf;
-  s_bar_state_t  s_bar;
-  line_editor_t  c_bar;
-  editor_mode_t  mode;
-  command_mode_t cmode;
-  char           cbar_msg[64];
-  line_editor_t  line_ed;
-  const char*    filepath;
+  window_t        win;
+  tty_t           tty;
+  config_t        conf;
+  s_bar_state_t   s_bar;
+  line_editor_t   c_bar;
+  editor_mode_t   mode;
+  command_mode_t  cmode;
+  char            cbar_msg[64];
+  line_editor_t   line_ed;
+  const char*     filepath;
+  save_job_t*     save_job;
+  swap_file_t*    swap;
+  // The process umask, as of startup
+  mode_t          file_mask;
+  screen_t        screen;
+  // Reused across refreshes: the composed frame, and what is written out
+  frame_buffer_t* frame;
+  frame_buffer_t* out;
 } editor_t;
 
 void editor_init(editor_t* self);
 void editor_free(editor_t* self);
 void editor_open(const char* filename);
-int  editor_save(const char* filepath);
+void editor_close_swap(void);
+bool editor_save_async(const char* filepath);
+bool editor_saving(void);
+unsigned int editor_save_progress(void);
+void editor_save_poll(void);
+void editor_save_wait(void);
 
 #endif /* EDITOR_H */
@@ -0,0 +1,31 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Output buffer for rendering a frame. Capacity doubles as it grows and is
+ * kept across resets, so once warmed up a frame is drawn without allocating.
+ */
+typedef struct {
+  char*  state;
+  size_t length;
+  size_t capacity;
+} frame_buffer_t;
+
+frame_buffer_t* frame_buffer_init(void);
+void            frame_buffer_free(frame_buffer_t* self);
+void            frame_buffer_reset(frame_buffer_t* self);
+void            frame_buffer_reserve(frame_buffer_t* self, size_t n);
+
+char*  frame_buffer_state(frame_buffer_t* self);
+size_t frame_buffer_size(frame_buffer_t* self);
+
+void frame_buffer_append(frame_buffer_t* self, const char* s);
+void frame_buffer_append_with(frame_buffer_t* self, const char* s, size_t n);
+void frame_buffer_append_char(frame_buffer_t* self, char c);
+void frame_buffer_fill(frame_buffer_t* self, char c, size_t n);
+void frame_buffer_append_uint(frame_buffer_t* self, unsigned int n, unsigned int width);
+
+#endif /* FRAME_BUFFER_H */
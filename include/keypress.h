@@ -1,6 +1,8 @@
 #ifndef KEYPRESS_H
 #define KEYPRESS_H
 
+#include <stdbool.h>
+
 #define CTRL_KEY(k)                      ((k) & 0x1F)
 
 // https://vt100.net/docs/vt100-ug/chapter3.html
@@ -23,6 +25,11 @@
 #define ESC_SEQ_COLOR(num)               ESC_SEQ "[38;5;" #num "m"
 #define ESC_SEQ_BG_COLOR(num)            ESC_SEQ "[48;5;" #num "m"
 
+// Bracketed paste: the terminal wraps pasted text in start and end markers
+#define ESC_SEQ_PASTE_MODE_ON            ESC_SEQ "[?2004h"
+#define ESC_SEQ_PASTE_MODE_OFF           ESC_SEQ "[?2004l"
+#define ESC_SEQ_PASTE_END                ESC_SEQ "[201~"
+
 typedef enum {
   BACKSPACE  = 127,
 
@@ -53,6 +60,7 @@ typedef enum {
 
   ENTER,
   DELETE,
+  PASTE,
 
   CTRL_A,
   CTRL_C,
@@ -66,5 +74,6 @@ typedef enum {
 } keypress_t;
 
 void keypress_handle(void);
+bool keypress_wait(int timeout_ms);
 
 #endif /* KEYPRESS_H */
@@ -3,6 +3,7 @@
 
 #include "libutil/libutil.h"
 #include "piece_table.h"
+#include "str_search.h"
 
 typedef struct {
   unsigned int line_start;
@@ -10,25 +11,40 @@ typedef struct {
 } line_info_t;
 
 typedef struct {
-  // array_t<line_info_t>
-  array_t       *line_info;
+  // Line positions are derived from the piece table's per-piece line break
+  // counts; only the total is cached here.
   unsigned int   num_lines;
-  // array_t<char*>
-  array_t       *line;
-  buffer_t      *tmp_buffer;
   piece_table_t *pt;
+  // Piece count at which the next idle compaction runs
+  unsigned int   compact_at;
 } line_buffer_t;
 
 line_buffer_t *line_buffer_init(char *initial);
+line_buffer_t *line_buffer_init_mapped(const char *mapping, unsigned int length, unsigned int eager_lines);
 void           line_buffer_free(line_buffer_t *self);
 void           line_buffer_refresh(line_buffer_t *self);
+bool           line_buffer_indexing(line_buffer_t *self);
+unsigned int   line_buffer_line_count_estimate(line_buffer_t *self);
+size_t         line_buffer_history_meta_size(line_buffer_t *self);
+unsigned int   line_buffer_history_spilled(line_buffer_t *self);
+bool           line_buffer_get_line_info(line_buffer_t *self, unsigned int lineno, line_info_t *li);
 void           line_buffer_get_line(line_buffer_t *self, unsigned int lineno, char *buffer);
-void           line_buffer_get_all(line_buffer_t *self, char **buffer);
+char          *line_buffer_get_all(line_buffer_t *self);
+bool           line_buffer_search(line_buffer_t *self, string_finder_t *sf, unsigned int from, unsigned int *index);
 void line_buffer_get_xy_from_index(line_buffer_t *self, unsigned int index, unsigned int *x, unsigned int *y);
-void  line_buffer_insert(line_buffer_t *self, int x, int y, char *insert_chars, void *metadata);
-void  line_buffer_delete(line_buffer_t *self, int x, int y, void *metadata);
-void *line_buffer_undo(line_buffer_t *self);
-void *line_buffer_redo(line_buffer_t *self);
+void  line_buffer_insert(line_buffer_t *self, int x, int y, char *insert_chars, const undo_cursor_t *cursor);
+void  line_buffer_delete(line_buffer_t *self, int x, int y, const undo_cursor_t *cursor);
+void  line_buffer_delete_n(line_buffer_t *self, int x, int y, unsigned int n, const undo_cursor_t *cursor);
+const undo_cursor_t *line_buffer_undo(line_buffer_t *self);
+const undo_cursor_t *line_buffer_redo(line_buffer_t *self);
+const undo_cursor_t *line_buffer_travel_steps(line_buffer_t *self, int steps);
+const undo_cursor_t *line_buffer_travel_seconds(line_buffer_t *self, int seconds);
+void  line_buffer_break(line_buffer_t *self);
+void  line_buffer_group_begin(line_buffer_t *self);
+void  line_buffer_group_end(line_buffer_t *self);
+bool  line_buffer_compact(line_buffer_t *self);
+void  line_buffer_set_history_meta_budget(line_buffer_t *self, size_t budget);
+bool  line_buffer_history_load(line_buffer_t *self, const char *path, uint64_t version);
 bool  line_buffer_dirty(line_buffer_t *self);
 void  line_buffer_dirty_reset(line_buffer_t *self);
 
@@ -31,6 +31,8 @@ typedef struct {
 typedef struct {
   cursor_t       curs;
   line_buffer_t* r;
+  // Last char typed, to tell where a word starts
+  int            last_char;
 } line_editor_t;
 
 void line_editor_init(line_editor_t* self);
@@ -39,7 +41,9 @@ void line_editor_delete_char(line_editor_t* self);
 void line_editor_delete_line_before_x(line_editor_t* self);
 void line_editor_insert_newline(line_editor_t* self);
 void line_editor_insert(line_editor_t* self, char* s);
+void line_editor_insert_block(line_editor_t* self, char* s);
 void line_editor_undo(line_editor_t* self);
 void line_editor_redo(line_editor_t* self);
+void line_editor_travel(line_editor_t* self, int count, bool in_seconds);
 
 #endif /* LINE_EDITOR_H */
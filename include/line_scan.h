@@ -0,0 +1,29 @@
+#ifndef LINE_SCAN_H
+#define LINE_SCAN_H
+
+// Growable, ascending list of line break offsets
+typedef struct {
+  unsigned int* offsets;
+  unsigned int  size;
+  unsigned int  cap;
+} line_breaks_t;
+
+// Appends `base + i` to `out` for every line break at `s[i]`, `i < length`
+typedef void line_scan_fn(const char* s, unsigned int length, unsigned int base, line_breaks_t* out);
+
+void line_breaks_init(line_breaks_t* self);
+void line_breaks_free(line_breaks_t* self);
+void line_breaks_reserve(line_breaks_t* self, unsigned int n);
+void line_breaks_append(line_breaks_t* self, line_breaks_t* other);
+
+// Scans with the fastest kernel the CPU supports
+void line_scan(const char* s, unsigned int length, unsigned int base, line_breaks_t* out);
+
+line_scan_fn line_scan_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+#define LINE_SCAN_X86
+line_scan_fn line_scan_sse2;
+line_scan_fn line_scan_avx2;
+#endif
+
+#endif /* LINE_SCAN_H */
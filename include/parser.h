@@ -12,6 +12,8 @@ typedef enum {
   COMMAND_WRITE = 1,
   COMMAND_QUIT,
   COMMAND_WRITE_QUIT,
+  COMMAND_EARLIER,
+  COMMAND_LATER,
 
   PCOMMAND_SEARCH,
 
@@ -22,6 +24,8 @@ static const char* command_enum_displays[] = {
   X(COMMAND_WRITE),
   X(COMMAND_QUIT),
   X(COMMAND_WRITE_QUIT),
+  X(COMMAND_EARLIER),
+  X(COMMAND_LATER),
 
   X(PCOMMAND_SEARCH),
 
@@ -1,9 +1,21 @@
 #ifndef PIECE_TABLE_H
 #define PIECE_TABLE_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include "libutil/libutil.h"
+#include "line_scan.h"
+#include "pool.h"
+
+// Set on the pieces an undo or redo range is restored between, while compacting
+#define PT_PIN_BEFORE 1
+#define PT_PIN_AFTER  2
 
 typedef enum {
   PT_SENTINEL,
@@ -12,16 +24,43 @@ typedef enum {
   PT_REPLACE,
 } piece_table_event;
 
+// One thread's share of a background line index: the breaks in [offset, end)
+typedef struct {
+  pthread_t     thread;
+  const char*   data;
+  unsigned int  offset;
+  unsigned int  end;
+  line_breaks_t line_breaks;
+  atomic_uint   scanned;
+  atomic_uint   found;
+  atomic_bool   done;
+  atomic_bool*  cancel;
+} line_index_worker_t;
+
+// Background scan for the line breaks in the unindexed tail of a read-only
+// buffer, split into contiguous slices across worker threads. Breaks are
+// collected privately and only merged into the buffer's index on the main
+// thread, once every worker is done.
 typedef struct {
-  /// array_t<piece_descriptor_range*>
-  array_t* event_captures;
-} event_stack_t;
+  line_index_worker_t* workers;
+  unsigned int         num_workers;
+  atomic_bool          cancel;
+} line_indexer_t;
 
 typedef struct {
-  unsigned int length;
-  unsigned int max_size;
-  unsigned int id;
-  buffer_t*    buffer;
+  unsigned int    length;
+  unsigned int    max_size;
+  unsigned int    id;
+  // Fixed block of `max_size` bytes. It is never reallocated, so pointers
+  // into it stay valid for the buffer's lifetime.
+  char*           data;
+  // Read-only file mapping that stands in for `buffer`, if any
+  const char*     mapping;
+  // Every line break in the first `indexed` bytes
+  line_breaks_t   line_breaks;
+  unsigned int    indexed;
+  // Scan of the remaining bytes, if it hasn't been merged yet
+  line_indexer_t* indexer;
 } seq_buffer_t;
 
 typedef struct piece_descriptor piece_descriptor_t;
@@ -31,55 +70,164 @@ typedef struct piece_descriptor {
   unsigned int        offset;
   unsigned int        length;
   unsigned int        buffer;
+  unsigned int        newlines;
   piece_descriptor_t* next;
   piece_descriptor_t* prev;
+  // Treap over the live pieces, ordered by document position. Each node caches
+  // the totals of its subtree so offset lookups are logarithmic.
+  piece_descriptor_t* left;
+  piece_descriptor_t* right;
+  piece_descriptor_t* parent;
+  unsigned int        priority;
+  unsigned int        subtree_count;
+  unsigned int        subtree_length;
+  unsigned int        subtree_newlines;
+  unsigned char       pins;
 } ___piece_descriptor_t;
 
+// Where the cursor was before an edit, restored when it is undone
 typedef struct {
-  bool                is_boundary;
-  unsigned int        seq_length;
-  unsigned int        index;
-  unsigned int        length;
-  unsigned int        group_id;
-  piece_descriptor_t* first;
-  piece_descriptor_t* last;
-  void*               metadata;
-} piece_descriptor_range_t;
+  unsigned int x;
+  unsigned int y;
+} undo_cursor_t;
 
+typedef struct piece_descriptor_range piece_descriptor_range_t;
+
+struct piece_descriptor_range {
+  bool                      is_boundary;
+  unsigned int              seq_length;
+  unsigned int              index;
+  unsigned int              length;
+  unsigned int              group_id;
+  piece_descriptor_t*       first;
+  piece_descriptor_t*       last;
+  undo_cursor_t             cursor;
+  // Where the edit's text sits in the sequence right after it is applied
+  unsigned int              region_index;
+  unsigned int              region_length;
+  // Undo tree links: the edit this one was made on top of, and the child redo
+  // goes to i.e. the latest one made or visited
+  piece_descriptor_range_t* parent;
+  piece_descriptor_range_t* redo_child;
+  unsigned int              num_children;
+  // Identifies the state right after the edit; numbered in the order made
+  unsigned int              seq;
+  time_t                    time;
+  bool                      pruned;
+};
+
+// Undo ranges moved out of memory. Records are appended oldest first and read
+// back newest first, as undo reaches the root of the in-memory undo tree.
 typedef struct {
-  event_stack_t*      undo_stack;
-  event_stack_t*      redo_stack;
+  FILE*        file;
+  // Start of each record
+  long*        offsets;
+  unsigned int size;
+  unsigned int cap;
+} undo_journal_t;
+
+// Undo history kept beside the file, so it outlives the session. Each edit is
+// appended once it can no longer be extended, along with the text it replaced
+// and the text it put in; each save appends the version of the file written.
+typedef struct {
+  char*        path;
+  FILE*        file;
+  // The state the file was in when opened; the journal starts from it
+  unsigned int base_seq;
+  uint64_t     base_version;
+  // The newest edit written
+  unsigned int sealed_seq;
+} undo_file_t;
+
+// Every edit in memory, as a tree of the states the text has been in. Undo
+// walks towards the root, redo down the latest branch. Each node only holds
+// the pieces its edit swapped; the text itself stays in the shared buffers.
+typedef struct {
+  // Stands for the oldest state in memory; holds no pieces
+  piece_descriptor_range_t*  root;
+  // The latest edit applied, or the root
+  piece_descriptor_range_t*  current;
+  // Every node but the root, in the order they were made
+  piece_descriptor_range_t** nodes;
+  unsigned int               start;
+  unsigned int               size;
+  unsigned int               cap;
+  unsigned int               last_seq;
+} undo_tree_t;
+
+typedef struct piece_table piece_table_t;
+
+// Told of every change to the text once it is made: `removed` bytes at `index`
+// were replaced by the `inserted` bytes now there
+typedef void piece_table_change_fn(void* ctx, piece_table_t* pt, unsigned int index, unsigned int removed, unsigned int inserted);
+
+struct piece_table {
+  undo_tree_t         history;
   piece_descriptor_t* frag_1;
   piece_descriptor_t* frag_2;
   piece_descriptor_t* head;
   piece_descriptor_t* tail;
+  piece_descriptor_t* root;
   unsigned int        seq_length;
   unsigned int        add_buffer_id;
   unsigned int        last_event_index;
   /// array_t<seq_buffer_t*>
   array_t*            buffer_list;
   piece_table_event   last_event;
-  int                 offset_since_dirty_reset;
-} piece_table_t;
+  // The state last saved
+  unsigned int        saved_seq;
+  // Edits made while a group is open share its id, and are undone together
+  unsigned int        group_id;
+  unsigned int        group_depth;
+  unsigned int        last_group_id;
+  // Backing store for every descriptor and undo range the table allocates
+  pool_t              descriptors;
+  pool_t              ranges;
+  // Undo history whose descriptors and ranges take more than
+  // `history_meta_budget` bytes is spilled to the journal; 0 keeps it all in
+  // memory. Only that bookkeeping is bounded: the journal refers to text by
+  // its place in the add buffer, so the text stays in memory.
+  undo_journal_t      journal;
+  size_t              history_meta_budget;
+  undo_file_t         undo_file;
+  // See `piece_table_on_change`
+  piece_table_change_fn* on_change;
+  void*                  on_change_ctx;
+};
+
+// Walks a range of the sequence as slices of the buffers its pieces reference
+typedef struct {
+  piece_table_t*      pt;
+  piece_descriptor_t* pd;
+  unsigned int        offset;
+  unsigned int        remaining;
+} piece_table_span_iter_t;
+
+// An immutable view of the sequence as slices of its buffers
+typedef struct {
+  struct iovec* slices;
+  unsigned int  num_slices;
+  size_t        length;
+  unsigned int  dirty_mark;
+  atomic_size_t written;
+} piece_table_snapshot_t;
 
 seq_buffer_t* seq_buffer_init(void);
 void          seq_buffer_free(seq_buffer_t* self);
+const char*   seq_buffer_state(seq_buffer_t* self);
+void          seq_buffer_index_line_breaks(seq_buffer_t* self, unsigned int offset, unsigned int length);
+unsigned int  seq_buffer_line_breaks_before(seq_buffer_t* self, unsigned int offset);
+void          seq_buffer_index_async(seq_buffer_t* self, unsigned int num_workers);
+bool          seq_buffer_index_done(seq_buffer_t* self);
+void          seq_buffer_index_join(seq_buffer_t* self);
+void          seq_buffer_index_progress(seq_buffer_t* self, unsigned int* scanned, unsigned int* found);
 
-event_stack_t*            event_stack_init(void);
-void                      event_stack_free(event_stack_t* self);
-bool                      event_stack_empty(event_stack_t* self);
-piece_descriptor_range_t* event_stack_last(event_stack_t* self);
-void                      event_stack_push(event_stack_t* self, piece_descriptor_range_t* pdr);
-piece_descriptor_range_t* event_stack_pop(event_stack_t* self);
-void                      event_stack_clear(event_stack_t* self);
-piece_descriptor_range_t* event_stack_back(event_stack_t* self, unsigned int index);
-
-piece_descriptor_t* piece_descriptor_init(void);
-void                piece_descriptor_free(piece_descriptor_t* self);
+piece_descriptor_t* piece_descriptor_init(pool_t* pool);
+void                piece_descriptor_free(piece_descriptor_t* self, pool_t* pool);
 void                piece_descriptor_remove(piece_descriptor_t* self);
 
-piece_descriptor_range_t* piece_descriptor_range_init(void);
-void                      piece_descriptor_range_free(piece_descriptor_range_t* self);
+piece_descriptor_range_t* piece_descriptor_range_init(pool_t* pool);
+void                      piece_descriptor_range_free(piece_descriptor_range_t* self, pool_t* pool);
 void piece_descriptor_range_append(piece_descriptor_range_t* self, piece_descriptor_t* pd);
 void piece_descriptor_range_append_range(piece_descriptor_range_t* self, piece_descriptor_range_t* pdr);
 void piece_descriptor_range_prepend_range(piece_descriptor_range_t* self, piece_descriptor_range_t* pdr);
@@ -87,28 +235,60 @@ void piece_descriptor_range_as_boundary(piece_descriptor_range_t* self, piece_de
 
 piece_table_t* piece_table_init(void);
 void           piece_table_setup(piece_table_t* self, char* piece);
+void           piece_table_setup_mapped(piece_table_t* self, const char* mapping, unsigned int length, unsigned int eager_lines);
+bool           piece_table_indexing(piece_table_t* self);
+bool           piece_table_index_poll(piece_table_t* self);
+void           piece_table_index_sync(piece_table_t* self);
+unsigned int   piece_table_line_count_estimate(piece_table_t* self);
 void           piece_table_free(piece_table_t* self);
 unsigned int   piece_table_size(piece_table_t* self);
+unsigned int   piece_table_line_count(piece_table_t* self);
+unsigned int   piece_table_line_start(piece_table_t* self, unsigned int lineno);
+unsigned int   piece_table_line_from_index(piece_table_t* self, unsigned int index);
+unsigned int   piece_table_piece_count(piece_table_t* self);
+unsigned int   piece_table_compact(piece_table_t* self, bool repack);
+void           piece_table_set_history_meta_budget(piece_table_t* self, size_t budget);
+size_t         piece_table_history_meta_size(piece_table_t* self);
+unsigned int   piece_table_history_spilled(piece_table_t* self);
+void           piece_table_history_clear(piece_table_t* self);
+bool           piece_table_can_undo(piece_table_t* self);
+bool           piece_table_can_redo(piece_table_t* self);
+bool           piece_table_history_load(piece_table_t* self, const char* path, uint64_t version);
+void           piece_table_on_change(piece_table_t* self, piece_table_change_fn* fn, void* ctx);
+void           piece_table_history_saved(piece_table_t* self, unsigned int mark, size_t length, uint64_t version);
 
-void piece_table_insert(piece_table_t* self, unsigned int index, char* piece, void* metadata);
-void piece_table_delete(piece_table_t* self, unsigned int index, unsigned int length, piece_table_event ev, void* metadata);
-void* piece_table_undo(piece_table_t* self);
-piece_descriptor_range_t* piece_table_undo_range_init(piece_table_t* self, unsigned int index, unsigned int length, void* metadata);
-void* piece_table_redo(piece_table_t* self);
+void piece_table_insert(piece_table_t* self, unsigned int index, char* piece, const undo_cursor_t* cursor);
+void piece_table_insert_n(piece_table_t* self, unsigned int index, const char* piece, unsigned int length, const undo_cursor_t* cursor);
+void piece_table_delete(piece_table_t* self, unsigned int index, unsigned int length, piece_table_event ev, const undo_cursor_t* cursor);
+const undo_cursor_t* piece_table_undo(piece_table_t* self);
+piece_descriptor_range_t* piece_table_undo_range_init(piece_table_t* self, unsigned int index, unsigned int length, const undo_cursor_t* cursor);
+const undo_cursor_t* piece_table_redo(piece_table_t* self);
+const undo_cursor_t* piece_table_travel_steps(piece_table_t* self, int steps);
+const undo_cursor_t* piece_table_travel_time(piece_table_t* self, time_t when);
+time_t               piece_table_state_time(piece_table_t* self);
+void piece_table_group_begin(piece_table_t* self);
+void piece_table_group_end(piece_table_t* self);
 
+void piece_table_span_iter_init(piece_table_span_iter_t* self, piece_table_t* pt, unsigned int index, unsigned int length);
+bool piece_table_span_iter_next(piece_table_span_iter_t* self, const char** span, unsigned int* length);
 unsigned int piece_table_render(piece_table_t* self, unsigned int index, unsigned int length, char* dest);
-void* piece_table_do_stack_event(piece_table_t* self, event_stack_t* src, event_stack_t* dest);
+piece_table_snapshot_t* piece_table_snapshot(piece_table_t* self);
+void                    piece_table_snapshot_free(piece_table_snapshot_t* self);
+io_write_all_result     piece_table_snapshot_write(piece_table_snapshot_t* self, int fd, size_t* n_write_ptr);
 seq_buffer_t* piece_table_alloc_buffer(piece_table_t* self, unsigned int max_size);
 seq_buffer_t* piece_table_alloc_add_buffer(piece_table_t* self, unsigned int max_size);
-unsigned int  piece_table_import_buffer(piece_table_t* self, char* s, unsigned int length);
+unsigned int  piece_table_import_buffer(piece_table_t* self, const char* s, unsigned int length);
 void piece_table_swap_desc_ranges(piece_table_t* self, piece_descriptor_range_t* src, piece_descriptor_range_t* dest);
 void piece_table_restore_desc_ranges(piece_table_t* self, piece_descriptor_range_t* pdr);
 unsigned int piece_table_desc_from_index(piece_table_t* self, unsigned int index, piece_descriptor_t** pd);
+char*        piece_table_desc_state(piece_table_t* self, piece_descriptor_t* pd);
 
 void piece_table_record_event(piece_table_t* self, piece_table_event ev, unsigned int index);
 bool piece_table_can_optimize(piece_table_t* self, piece_table_event ev, unsigned int index);
 void piece_table_break(piece_table_t* self);
 bool piece_table_dirty(piece_table_t* self);
 void piece_table_dirty_reset(piece_table_t* self);
+unsigned int piece_table_dirty_mark(piece_table_t* self);
+void piece_table_dirty_reset_to(piece_table_t* self, unsigned int mark);
 
 #endif /* PIECE_TABLE_H */
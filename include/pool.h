@@ -0,0 +1,34 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+typedef struct pool_slab pool_slab_t;
+
+struct pool_slab {
+  pool_slab_t* next;
+  unsigned int capacity;
+  unsigned int used;
+  max_align_t  data[];
+};
+
+/**
+ * Allocator for objects of one size. Objects are carved out of slabs, which
+ * double in size up to POOL_MAX_SLAB objects, and released objects are reused
+ * first. Everything is handed back at once when the pool is freed.
+ */
+typedef struct {
+  size_t       elem_size;
+  // Newest first; only the newest slab has unused space
+  pool_slab_t* slabs;
+  // Released objects, linked through their first word
+  void*        free_list;
+  unsigned int live;
+} pool_t;
+
+void  pool_init(pool_t* self, size_t elem_size);
+void  pool_free(pool_t* self);
+void* pool_alloc(pool_t* self);
+void  pool_release(pool_t* self, void* elem);
+
+#endif /* POOL_H */
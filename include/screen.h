@@ -0,0 +1,42 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "frame_buffer.h"
+
+#define SCREEN_INVERT 1
+
+// A terminal cell: one byte of text and the attributes it is drawn with
+typedef struct {
+  char          ch;
+  unsigned char flags;
+  // 256-colour palette indices, or -1 for the terminal's default
+  short         fg;
+  short         bg;
+} screen_cell_t;
+
+/**
+ * Front/back model of the terminal. Each frame is composed into `back`, then
+ * diffed against `front` - what the terminal is currently showing - so only
+ * the cells that changed are written out.
+ */
+typedef struct {
+  screen_cell_t* front;
+  screen_cell_t* back;
+  unsigned int   rows;
+  unsigned int   cols;
+  // Whether `front` reflects the terminal; if not, the next flush repaints
+  bool           valid;
+} screen_t;
+
+void screen_init(screen_t* self, unsigned int rows, unsigned int cols);
+void screen_free(screen_t* self);
+void screen_resize(screen_t* self, unsigned int rows, unsigned int cols);
+void screen_invalidate(screen_t* self);
+
+void screen_load(screen_t* self, const char* s, size_t length);
+void screen_flush(screen_t* self, frame_buffer_t* out);
+
+#endif /* SCREEN_H */
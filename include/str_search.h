@@ -1,18 +1,29 @@
 #ifndef STR_SEARCH_H
 #define STR_SEARCH_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
 
 typedef struct {
-  int    bad_char_skip[256];
-  char  *pattern;
-  size_t pattern_len;
-  int   *good_suffix_skip;
+  int           bad_char_skip[256];
+  char         *pattern;
+  size_t        pattern_len;
+  int          *good_suffix_skip;
+  // Index of the span being fed, and of the next window to try. Wider than a
+  // document index, as a skip can carry the window past the last one.
+  size_t        offset;
+  size_t        next;
+  // The last bytes fed before the span, for matches that straddle spans
+  char         *tail;
+  unsigned int  tail_len;
 } string_finder_t;
 
 /* Implements Boyer-Moore search */
-void string_finder_init(string_finder_t *self, char *pattern);
-int  string_finder_next(string_finder_t *self, char *text, unsigned int find_n);
+bool string_finder_init(string_finder_t *self, char *pattern);
+void string_finder_free(string_finder_t *self);
+bool string_finder_next(string_finder_t *self, char *text, unsigned int find_n, unsigned int *index);
+void string_finder_start(string_finder_t *self, unsigned int from);
+bool string_finder_feed(string_finder_t *self, const char *span, unsigned int length, unsigned int *index);
 
 #endif /* STR_SEARCH_H */
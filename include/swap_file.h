@@ -0,0 +1,66 @@
+#ifndef SWAP_FILE_H
+#define SWAP_FILE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "piece_table.h"
+
+// Identifies the file a swap file was started over, without reading it. All
+// zeros for a file that doesn't exist yet.
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t  mtime_sec;
+  int64_t  mtime_nsec;
+} swap_file_base_t;
+
+typedef enum {
+  SWAP_FILE_OK,
+  // A swap file over a different file was moved aside, to the path with `~`
+  SWAP_FILE_MOVED_ASIDE,
+  // Another session holds the swap file; it is left alone
+  SWAP_FILE_IN_USE,
+  SWAP_FILE_ERR,
+} swap_file_status;
+
+/**
+ * Crash recovery log. Every change to the text is appended as the bytes it
+ * replaced at an index and the bytes it put there. A background thread writes
+ * the log out in batches, and syncs it every `sync_ms`; editing only ever
+ * copies into a buffer.
+ *
+ * Each save records the file it produced, and how many changes it holds. On
+ * the next open, changes logged after the save of the file on disk are
+ * replayed, in time proportional to the log. The swap file is locked while
+ * open, so a second session over the same file doesn't take it over.
+ */
+typedef struct {
+  char*           path;
+  int             fd;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;
+  // Records waiting for the writer
+  char*           pending;
+  size_t          pending_len;
+  size_t          pending_cap;
+  // The writer is to truncate the file before writing what is pending
+  bool            reset;
+  bool            stop;
+  unsigned int    sync_ms;
+  // Changes logged since the log was last reset
+  unsigned int    num_changes;
+} swap_file_t;
+
+bool swap_file_base_of(const char* filepath, swap_file_base_t* base);
+
+swap_file_t* swap_file_open(const char* path, const swap_file_base_t* base, unsigned int sync_ms, piece_table_t* pt, int* n_recovered, swap_file_status* status);
+void         swap_file_close(swap_file_t* self, bool remove);
+void         swap_file_on_change(void* ctx, piece_table_t* pt, unsigned int index, unsigned int removed, unsigned int inserted);
+unsigned int swap_file_mark(swap_file_t* self);
+void         swap_file_saved(swap_file_t* self, unsigned int mark, const swap_file_base_t* base);
+
+#endif /* SWAP_FILE_H */
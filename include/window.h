@@ -1,7 +1,7 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
-#include "libutil/libutil.h"
+#include "frame_buffer.h"
 
 #define DEFAULT_LNPAD 3
 
@@ -17,10 +17,11 @@ extern inline unsigned int window_get_num_cols(void);
 
 void window_clear(void);
 void window_refresh(void);
+int  window_frame_wait_ms(void);
 void window_scroll(void);
 
-void window_draw_rows(buffer_t* buf);
-void window_draw_status_bar(buffer_t* buf);
-void window_draw_command_bar(buffer_t* buf);
+void window_draw_rows(frame_buffer_t* buf);
+void window_draw_status_bar(frame_buffer_t* buf);
+void window_draw_command_bar(frame_buffer_t* buf);
 
 #endif /* WINDOW_H */
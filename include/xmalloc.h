@@ -12,3 +12,13 @@ xmalloc (unsigned int sz) {
 
   return ptr;
 }
+
+static inline void*
+xrealloc (void* ptr, size_t sz) {
+  void* next;
+  if ((next = realloc(ptr, sz)) == NULL) {
+    panic("[xrealloc::%s] failed to allocate memory\n", __func__);
+  }
+
+  return next;
+}
@@ -1,6 +1,8 @@
 #include "command_bar.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,18 +14,27 @@
 
 static void
 command_bar_do_quit (line_editor_t* self, command_token_t* command) {
+  // Let a pending write land before deciding whether there are unsaved changes
+  editor_save_wait();
+
   if (line_buffer_dirty(editor.line_ed.r) && ((command->mods & TOKEN_MOD_OVERRIDE) != TOKEN_MOD_OVERRIDE)) {
     command_bar_set_message_mode(self, "No write since last change");
     return;
   } else {
+    // Writes the edit in progress to the undo file
+    line_buffer_break(editor.line_ed.r);
+    editor_close_swap();
     exit(0);
   }
 }
 
 static void
 command_bar_save_file (line_editor_t* self, const char* filepath) {
-  ssize_t n_bytes = editor_save(filepath);
-  command_bar_set_message_mode(self, "Wrote %d bytes to %s", n_bytes, filepath);
+  if (editor_save_async(filepath)) {
+    command_bar_set_message_mode(self, "Writing %s...", filepath);
+  } else {
+    command_bar_set_message_mode(self, "A write is already in progress");
+  }
 }
 
 static void
@@ -44,14 +55,12 @@ command_bar_do_write (line_editor_t* self, command_token_t* command) {
 
 static void
 command_bar_do_search (line_editor_t* self, command_token_t* command) {
-  char* s = xmalloc(1);
-  line_buffer_get_all(editor.line_ed.r, &s);
-
   string_finder_t sf;
-  string_finder_init(&sf, command->arg);
-  int found = string_finder_next(&sf, s, 0);
+  unsigned int    found;
+  bool            ok = string_finder_init(&sf, command->arg) && line_buffer_search(editor.line_ed.r, &sf, 0, &found);
+  string_finder_free(&sf);
 
-  if (found != -1) {
+  if (ok) {
     line_buffer_get_xy_from_index(
       editor.line_ed.r,
       found,
@@ -59,8 +68,38 @@ command_bar_do_search (line_editor_t* self, command_token_t* command) {
       &editor.line_ed.curs.y
     );
   }
+}
 
-  // free(s);
+// Parses `earlier`/`later` counts: a number of states, or with an s, m or h
+// suffix, of seconds, minutes or hours. No count means one state.
+static void
+command_bar_do_travel (line_editor_t* self, command_token_t* command, int sign) {
+  long count      = 1;
+  bool in_seconds = false;
+
+  if (command->arg) {
+    char* end;
+    long  unit = 1;
+
+    errno      = 0;
+    count      = strtol(command->arg, &end, 10);
+
+    if (*end == 's' || *end == 'm' || *end == 'h') {
+      in_seconds = true;
+      unit       = *end == 'h' ? 60 * 60 : *end == 'm' ? 60 : 1;
+      end++;
+    }
+
+    // Range-check before scaling, so the multiply cannot overflow
+    if (end == command->arg || *end != '\0' || errno == ERANGE || count < 0 || count > INT_MAX / unit) {
+      command_bar_set_message_mode(self, "Invalid count %s", command->arg);
+      return;
+    }
+
+    count *= unit;
+  }
+
+  line_editor_travel(&editor.line_ed, sign * (int)count, in_seconds);
 }
 
 void
@@ -78,10 +117,11 @@ command_bar_clear (line_editor_t* self) {
 
 void
 command_bar_process_command (line_editor_t* self) {
-  line_info_t* row = (line_info_t*)array_get(self->r->line_info, 0);
-  assert(row != NULL);
+  line_info_t row;
+  bool        ok = line_buffer_get_line_info(self->r, 0, &row);
+  assert(ok);
 
-  char line[row->line_length];
+  char line[row.line_length + 1];
   line_buffer_get_line(editor.c_bar.r, 0, line);
 
   bool             is_override = false;
@@ -90,24 +130,7 @@ command_bar_process_command (line_editor_t* self) {
   // TODO: Rename member, rename enums w/prefix
   switch (command->command) {
     case COMMAND_WRITE: {
-      if (command->arg) {
-        if ((command->mods & TOKEN_MOD_OVERRIDE) != TOKEN_MOD_OVERRIDE && file_exists(command->arg)) {
-          command_bar_set_message_mode(self, "Cannot overwrite existing file");
-        } else {
-          ssize_t n_bytes = editor_save(command->arg);
-          command_bar_set_message_mode(self, "Wrote %d bytes to %s", n_bytes, command->arg);
-        }
-
-        break;
-      }
-
-      if (!editor.filepath) {
-        command_bar_set_message_mode(self, "No file name");
-      } else {
-        int n_bytes = editor_save(editor.filepath);
-        command_bar_set_message_mode(self, "Wrote %d bytes to %s", n_bytes, editor.filepath);
-      }
-
+      command_bar_do_write(self, command);
       break;
     }
     case COMMAND_QUIT:
@@ -120,6 +143,14 @@ command_bar_process_command (line_editor_t* self) {
       command_bar_set_message_mode(self, "Unknown command");
       break;
     }
+    case COMMAND_EARLIER: {
+      command_bar_do_travel(self, command, -1);
+      break;
+    }
+    case COMMAND_LATER: {
+      command_bar_do_travel(self, command, 1);
+      break;
+    }
     case PCOMMAND_SEARCH: {
       command_bar_do_search(self, command);
       break;
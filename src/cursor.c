@@ -9,7 +9,6 @@
 #include "globals.h"
 #include "keypress.h"
 #include "tty.h"
-#include "xmalloc.h"
 
 typedef enum {
   SELECT_LEFT,
@@ -90,7 +89,7 @@ cursor_get_position (unsigned int *rows, unsigned int *cols) {
 }
 
 void
-cursor_set_position (line_editor_t *self, buffer_t *buf) {
+cursor_set_position (line_editor_t *self, frame_buffer_t *buf) {
   char curs[32];
   // clang-format off
   snprintf(
@@ -101,11 +100,11 @@ cursor_set_position (line_editor_t *self, buffer_t *buf) {
     ((cursor_get_x(self) + line_pad + 1) - cursor_get_col_off(self)) + 1
   );
   // clang-format on
-  buffer_append(buf, curs);
+  frame_buffer_append(buf, curs);
 }
 
 void
-cursor_set_position_command_bar (line_editor_t *self, buffer_t *buf) {
+cursor_set_position_command_bar (line_editor_t *self, frame_buffer_t *buf) {
   char curs[32];
   // clang-format off
   snprintf(
@@ -116,17 +115,7 @@ cursor_set_position_command_bar (line_editor_t *self, buffer_t *buf) {
     (cursor_get_x(self) - cursor_get_col_off(self)) + 1 + COMMAND_BAR_PREFIX_OFFSET
   );
   // clang-format on
-  buffer_append(buf, curs);
-}
-
-cursor_t *
-cursor_create_copy (line_editor_t *self) {
-  cursor_t *curs = xmalloc(sizeof(cursor_t));
-  curs->x        = cursor_get_x(self);
-  curs->y        = cursor_get_y(self);
-  curs->col_off  = cursor_get_col_off(self);
-
-  return curs;
+  frame_buffer_append(buf, curs);
 }
 
 void
@@ -150,16 +139,18 @@ cursor_move_left (line_editor_t *self) {
     cursor_dec_x(self);
   } else if (!cursor_on_first_line(self)) {
     // Move to end of prev line on left from col 0
-    line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_dec_y(self));
-    assert(line_info != NULL);
-    cursor_set_x(self, line_info->line_length);
+    line_info_t line_info;
+    bool        ok = line_buffer_get_line_info(self->r, cursor_dec_y(self), &line_info);
+    assert(ok);
+    cursor_set_x(self, line_info.line_length);
   }
 }
 
 void
 cursor_move_left_word (line_editor_t *self) {
-  line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self));
-  assert(line_info != NULL);
+  line_info_t line_info;
+  bool        ok = line_buffer_get_line_info(self->r, cursor_get_y(self), &line_info);
+  assert(ok);
 
   if (cursor_get_x(self) == 0) {
     cursor_move_left(self);
@@ -174,7 +165,7 @@ cursor_move_left_word (line_editor_t *self) {
 
   unsigned int i = cursor_get_x(self);
 
-  char buf[line_info->line_length];
+  char buf[line_info.line_length + 1];
   line_buffer_get_line(self->r, cursor_get_y(self), buf);
 
   // TODO: array or hashmap of break chars
@@ -199,14 +190,14 @@ cursor_move_left_word (line_editor_t *self) {
 
 void
 cursor_move_right (line_editor_t *self) {
-  line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self));
-  if (!line_info) {
+  line_info_t line_info;
+  if (!line_buffer_get_line_info(self->r, cursor_get_y(self), &line_info)) {
     return;
   }
 
-  if (cursor_get_x(self) < line_info->line_length) {
+  if (cursor_get_x(self) < line_info.line_length) {
     cursor_inc_x(self);
-  } else if (cursor_get_x(self) == line_info->line_length && !cursor_on_last_line(self)) {
+  } else if (cursor_get_x(self) == line_info.line_length && !cursor_on_last_line(self)) {
     // Move to beginning of next line on right from last col
     cursor_set_x(self, 0);
     cursor_inc_y(self);
@@ -215,37 +206,38 @@ cursor_move_right (line_editor_t *self) {
 
 void
 cursor_move_right_word (line_editor_t *self) {
-  line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self));
-  assert(line_info != NULL);
+  line_info_t line_info;
+  bool        ok = line_buffer_get_line_info(self->r, cursor_get_y(self), &line_info);
+  assert(ok);
 
-  if (cursor_get_x(self) == line_info->line_length && !cursor_on_last_line(self)) {
+  if (cursor_get_x(self) == line_info.line_length && !cursor_on_last_line(self)) {
     cursor_set_x(self, 0);
     cursor_inc_y(self);
     return;
   }
 
   // Jump to end if we're one char away
-  if (cursor_get_x(self) == line_info->line_length - 1) {
-    cursor_set_x(self, line_info->line_length);
+  if (cursor_get_x(self) == line_info.line_length - 1) {
+    cursor_set_x(self, line_info.line_length);
     return;
   }
 
   unsigned int i = cursor_get_x(self);
 
   // TODO: cache all lines in current window
-  char buf[line_info->line_length];
+  char buf[line_info.line_length + 1];
   line_buffer_get_line(self->r, cursor_get_y(self), buf);
 
   // If the very next char is a break char, jump to the start of the next word
   if (buf[i] == ' ') {
-    for (; i < line_info->line_length; i++) {
+    for (; i < line_info.line_length; i++) {
       if (buf[i] != ' ') {
         break;
       }
     }
   } else {
     // Otherwise, if we're on a word, jump to the next break char
-    for (; i < line_info->line_length; i++) {
+    for (; i < line_info.line_length; i++) {
       if (buf[i] == ' ') {
         break;
       }
@@ -283,9 +275,10 @@ cursor_move_begin (line_editor_t *self) {
 void
 cursor_move_end (line_editor_t *self) {
   if (cursor_get_y(self) < self->r->num_lines) {
-    line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self));
-    assert(line_info != NULL);
-    cursor_set_x(self, line_info->line_length);
+    line_info_t line_info;
+    bool        ok = line_buffer_get_line_info(self->r, cursor_get_y(self), &line_info);
+    assert(ok);
+    cursor_set_x(self, line_info.line_length);
   }
 }
 
@@ -302,9 +295,9 @@ cursor_move_end (line_editor_t *self) {
 // to line 1
 void
 cursor_snap_to_end (line_editor_t *self) {
-  line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self));
+  line_info_t line_info;
 
-  unsigned int length    = line_info ? line_info->line_length : 0;
+  unsigned int length = line_buffer_get_line_info(self->r, cursor_get_y(self), &line_info) ? line_info.line_length : 0;
   if (cursor_get_x(self) > length) {
     cursor_set_x(self, length);
   }
@@ -357,9 +350,10 @@ cursor_select_down (line_editor_t *self) {
   cursor_set_is_active(self, true);
 
   if (cursor_get_y(self) == self->r->num_lines - 1) {
-    line_info_t *line_info = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self));
-    assert(line_info != NULL);
-    cursor_set_select_offset(self, line_info->line_length, cursor_get_y(self));
+    line_info_t line_info;
+    bool        ok = line_buffer_get_line_info(self->r, cursor_get_y(self), &line_info);
+    assert(ok);
+    cursor_set_select_offset(self, line_info.line_length, cursor_get_y(self));
     cursor_set_x(self, self->curs.select_offset.x);
     return;
   }
@@ -1,9 +1,14 @@
 #include "editor.h"
 
-#include <aio.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "cursor.h"
@@ -11,19 +16,64 @@
 #include "globals.h"
 #include "xmalloc.h"
 
+// The version of `filepath` the undo file keeps, from its identity and mtime.
+// Any write changes it, without the text having to be read to tell.
+static uint64_t
+editor_file_version (const char *filepath) {
+  struct stat st;
+
+  if (stat(filepath, &st) == -1) {
+    return 0;
+  }
+
+  uint64_t fields[] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+  uint64_t version  = 0xcbf29ce484222325ULL;
+
+  // FNV-1a, a field at a time
+  for (unsigned int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    version = (version ^ fields[i]) * 0x100000001b3ULL;
+  }
+
+  return version;
+}
+
+// `snapshot` is the state that was written, as of `swap_mark` changes in the
+// swap file; anything edited since keeps the buffer dirty
 static void
-editor_update_file_state_on_write (const char *filepath) {
+editor_update_file_state_on_write (const char *filepath, piece_table_snapshot_t *snapshot, unsigned int swap_mark) {
   if (!editor.filepath) {
     editor.filepath = s_copy(filepath);
-    line_buffer_dirty_reset(editor.line_ed.r);
+    piece_table_dirty_reset_to(editor.line_ed.r->pt, snapshot->dirty_mark);
   } else {
     // Only clear dirty flag if we're actually writing to the current file.
     if (s_equals(filepath, editor.filepath)) {
-      line_buffer_dirty_reset(editor.line_ed.r);
+      piece_table_dirty_reset_to(editor.line_ed.r->pt, snapshot->dirty_mark);
+      piece_table_history_saved(editor.line_ed.r->pt, snapshot->dirty_mark, snapshot->length, editor_file_version(filepath));
+
+      if (editor.swap) {
+        swap_file_base_t base;
+        swap_file_base_of(filepath, &base);
+        swap_file_saved(editor.swap, swap_mark, &base);
+      }
     }
   }
 }
 
+// The undo and swap files sit beside `filepath`, hidden e.g. `dir/.name.undo`
+static char *
+editor_hidden_path (const char *filepath, const char *suffix) {
+  char *target  = realpath(filepath, NULL);
+  char *dir_cp  = s_copy(target ? target : filepath);
+  char *base_cp = s_copy(target ? target : filepath);
+  char *path    = s_fmt("%s/.%s%s", dirname(dir_cp), basename(base_cp), suffix);
+
+  free(target);
+  free(dir_cp);
+  free(base_cp);
+
+  return path;
+}
+
 void
 editor_init (editor_t *self) {
   if (tty_get_window_size(&(self->win.rows), &(self->win.cols)) == -1) {
@@ -31,7 +81,12 @@ editor_init (editor_t *self) {
   }
 
   self->conf.tab_sz               = DEFAULT_TAB_SZ;
+  self->conf.frame_rate           = DEFAULT_FRAME_RATE;
   self->conf.ln_prefix            = DEFAULT_LINE_PREFIX;
+  self->conf.undo_meta_budget     = DEFAULT_UNDO_META_BUDGET;
+  self->conf.undo_file            = DEFAULT_UNDO_FILE;
+  self->conf.swap_file            = DEFAULT_SWAP_FILE;
+  self->conf.swap_sync_ms         = DEFAULT_SWAP_SYNC_MS;
 
   // Subtract for the status bar
   self->win.rows                 -= 2;
@@ -40,83 +95,285 @@ editor_init (editor_t *self) {
 
   line_editor_init(&self->c_bar);
   line_editor_init(&self->line_ed);
+  line_buffer_set_history_meta_budget(self->line_ed.r, self->conf.undo_meta_budget);
+
+  // The screen spans the status and command bars too
+  screen_init(&self->screen, self->win.rows + 2, self->win.cols);
+  self->frame = frame_buffer_init();
+  self->out   = frame_buffer_init();
 
   self->filepath = NULL;
+  self->save_job = NULL;
+  self->swap     = NULL;
+
+  // The umask can only be read by setting it, which would race with files
+  // created on other threads; read it once, up front
+  self->file_mask = umask(0);
+  umask(self->file_mask);
 
   mode_chmod(EDIT_MODE);
 }
 
 void
 editor_free (editor_t *self) {
+  editor_save_wait();
+  editor_close_swap();
   line_buffer_free(self->c_bar.r);
   line_buffer_free(self->line_ed.r);
+  screen_free(&self->screen);
+  frame_buffer_free(self->frame);
+  frame_buffer_free(self->out);
 }
 
-// TODO: Handle very large files
+// Maps the file read-only and hands the mapping to the piece table as its
+// original buffer, so nothing is copied and pages are only faulted in as the
+// view touches them.
 void
 editor_open (const char *filepath) {
+  editor_save_wait();
+  editor_close_swap();
+
   if (file_exists(filepath)) {
-    FILE *fd = fopen(filepath, "rb+");
-    if (!fd) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd == -1) {
       panic("failed to open file %s\n", filepath);
     }
 
-    size_t             sz;
-    char              *data = xmalloc(1);
-    io_read_all_result ret  = io_read_all(fd, &data, &sz);
-    fclose(fd);
-
-    // TODO: status bar, not panic
-    switch (ret) {
-      case IO_READ_ALL_INVALID: panic("an error occurred while reading %s\n", filepath); break;
-      case IO_READ_ALL_ERR: panic("a stream error occurred while reading %s\n", filepath); break;
-      case IO_READ_ALL_TOO_LARGE:
-        panic("failed to read %s - input was too large\n", filepath);
-        break;
-      case IO_READ_ALL_NOMEM: panic("ran out of memory while reading %s\n", filepath); break;
-      case IO_READ_ALL_OK: break;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      panic("an error occurred while reading %s\n", filepath);
+    }
+
+    // Piece offsets and line positions are unsigned ints, so files are
+    // capped at 4 GiB. The buffer is left as it was.
+    if ((unsigned long long)st.st_size > UINT_MAX) {
+      close(fd);
+      mode_chmod(COMMAND_MODE);
+      command_bar_set_message_mode(&editor.c_bar, "Can't open files over 4 GiB");
+      return;
+    }
+
+    // Empty files can't be mapped, and there's nothing to load anyway
+    if (st.st_size > 0) {
+      char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        panic("failed to map file %s\n", filepath);
+      }
+
+      line_buffer_free(editor.line_ed.r);
+      editor.line_ed.r = line_buffer_init_mapped(data, st.st_size, editor.win.rows + DEFAULT_INDEX_MARGIN);
+      line_buffer_set_history_meta_budget(editor.line_ed.r, editor.conf.undo_meta_budget);
+    }
+
+    close(fd);
+  }
+
+  if (editor.conf.undo_file) {
+    char *undo_path = editor_hidden_path(filepath, ".undo");
+    line_buffer_history_load(editor.line_ed.r, undo_path, editor_file_version(filepath));
+    free(undo_path);
+  }
+
+  if (editor.conf.swap_file) {
+    swap_file_base_t base;
+    int              n_recovered;
+    swap_file_status status;
+    char            *swap_path = editor_hidden_path(filepath, ".swp");
+
+    swap_file_base_of(filepath, &base);
+    editor.swap = swap_file_open(swap_path, &base, editor.conf.swap_sync_ms, editor.line_ed.r->pt, &n_recovered, &status);
+    line_buffer_refresh(editor.line_ed.r);
+
+    if (n_recovered > 0) {
+      mode_chmod(COMMAND_MODE);
+      command_bar_set_message_mode(&editor.c_bar, "Recovered %d changes from the swap file", n_recovered);
+    } else if (status == SWAP_FILE_MOVED_ASIDE) {
+      mode_chmod(COMMAND_MODE);
+      command_bar_set_message_mode(&editor.c_bar, "Kept a swap file for another version of the file as %s~", swap_path);
+    } else if (status == SWAP_FILE_IN_USE) {
+      mode_chmod(COMMAND_MODE);
+      command_bar_set_message_mode(&editor.c_bar, "The file is open in another session; changes won't be swapped");
     }
 
-    line_buffer_insert(editor.line_ed.r, 0, 0, data, NULL);
-    event_stack_clear(editor.line_ed.r->pt->undo_stack);
-    editor.line_ed.r->pt->last_event_index = 0;
-    editor.line_ed.r->pt->last_event       = PT_SENTINEL;
+    free(swap_path);
   }
 
   editor.filepath = filepath;
 }
 
-// TODO: Logging
-int
-editor_save (const char *filepath) {
-  unsigned int sz = piece_table_size(editor.line_ed.r->pt);
-  char         s[sz];
+// Stops logging changes and deletes the swap file; for a clean exit
+void
+editor_close_swap (void) {
+  if (editor.swap) {
+    piece_table_on_change(editor.line_ed.r->pt, NULL, NULL);
+    swap_file_close(editor.swap, true);
+    editor.swap = NULL;
+  }
+}
+
+// Writes the snapshot to a temp file beside `filepath`, syncs it and renames
+// it over the target, so a crash or failed write never leaves a partial file.
+// The rename also leaves the old inode, which may back the piece table's
+// original buffer, intact until its mapping is released.
+static io_write_all_result
+editor_write_atomic (const char *filepath, piece_table_snapshot_t *snapshot, mode_t mask, size_t *n_bytes) {
+  // Write through symlinks rather than replacing them
+  char       *target   = realpath(filepath, NULL);
+  const char *path     = target ? target : filepath;
+  char       *dir_cp   = s_copy(path);
+  char       *base_cp  = s_copy(path);
+  char       *dir      = dirname(dir_cp);
+  char       *tmp_path = s_fmt("%s/.%s.XXXXXX", dir, basename(base_cp));
+
+  io_write_all_result ret = IO_WRITE_ALL_ERR;
+  *n_bytes                = 0;
+
+  int fd = mkstemp(tmp_path);
+  if (fd == -1) {
+    goto done;
+  }
+
+  // mkstemp creates the file 0600; keep the target's mode, else the default
+  struct stat st;
+  fchmod(fd, target && stat(target, &st) == 0 ? st.st_mode & 07777 : 0666 & ~mask);
+
+  ret = piece_table_snapshot_write(snapshot, fd, n_bytes);
+  if (ret == IO_WRITE_ALL_OK && fsync(fd) == -1) {
+    ret = IO_WRITE_ALL_ERR;
+  }
+
+  if (close(fd) == -1 && ret == IO_WRITE_ALL_OK) {
+    ret = IO_WRITE_ALL_ERR;
+  }
+
+  if (ret == IO_WRITE_ALL_OK && rename(tmp_path, path) == -1) {
+    ret = IO_WRITE_ALL_ERR;
+  }
+
+  if (ret != IO_WRITE_ALL_OK) {
+    unlink(tmp_path);
+    goto done;
+  }
+
+  // Persist the rename itself
+  int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+done:
+  free(target);
+  free(dir_cp);
+  free(base_cp);
+  free(tmp_path);
+
+  return ret;
+}
+
+static void *
+editor_save_job_run (void *arg) {
+  save_job_t *job = arg;
+
+  job->result = editor_write_atomic(job->filepath, job->snapshot, job->mask, &job->n_bytes);
+  atomic_store(&job->done, true);
+
+  return NULL;
+}
+
+// Snapshots the document for writing to `filepath`. Only the piece list is
+// copied.
+static save_job_t *
+editor_save_job_init (const char *filepath) {
+  save_job_t *job = xmalloc(sizeof(save_job_t));
+  job->filepath   = s_copy(filepath);
+  job->swap_mark  = editor.swap ? swap_file_mark(editor.swap) : 0;
+  job->snapshot   = piece_table_snapshot(editor.line_ed.r->pt);
+  job->mask       = editor.file_mask;
+  job->result     = IO_WRITE_ALL_ERR;
+  job->n_bytes    = 0;
+  job->threaded   = false;
+  atomic_init(&job->done, false);
+
+  return job;
+}
+
+// Joins the save job and reports its outcome. A success replaces the pending
+// "Writing..." message, if it is still up; a failure is always surfaced.
+static void
+editor_save_finish (void) {
+  save_job_t *job = editor.save_job;
+  editor.save_job = NULL;
+
+  if (job->threaded) {
+    pthread_join(job->thread, NULL);
+  }
+
+  if (job->result == IO_WRITE_ALL_OK) {
+    editor_update_file_state_on_write(job->filepath, job->snapshot, job->swap_mark);
+
+    if (editor.mode == COMMAND_MODE && editor.cmode == CB_MESSAGE) {
+      command_bar_set_message_mode(&editor.c_bar, "Wrote %zu bytes to %s", job->n_bytes, job->filepath);
+    }
+  } else {
+    mode_chmod(COMMAND_MODE);
+    command_bar_set_message_mode(&editor.c_bar, "Failed to write %s", job->filepath);
+  }
+
+  piece_table_snapshot_free(job->snapshot);
+  free(job->filepath);
+  free(job);
+}
+
+// Writes the document to `filepath` on a background thread, so this returns
+// immediately and editing carries on while the data is written. Returns false
+// if a save is already running.
+bool
+editor_save_async (const char *filepath) {
+  if (editor.save_job) {
+    return false;
+  }
+
+  save_job_t *job = editor_save_job_init(filepath);
+  job->threaded   = pthread_create(&job->thread, NULL, editor_save_job_run, job) == 0;
 
-  FILE *fd = fopen(filepath, "wb+");
-  if (!fd) {
-    // TODO: No panic - just status bar update
-    panic("failed to open file %s\n", filepath);
+  // No thread to be had; write it here, and report it as if it had one
+  if (!job->threaded) {
+    editor_save_job_run(job);
   }
 
-  piece_table_render(editor.line_ed.r->pt, 0, sz, s);
+  editor.save_job = job;
+  return true;
+}
 
-  size_t              n_bytes;
-  io_write_all_result ret = io_write_all(fd, s, &n_bytes);
-  fclose(fd);
+bool
+editor_saving (void) {
+  return !!editor.save_job;
+}
 
-  switch (ret) {
-    case IO_WRITE_ALL_INVALID:
-      panic("an error occurred while writing %s - invalid data or file descriptor\n", filepath);
-      break;
-    case IO_WRITE_ALL_ERR: panic("an error occurred while writing %s\n", filepath); break;
-    // TODO: Actually handle this somehow. Either use a swapfile or atomic op so we can rollback the file.
-    case IO_WRITE_ALL_INCOMPLETE:
-      panic("an error occurred while writing %s - incomplete write. sorry we screwed up your file oops\n", filepath);
-      break;
-    case IO_WRITE_ALL_OK: break;
+// Percentage of the running save written so far
+unsigned int
+editor_save_progress (void) {
+  if (!editor.save_job || !editor.save_job->snapshot->length) {
+    return 100;
   }
 
-  editor_update_file_state_on_write(filepath);
+  size_t written = atomic_load(&editor.save_job->snapshot->written);
+  return (unsigned int)(written * 100 / editor.save_job->snapshot->length);
+}
+
+// Finishes the save job if its thread is done; never blocks
+void
+editor_save_poll (void) {
+  if (editor.save_job && atomic_load(&editor.save_job->done)) {
+    editor_save_finish();
+  }
+}
 
-  return (int)n_bytes;
+// Blocks until any running save is done
+void
+editor_save_wait (void) {
+  if (editor.save_job) {
+    editor_save_finish();
+  }
 }
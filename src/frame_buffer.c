@@ -0,0 +1,115 @@
+#include "frame_buffer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exception.h"
+#include "xmalloc.h"
+
+#define FRAME_BUFFER_INITIAL_CAP 4096
+
+frame_buffer_t*
+frame_buffer_init (void) {
+  frame_buffer_t* self = xmalloc(sizeof(frame_buffer_t));
+  self->state          = NULL;
+  self->length         = 0;
+  self->capacity       = 0;
+
+  frame_buffer_reserve(self, FRAME_BUFFER_INITIAL_CAP);
+  frame_buffer_reset(self);
+  return self;
+}
+
+void
+frame_buffer_free (frame_buffer_t* self) {
+  free(self->state);
+  free(self);
+}
+
+// Empties the buffer but keeps its memory for the next frame
+void
+frame_buffer_reset (frame_buffer_t* self) {
+  self->length   = 0;
+  self->state[0] = '\0';
+}
+
+// Ensures there is room for `n` more bytes, plus the terminator
+void
+frame_buffer_reserve (frame_buffer_t* self, size_t n) {
+  if (n >= SIZE_MAX - self->length) {
+    panic("[frame_buffer_reserve] a frame of %zu + %zu bytes is too large\n", self->length, n);
+  }
+
+  size_t needed = self->length + n;
+  if (needed < self->capacity) {
+    return;
+  }
+
+  size_t capacity = self->capacity ? self->capacity : FRAME_BUFFER_INITIAL_CAP;
+  while (capacity <= needed) {
+    capacity = capacity > SIZE_MAX / 2 ? needed + 1 : capacity * 2;
+  }
+
+  self->state    = xrealloc(self->state, capacity);
+  self->capacity = capacity;
+}
+
+char*
+frame_buffer_state (frame_buffer_t* self) {
+  return self->state;
+}
+
+size_t
+frame_buffer_size (frame_buffer_t* self) {
+  return self->length;
+}
+
+void
+frame_buffer_append_with (frame_buffer_t* self, const char* s, size_t n) {
+  frame_buffer_reserve(self, n);
+  memcpy(self->state + self->length, s, n);
+  self->length              += n;
+  self->state[self->length]  = '\0';
+}
+
+void
+frame_buffer_append (frame_buffer_t* self, const char* s) {
+  frame_buffer_append_with(self, s, strlen(s));
+}
+
+void
+frame_buffer_append_char (frame_buffer_t* self, char c) {
+  frame_buffer_append_with(self, &c, 1);
+}
+
+// Appends `n` copies of `c`
+void
+frame_buffer_fill (frame_buffer_t* self, char c, size_t n) {
+  frame_buffer_reserve(self, n);
+  memset(self->state + self->length, c, n);
+  self->length              += n;
+  self->state[self->length]  = '\0';
+}
+
+// Appends `n` in decimal, right-aligned in a field of `width` i.e. "%*u"
+void
+frame_buffer_append_uint (frame_buffer_t* self, unsigned int n, unsigned int width) {
+  char         digits[10];
+  unsigned int num_digits = 0;
+
+  do {
+    digits[num_digits++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+
+  if (width > num_digits) {
+    frame_buffer_fill(self, ' ', width - num_digits);
+  }
+
+  frame_buffer_reserve(self, num_digits);
+  while (num_digits) {
+    self->state[self->length++] = digits[--num_digits];
+  }
+  self->state[self->length] = '\0';
+}
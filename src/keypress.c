@@ -1,8 +1,10 @@
 #include "keypress.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "command_bar.h"
@@ -10,6 +12,8 @@
 #include "exception.h"
 #include "globals.h"
 #include "line_editor.h"
+#include "window.h"
+#include "xmalloc.h"
 
 typedef enum {
   KEYPRESS_SHIFT = 1,
@@ -48,15 +52,63 @@ static int CTRL_SHIFT_LEFT_MAP[] = {
   CTRL_SHIFT_ARROW_LEFT,
 };
 
+#define KEYPRESS_INPUT_SZ 4096
+
+// Bytes read from the terminal but not handled yet. Whatever is available is
+// read in one go, so a burst of input costs one read rather than one per byte.
+static struct {
+  char         data[KEYPRESS_INPUT_SZ];
+  unsigned int head;
+  unsigned int length;
+} input;
+
+// Takes the next byte of input, refilling the buffer when it runs out. Returns
+// 1, or the failed read's result: 0 on timeout, -1 on error.
+static int
+keypress_read_byte (char* c) {
+  if (input.head == input.length) {
+    ssize_t n = read(STDIN_FILENO, input.data, sizeof(input.data));
+    if (n <= 0) {
+      return n;
+    }
+
+    input.head   = 0;
+    input.length = n;
+  }
+
+  *c = input.data[input.head++];
+  return 1;
+}
+
+// Waits up to `timeout_ms` for input. Returns whether there is any to handle.
+bool
+keypress_wait (int timeout_ms) {
+  if (input.head < input.length) {
+    return true;
+  }
+
+  struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+
 static int
 keypress_read (unsigned int* flags) {
   int  bytes_read;
   char c;
 
-  while ((bytes_read = read(STDIN_FILENO, &c, 1)) != 1) {
+  while ((bytes_read = keypress_read_byte(&c)) != 1) {
     if (bytes_read == -1 && errno != EAGAIN) {
       panic("read failed and returned %d\n", bytes_read);
     }
+
+    // Keep the approximate line count and save progress current
+    if (bytes_read == 0 && (line_buffer_indexing(editor.line_ed.r) || editor_saving())) {
+      window_refresh();
+    }
+
+    if (bytes_read == 0) {
+      line_buffer_compact(editor.line_ed.r);
+    }
   }
 
   // If the char is an escape sequence...
@@ -64,10 +116,10 @@ keypress_read (unsigned int* flags) {
     char seq[5];
 
     // Nothing else; just an esc seq literal
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) {
+    if (keypress_read_byte(&seq[0]) != 1) {
       return ESC_SEQ_CHAR;
     }
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) {
+    if (keypress_read_byte(&seq[1]) != 1) {
       return ESC_SEQ_CHAR;
     }
 
@@ -75,10 +127,27 @@ keypress_read (unsigned int* flags) {
     if (seq[0] == '[') {
       // If the second byte is a digit...
       if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) {
+        if (keypress_read_byte(&seq[2]) != 1) {
           return ESC_SEQ_CHAR;
         }
 
+        // Start of a bracketed paste, ESC [ 2 0 0 ~, or F9, ESC [ 2 0 ~
+        if (seq[1] == '2' && seq[2] == '0') {
+          if (keypress_read_byte(&seq[3]) != 1) {
+            return ESC_SEQ_CHAR;
+          }
+
+          if (seq[3] == '~') {
+            return UNKNOWN;
+          }
+
+          if (keypress_read_byte(&seq[4]) != 1) {
+            return ESC_SEQ_CHAR;
+          }
+
+          return seq[3] == '0' && seq[4] == '~' ? PASTE : UNKNOWN;
+        }
+
         if (seq[2] == '~') {
           switch (seq[1]) {
             case '3': return DELETE;
@@ -92,7 +161,7 @@ keypress_read (unsigned int* flags) {
         }
 
         if (seq[2] == ';') {
-          if (read(STDIN_FILENO, &seq[3], 1) != 1) {
+          if (keypress_read_byte(&seq[3]) != 1) {
             return ESC_SEQ_CHAR;
           }
 
@@ -105,7 +174,7 @@ keypress_read (unsigned int* flags) {
               break;
           }
 
-          if (read(STDIN_FILENO, &seq[4], 1) != 1) {
+          if (keypress_read_byte(&seq[4]) != 1) {
             return ESC_SEQ_CHAR;
           }
 
@@ -170,6 +239,83 @@ keypress_read (unsigned int* flags) {
   return c;
 }
 
+// Read timeouts, of 100ms each, to wait for the rest of a paste
+#define KEYPRESS_PASTE_MAX_WAITS 10
+
+// Reads a bracketed paste up to its end marker. Terminals send line breaks as
+// carriage returns; these become newlines.
+static char*
+keypress_read_paste (void) {
+  static const char end[]      = ESC_SEQ_PASTE_END;
+  size_t            end_length = sizeof(end) - 1;
+  unsigned int      waits      = 0;
+  size_t            length     = 0;
+  size_t            cap        = 256;
+  char*             s          = xmalloc(cap);
+
+  while (length < end_length || memcmp(s + length - end_length, end, end_length) != 0) {
+    if (length + 1 == cap) {
+      cap *= 2;
+      s    = xrealloc(s, cap);
+    }
+
+    int r = keypress_read_byte(&s[length]);
+    if (r == 1) {
+      length++;
+      waits = 0;
+      continue;
+    }
+
+    // Don't hang on a paste whose end marker never arrives
+    if ((r == -1 && errno != EAGAIN) || ++waits == KEYPRESS_PASTE_MAX_WAITS) {
+      end_length = 0;
+      break;
+    }
+  }
+
+  length -= end_length;
+
+  // Normalise line breaks, and drop NULs, which can't be inserted
+  size_t n    = 0;
+  char   prev = '\0';
+  for (size_t i = 0; i < length; i++) {
+    char c = s[i];
+
+    if (c != '\0' && !(c == '\n' && prev == '\r')) {
+      s[n++] = c == '\r' ? '\n' : c;
+    }
+    prev = c;
+  }
+  s[n] = '\0';
+
+  return s;
+}
+
+static void
+keypress_handle_paste (void) {
+  char* s = keypress_read_paste();
+
+  if (!*s || (editor.mode == COMMAND_MODE && editor.cmode == CB_MESSAGE)) {
+    free(s);
+    return;
+  }
+
+  cursor_select_clear(&editor.line_ed);
+
+  if (editor.mode == EDIT_MODE) {
+    line_editor_insert_block(&editor.line_ed, s);
+    cursor_snap_to_end(&editor.line_ed);
+  } else {
+    // Commands are a single line
+    for (char* nl = s; (nl = strchr(nl, '\n'));) {
+      *nl = ' ';
+    }
+    line_editor_insert_block(&editor.c_bar, s);
+  }
+
+  free(s);
+}
+
 static void
 keypress_handle_edit_mode_key (int c) {
   switch (c) {
@@ -277,6 +423,11 @@ keypress_handle (void) {
   unsigned int flags = 0;
   int          c     = keypress_read(&flags);
 
+  if (c == PASTE) {
+    keypress_handle_paste();
+    return;
+  }
+
   if (editor.mode == COMMAND_MODE && editor.cmode == CB_MESSAGE) {
     keypress_handle_command_message_mode(c);
     return;
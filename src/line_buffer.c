@@ -7,42 +7,41 @@
 #include "globals.h"
 #include "xmalloc.h"
 
-static line_info_t *
-line_info_init (unsigned int start, unsigned int length) {
-  line_info_t *self = xmalloc(sizeof(line_info_t));
-  self->line_start  = start;
-  self->line_length = length;
+#define LINE_BUFFER_COMPACT_MIN_PIECES 256
 
-  return self;
+// Returns the length of line `lineno`, excluding its line break
+static unsigned int
+line_buffer_line_length (line_buffer_t *self, unsigned int lineno, unsigned int line_start) {
+  unsigned int line_end = lineno + 1 < self->num_lines ? piece_table_line_start(self->pt, lineno + 1) - 1
+                                                       : piece_table_size(self->pt);
+  return line_end - line_start;
 }
 
-static void
-line_info_free (line_info_t *self) {
-  free(self);
-}
+line_buffer_t *
+line_buffer_init (char *initial) {
+  line_buffer_t *self = xmalloc(sizeof(line_buffer_t));
+  self->num_lines     = 1;
+  self->pt            = piece_table_init();
+  self->compact_at    = LINE_BUFFER_COMPACT_MIN_PIECES;
 
-static void
-line_buffer_reset (line_buffer_t *self) {
-  buffer_free(self->tmp_buffer);
-  array_free(self->line_info, (free_fn *)line_info_free);  // TODO: optimize
-  array_free(self->line, NULL);
+  piece_table_setup(self->pt, initial);
+  line_buffer_refresh(self);
 
-  self->tmp_buffer = buffer_init(NULL);
-  self->line_info  = array_init();
-  self->num_lines  = 1;
-  self->line       = array_init();
+  return self;
 }
 
+// Initializes a line buffer whose original text is a read-only file mapping.
+// Ownership of the mapping passes to the line buffer. Only `eager_lines` lines
+// are indexed before returning; see `piece_table_setup_mapped`.
 line_buffer_t *
-line_buffer_init (char *initial) {
+line_buffer_init_mapped (const char *mapping, unsigned int length, unsigned int eager_lines) {
   line_buffer_t *self = xmalloc(sizeof(line_buffer_t));
-  self->line_info     = array_init();
   self->num_lines     = 1;
-  self->line          = array_init();
-  self->tmp_buffer    = buffer_init(NULL);
   self->pt            = piece_table_init();
+  self->compact_at    = LINE_BUFFER_COMPACT_MIN_PIECES;
 
-  piece_table_setup(self->pt, initial);
+  piece_table_setup_mapped(self->pt, mapping, length, eager_lines);
+  self->num_lines = piece_table_line_count(self->pt);
 
   return self;
 }
@@ -50,141 +49,231 @@ line_buffer_init (char *initial) {
 void
 line_buffer_free (line_buffer_t *self) {
   piece_table_free(self->pt);
-  buffer_free(self->tmp_buffer);
-  array_free(self->line_info, NULL);
-  array_free(self->line, NULL);
   free(self);
 }
 
+// Syncs the cached line count with the piece table. This is O(1): the piece
+// table keeps the line break totals up to date as it is edited. Picks up the
+// background line index too, if it has finished.
 void
 line_buffer_refresh (line_buffer_t *self) {
-  line_buffer_reset(self);
+  piece_table_index_poll(self->pt);
+  self->num_lines = piece_table_line_count(self->pt);
+}
 
-  unsigned int doc_size     = piece_table_size(self->pt);
+bool
+line_buffer_indexing (line_buffer_t *self) {
+  return piece_table_indexing(self->pt);
+}
 
-  unsigned int offset_chars = 0;
-  unsigned int line_start   = 0;
-  unsigned int num_lines    = 1;
-  unsigned int line_length  = 0;
+unsigned int
+line_buffer_line_count_estimate (line_buffer_t *self) {
+  return piece_table_line_count_estimate(self->pt);
+}
 
-  if (doc_size == 0) {
-    line_info_t *li = line_info_init(0, 0);
-    array_push(self->line_info, (void *)li);
-    self->num_lines = 1;
-    return;
+// While the file is still being indexed, the last known line runs on into the
+// unindexed text. Anything that needs it has to wait for the full index.
+static void
+line_buffer_index_sync_from (line_buffer_t *self, unsigned int lineno) {
+  if (lineno + 1 >= self->num_lines && piece_table_indexing(self->pt)) {
+    piece_table_index_sync(self->pt);
+    line_buffer_refresh(self);
   }
+}
 
-  for (; offset_chars < doc_size;) {
-    line_length++;
-    char c[2];
-
-    piece_table_render(self->pt, offset_chars++, 1, c);
-    buffer_append(self->tmp_buffer, c);
-
-    if (c[0] == '\n') {
-      line_info_t *li = line_info_init(line_start, line_length - 1);
-      array_push(self->line_info, (void *)li);
-
-      line_start  = offset_chars;
-      line_length = 0;
-      num_lines++;
-    }
-  }
+bool
+line_buffer_get_line_info (line_buffer_t *self, unsigned int lineno, line_info_t *li) {
+  line_buffer_index_sync_from(self, lineno);
 
-  if (doc_size) {
-    line_info_t *li = line_info_init(line_start, line_length);
-    array_push(self->line_info, (void *)li);
+  if (lineno >= self->num_lines) {
+    return false;
   }
 
-  self->num_lines = num_lines;
+  li->line_start  = piece_table_line_start(self->pt, lineno);
+  li->line_length = line_buffer_line_length(self, lineno, li->line_start);
+  return true;
 }
 
 void
 line_buffer_get_line (line_buffer_t *self, unsigned int lineno, char *buffer) {
-  assert(self->num_lines > lineno);
+  line_info_t li;
+  bool        ok = line_buffer_get_line_info(self, lineno, &li);
+  assert(ok);
 
-  line_info_t *line_info   = (line_info_t *)array_get(self->line_info, lineno);
-  unsigned int line_start  = line_info->line_start;
-  unsigned int line_length = line_info->line_length;
+  piece_table_render(self->pt, li.line_start, li.line_length, buffer);
+}
 
-  if (line_length == 0) {
-    buffer = "";
-    return;
-  }
+// Renders the whole text into a new string, for the caller to free. Prefer
+// walking `piece_table_span_iter_t`s for anything the size of the document.
+char *
+line_buffer_get_all (line_buffer_t *self) {
+  unsigned int sz = piece_table_size(self->pt);
+  char        *s  = xmalloc(sz + 1);
 
-  char *line = s_substr(buffer_state(self->tmp_buffer), line_start, line_start + line_length, false);
+  piece_table_render(self->pt, 0, sz, s);
+  return s;
+}
 
-  memcpy(buffer, line, strlen(line) + 1);
-  buffer[strlen(line) + 1] = '\0';
+// Finds the first match of `sf` at or after `from`. Returns whether there is
+// one, with `index` set to its index. The buffers the pieces reference are
+// searched in place, in one pass.
+bool
+line_buffer_search (line_buffer_t *self, string_finder_t *sf, unsigned int from, unsigned int *index) {
+  piece_table_span_iter_t it;
+  const char             *span;
+  unsigned int            length;
+  unsigned int            sz = piece_table_size(self->pt);
+
+  if (from > sz) {
+    return false;
+  }
 
-  free(line);
-}
+  if (sf->pattern_len == 0) {
+    *index = from;
+    return true;
+  }
 
-void
-line_buffer_get_all (line_buffer_t *self, char **buffer) {
-  unsigned int sz = piece_table_size(self->pt);
-  char         s[sz];
+  string_finder_start(sf, from);
+  piece_table_span_iter_init(&it, self->pt, from, sz - from);
 
-  piece_table_render(self->pt, 0, sz, s);
-  *buffer = s;
+  while (piece_table_span_iter_next(&it, &span, &length)) {
+    if (string_finder_feed(sf, span, length, index)) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
+// Resolves an x, y pair to an absolute index. A negative x addresses the
+// preceding line breaks e.g. x = -1 is the break that ends line y - 1.
 static unsigned int
 get_absolute_index (line_buffer_t *self, int x, int y) {
-  if (array_size(self->line_info) == 0) {
-    return 0;
-  }
-
-  return ((line_info_t *)array_get(self->line_info, y))->line_start + x;
+  return (int)piece_table_line_start(self->pt, y) + x;
 }
 
 void
 line_buffer_get_xy_from_index (line_buffer_t *self, unsigned int index, unsigned int *x, unsigned int *y) {
-  foreach (self->line_info, i) {
-    line_info_t *li    = (line_info_t *)array_get(self->line_info, i);
-    unsigned int start = li->line_start;
-    unsigned int end   = li->line_start + li->line_length;
-
-    if (start <= index && end >= index) {
-      *x = index - start;
-      *y = i;
-      return;
-    }
+  unsigned int lineno = piece_table_line_from_index(self->pt, index);
+  if (piece_table_indexing(self->pt) && lineno + 1 >= self->num_lines) {
+    line_buffer_index_sync_from(self, lineno);
+    lineno = piece_table_line_from_index(self->pt, index);
   }
 
-  assert(false);
+  *x = index - piece_table_line_start(self->pt, lineno);
+  *y = lineno;
 }
 
-// TODO: store metadata only when needed (when dealing with a group)
-// Perhaps we return a bool or enum indicating when the metadata wasn't needed
-// so the caller can call free immediately. Storing a cursor on the heap for
-// every single piece table update is a bit heavy-handed.
+// The cursor, if given, is copied into the undo history and handed back when
+// the edit is undone
 void
-line_buffer_insert (line_buffer_t *self, int x, int y, char *insert_chars, void *metadata) {
-  unsigned int absolute_index = get_absolute_index(self, x, y);
-  piece_table_insert(self->pt, absolute_index, insert_chars, metadata);
+line_buffer_insert (line_buffer_t *self, int x, int y, char *insert_chars, const undo_cursor_t *cursor) {
+  piece_table_insert(self->pt, get_absolute_index(self, x, y), insert_chars, cursor);
   line_buffer_refresh(self);
 }
 
 void
-line_buffer_delete (line_buffer_t *self, int x, int y, void *metadata) {
-  unsigned int absolute_index = get_absolute_index(self, x, y);
-  piece_table_delete(self->pt, absolute_index, 1, PT_DELETE, metadata);
+line_buffer_delete (line_buffer_t *self, int x, int y, const undo_cursor_t *cursor) {
+  line_buffer_delete_n(self, x, y, 1, cursor);
+}
+
+// Deletes `n` chars starting at x, y as a single edit
+void
+line_buffer_delete_n (line_buffer_t *self, int x, int y, unsigned int n, const undo_cursor_t *cursor) {
+  piece_table_delete(self->pt, get_absolute_index(self, x, y), n, PT_DELETE, cursor);
   line_buffer_refresh(self);
 }
 
-void *
+const undo_cursor_t *
 line_buffer_undo (line_buffer_t *self) {
-  void *metadata = piece_table_undo(self->pt);
+  const undo_cursor_t *cursor = piece_table_undo(self->pt);
   line_buffer_refresh(self);
-  return metadata;
+  return cursor;
 }
 
-void *
+const undo_cursor_t *
 line_buffer_redo (line_buffer_t *self) {
-  void *metadata = piece_table_redo(self->pt);
+  const undo_cursor_t *cursor = piece_table_redo(self->pt);
+  line_buffer_refresh(self);
+  return cursor;
+}
+
+// Goes back, or forward, `steps` states in the order they were made, across
+// undo branches
+const undo_cursor_t *
+line_buffer_travel_steps (line_buffer_t *self, int steps) {
+  const undo_cursor_t *cursor = piece_table_travel_steps(self->pt, steps);
+  line_buffer_refresh(self);
+  return cursor;
+}
+
+// Goes to the state current `seconds` after, or before if negative, the
+// current state was made
+const undo_cursor_t *
+line_buffer_travel_seconds (line_buffer_t *self, int seconds) {
+  const undo_cursor_t *cursor = piece_table_travel_time(self->pt, piece_table_state_time(self->pt) + seconds);
+  line_buffer_refresh(self);
+  return cursor;
+}
+
+// Ends the current edit, so the next one is undone separately
+void
+line_buffer_break (line_buffer_t *self) {
+  piece_table_break(self->pt);
+}
+
+// Edits between these are undone in one step; see `piece_table_group_begin`
+void
+line_buffer_group_begin (line_buffer_t *self) {
+  piece_table_group_begin(self->pt);
+}
+
+void
+line_buffer_group_end (line_buffer_t *self) {
+  piece_table_group_end(self->pt);
+}
+
+// Compacts the piece table once it has fragmented enough since the last
+// pass. Meant for idle time. Returns whether it ran.
+bool
+line_buffer_compact (line_buffer_t *self) {
+  if (piece_table_piece_count(self->pt) < self->compact_at || piece_table_indexing(self->pt)) {
+    return false;
+  }
+
+  piece_table_compact(self->pt, true);
+
+  // Pieces the undo history holds on to stay; wait for as many again
+  unsigned int n   = piece_table_piece_count(self->pt);
+  self->compact_at = n * 2 > LINE_BUFFER_COMPACT_MIN_PIECES ? n * 2 : LINE_BUFFER_COMPACT_MIN_PIECES;
+  return true;
+}
+
+void
+line_buffer_set_history_meta_budget (line_buffer_t *self, size_t budget) {
+  piece_table_set_history_meta_budget(self->pt, budget);
+}
+
+// Keeps the undo history in the file at `path`, restoring it if the text is
+// in a state it saved; see `piece_table_history_load`
+bool
+line_buffer_history_load (line_buffer_t *self, const char *path, uint64_t version) {
+  bool ok = piece_table_history_load(self->pt, path, version);
   line_buffer_refresh(self);
-  return metadata;
+  return ok;
+}
+
+// Bytes of undo history bookkeeping held in memory, not counting the text it
+// refers to
+size_t
+line_buffer_history_meta_size (line_buffer_t *self) {
+  return piece_table_history_meta_size(self->pt);
+}
+
+// Undo steps spilled to disk
+unsigned int
+line_buffer_history_spilled (line_buffer_t *self) {
+  return piece_table_history_spilled(self->pt);
 }
 
 bool
@@ -1,6 +1,7 @@
 #include "line_editor.h"
 
 #include <aio.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,21 +22,65 @@ line_editor_init (line_editor_t *self) {
     .select_offset = -1,
   };
 
-  self->r = line_buffer_init(NULL);
+  self->r         = line_buffer_init(NULL);
+  self->last_char = 0;
+}
+
+// The cursor as the undo history records it
+static undo_cursor_t
+line_editor_undo_cursor (line_editor_t *self) {
+  return (undo_cursor_t){cursor_get_x(self), cursor_get_y(self)};
 }
 
 void
 line_editor_insert (line_editor_t *self, char *s) {
-  line_buffer_insert(self->r, cursor_get_x(self), cursor_get_y(self), s, cursor_create_copy(self));
+  undo_cursor_t curs = line_editor_undo_cursor(self);
+  line_buffer_insert(self->r, cursor_get_x(self), cursor_get_y(self), s, &curs);
 }
 
+// Inserts `s` at the cursor as a single edit, undone in one step, and moves the
+// cursor past it
 void
-line_editor_insert_char (line_editor_t *self, int c) {
-  char cp[1];
+line_editor_insert_block (line_editor_t *self, char *s) {
+  line_buffer_group_begin(self->r);
+  line_editor_insert(self, s);
+  line_buffer_group_end(self->r);
+
+  unsigned int num_newlines = 0;
+  char        *last_line    = s;
+
+  for (char *nl = s; (nl = strchr(nl, '\n')); nl++) {
+    num_newlines++;
+    last_line = nl + 1;
+  }
+
+  if (num_newlines) {
+    cursor_set_xy(self, strlen(last_line), cursor_get_y(self) + num_newlines);
+  } else {
+    cursor_set_x(self, cursor_get_x(self) + strlen(s));
+  }
+}
+
+// Typing is undone a word at a time, each word along with the whitespace
+// after it. A line break ends a word too, so lines are undone separately.
+static void
+line_editor_type (line_editor_t *self, int c) {
+  if (!isspace(c) && isspace(self->last_char)) {
+    line_buffer_break(self->r);
+  }
+
+  char cp[2];
   cp[0] = c;
   cp[1] = '\0';
-  line_buffer_insert(self->r, cursor_get_x(self), cursor_get_y(self), cp, cursor_create_copy(self));
 
+  undo_cursor_t curs = line_editor_undo_cursor(self);
+  line_buffer_insert(self->r, cursor_get_x(self), cursor_get_y(self), cp, &curs);
+  self->last_char = c;
+}
+
+void
+line_editor_insert_char (line_editor_t *self, int c) {
+  line_editor_type(self, c);
   cursor_inc_x(self);
 }
 
@@ -46,45 +91,47 @@ line_editor_delete_char (line_editor_t *self) {
     return;
   }
 
-  cursor_t *curs = cursor_create_copy(self);
+  undo_cursor_t curs = line_editor_undo_cursor(self);
   // If char to the left of the cursor...
   if (cursor_not_at_row_begin(self)) {
-    line_buffer_delete(self->r, cursor_get_x(self) - 1, cursor_get_y(self), curs);
+    line_buffer_delete(self->r, cursor_get_x(self) - 1, cursor_get_y(self), &curs);
     cursor_dec_x(self);
   } else {
-    line_info_t *row = (line_info_t *)array_get(self->r->line_info, cursor_get_y(self) - 1);
+    line_info_t row;
+    line_buffer_get_line_info(self->r, cursor_get_y(self) - 1, &row);
     // We're at the beginning of the row
-    cursor_set_x(self, row->line_length);
-    line_buffer_delete(self->r, -1, cursor_get_y(self), curs);
+    cursor_set_x(self, row.line_length);
+    line_buffer_delete(self->r, -1, cursor_get_y(self), &curs);
     cursor_dec_y(self);
   }
 }
 
+// Deletes everything before the cursor on its line, undone in one step
 void
 line_editor_delete_line_before_x (line_editor_t *self) {
-  cursor_t *curs = cursor_create_copy(self);
-
-  while (cursor_get_x(self) != 0) {
-    cursor_dec_x(self);
-    line_buffer_delete(self->r, cursor_get_x(self), cursor_get_y(self), curs);
+  if (cursor_get_x(self) == 0) {
+    return;
   }
 
+  undo_cursor_t curs = line_editor_undo_cursor(self);
+
+  line_buffer_group_begin(self->r);
+  line_buffer_delete_n(self->r, 0, cursor_get_y(self), cursor_get_x(self), &curs);
+  line_buffer_group_end(self->r);
+
   cursor_set_x(self, 0);
 }
 
 void
 line_editor_insert_newline (line_editor_t *self) {
-  char nl[1];
-  nl[0] = '\n';
-  nl[1] = '\0';
-  line_buffer_insert(self->r, cursor_get_x(self), cursor_get_y(self), nl, cursor_create_copy(self));
+  line_editor_type(self, '\n');
   cursor_inc_y(self);
   cursor_set_x(self, 0);
 }
 
 void
 line_editor_undo (line_editor_t *self) {
-  cursor_t *old_curs = (cursor_t *)line_buffer_undo(self->r);
+  const undo_cursor_t *old_curs = line_buffer_undo(self->r);
   if (old_curs) {
     cursor_set_xy(self, old_curs->x, old_curs->y);
   }
@@ -93,7 +140,17 @@ line_editor_undo (line_editor_t *self) {
 // TODO: Need to implement shift key when not an escape sequence
 void
 line_editor_redo (line_editor_t *self) {
-  cursor_t *old_curs = (cursor_t *)line_buffer_redo(self->r);
+  const undo_cursor_t *old_curs = line_buffer_redo(self->r);
+  if (old_curs) {
+    cursor_set_xy(self, old_curs->x, old_curs->y);
+  }
+}
+
+// Moves through the undo history by `count` states, or seconds; back if
+// negative
+void
+line_editor_travel (line_editor_t *self, int count, bool in_seconds) {
+  const undo_cursor_t *old_curs = in_seconds ? line_buffer_travel_seconds(self->r, count) : line_buffer_travel_steps(self->r, count);
   if (old_curs) {
     cursor_set_xy(self, old_curs->x, old_curs->y);
   }
@@ -0,0 +1,164 @@
+#include "line_scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "xmalloc.h"
+
+#ifdef LINE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define LINE_BREAKS_INITIAL_CAP 16
+
+void
+line_breaks_init (line_breaks_t* self) {
+  self->offsets = NULL;
+  self->size    = 0;
+  self->cap     = 0;
+}
+
+void
+line_breaks_free (line_breaks_t* self) {
+  free(self->offsets);
+  line_breaks_init(self);
+}
+
+// Ensures there is room for `n` offsets in total
+void
+line_breaks_reserve (line_breaks_t* self, unsigned int n) {
+  if (n <= self->cap) {
+    return;
+  }
+
+  unsigned int cap = self->cap ? self->cap : LINE_BREAKS_INITIAL_CAP;
+  while (cap < n) {
+    cap *= 2;
+  }
+
+  self->offsets = xrealloc(self->offsets, cap * sizeof(unsigned int));
+  self->cap     = cap;
+}
+
+void
+line_breaks_append (line_breaks_t* self, line_breaks_t* other) {
+  if (other->size == 0) {
+    return;
+  }
+
+  line_breaks_reserve(self, self->size + other->size);
+  memcpy(self->offsets + self->size, other->offsets, other->size * sizeof(unsigned int));
+  self->size += other->size;
+}
+
+void
+line_scan_scalar (const char* s, unsigned int length, unsigned int base, line_breaks_t* out) {
+  // An empty slice may have no buffer behind it at all
+  if (length == 0) {
+    return;
+  }
+
+  const char* end = s + length;
+
+  for (const char* nl = s; (nl = memchr(nl, '\n', end - nl)); nl++) {
+    line_breaks_reserve(out, out->size + 1);
+    out->offsets[out->size++] = base + (nl - s);
+  }
+}
+
+#ifdef LINE_SCAN_X86
+// Appends an offset for each set bit of a 64-byte block's match mask
+static inline void
+line_scan_push_mask (line_breaks_t* out, uint64_t mask, unsigned int base) {
+  if (!mask) {
+    return;
+  }
+
+  line_breaks_reserve(out, out->size + __builtin_popcountll(mask));
+
+  for (; mask; mask &= mask - 1) {
+    out->offsets[out->size++] = base + __builtin_ctzll(mask);
+  }
+}
+
+// Both kernels compare four vectors at a time and skip the whole block on a
+// single OR-reduced test when it has no line break, so sparse text costs
+// little more than the loads.
+__attribute__((target("sse2"))) void
+line_scan_sse2 (const char* s, unsigned int length, unsigned int base, line_breaks_t* out) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  unsigned int  i  = 0;
+
+  for (; i + 64 <= length; i += 64) {
+    __m128i c0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), nl);
+    __m128i c1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i + 16)), nl);
+    __m128i c2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i + 32)), nl);
+    __m128i c3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i + 48)), nl);
+
+    if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(c2, c3)))) {
+      continue;
+    }
+
+    uint64_t m0 = (uint16_t)_mm_movemask_epi8(c0);
+    uint64_t m1 = (uint16_t)_mm_movemask_epi8(c1);
+    uint64_t m2 = (uint16_t)_mm_movemask_epi8(c2);
+    uint64_t m3 = (uint16_t)_mm_movemask_epi8(c3);
+
+    line_scan_push_mask(out, m0 | m1 << 16 | m2 << 32 | m3 << 48, base + i);
+  }
+
+  line_scan_scalar(s + i, length - i, base + i, out);
+}
+
+__attribute__((target("avx2"))) void
+line_scan_avx2 (const char* s, unsigned int length, unsigned int base, line_breaks_t* out) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  unsigned int  i  = 0;
+
+  for (; i + 128 <= length; i += 128) {
+    __m256i c0  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i)), nl);
+    __m256i c1  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i + 32)), nl);
+    __m256i c2  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i + 64)), nl);
+    __m256i c3  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i + 96)), nl);
+    __m256i any = _mm256_or_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c2, c3));
+
+    if (_mm256_testz_si256(any, any)) {
+      continue;
+    }
+
+    uint64_t m0 = (uint32_t)_mm256_movemask_epi8(c0);
+    uint64_t m1 = (uint32_t)_mm256_movemask_epi8(c1);
+    uint64_t m2 = (uint32_t)_mm256_movemask_epi8(c2);
+    uint64_t m3 = (uint32_t)_mm256_movemask_epi8(c3);
+
+    line_scan_push_mask(out, m0 | m1 << 32, base + i);
+    line_scan_push_mask(out, m2 | m3 << 32, base + i + 64);
+  }
+
+  line_scan_scalar(s + i, length - i, base + i, out);
+}
+#endif
+
+static line_scan_fn*
+line_scan_resolve (void) {
+#ifdef LINE_SCAN_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return line_scan_avx2;
+  }
+
+  if (__builtin_cpu_supports("sse2")) {
+    return line_scan_sse2;
+  }
+#endif
+
+  return line_scan_scalar;
+}
+
+void
+line_scan (const char* s, unsigned int length, unsigned int base, line_breaks_t* out) {
+  if (length == 0) {
+    return;
+  }
+
+  line_scan_resolve()(s, length, base, out);
+}
@@ -37,7 +37,13 @@ main (int argc, char const *argv[]) {
 
   while (true) {
     window_refresh();
-    keypress_handle();
+
+    // Handle everything that arrives before the next frame is due, so a paste
+    // or key repeat burst is drawn once per frame rather than once per key
+    int wait_ms;
+    do {
+      keypress_handle();
+    } while ((wait_ms = window_frame_wait_ms()) > 0 && keypress_wait(wait_ms));
   }
 
   return 0;
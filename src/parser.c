@@ -67,6 +67,8 @@ parser_parse_command (parser_t* self, array_t* tokens, command_token_t* ct) {
   IF_COMMAND("w", COMMAND_WRITE)
   IF_COMMAND("q", COMMAND_QUIT)
   IF_COMMAND("wq", COMMAND_WRITE_QUIT)
+  IF_COMMAND("earlier", COMMAND_EARLIER)
+  IF_COMMAND("later", COMMAND_LATER)
 
   switch (ct->command) {
     case COMMAND_WRITE:
@@ -124,6 +126,24 @@ parser_parse_command (parser_t* self, array_t* tokens, command_token_t* ct) {
       break;
     }
 
+    // Takes an optional count, with a time unit if any e.g. `earlier 10m`
+    case COMMAND_EARLIER:
+    case COMMAND_LATER: {
+      if (has_args) {
+        token_t* space = (token_t*)array_get(tokens, 1);
+        token_t* count = array_size(tokens) > 2 ? (token_t*)array_get(tokens, 2) : NULL;
+
+        if (space->type != TOKEN_SPACE || !count || count->type != TOKEN_STRING) {
+          SET_ERROR("expected a count");
+        } else if (array_size(tokens) > 3) {
+          SET_ERROR("trailing text");
+        } else {
+          ct->arg = s_copy(count->value);
+        }
+      }
+      break;
+    }
+
     case COMMAND_QUIT: {
       if (has_args) {
         SET_ERROR("trailing text");
@@ -1,101 +1,254 @@
 #include "piece_table.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "calc.h"
 #include "xmalloc.h"
 
+#define LINE_INDEX_CHUNK_SZ        (1 << 20)
+#define LINE_INDEX_EAGER_STEP      (1 << 16)
+#define LINE_INDEX_PARALLEL_MIN_SZ (32 << 20)
+#define LINE_INDEX_MAX_WORKERS     64
+#define PT_WRITE_IOV_BATCH         64
+#define PT_COMPACT_SMALL_PIECE     64
+#define PT_COMPACT_MAX_REPACK      4096
+#define PT_ADD_CHUNK_SZ            0x10000
+
 seq_buffer_t*
 seq_buffer_init (void) {
   seq_buffer_t* self = xmalloc(sizeof(seq_buffer_t));
   self->length       = 0;
   self->max_size     = 0;
   self->id           = 0;
-  self->buffer       = buffer_init(NULL);
+  self->data         = NULL;
+  self->mapping      = NULL;
+  self->indexed      = 0;
+  self->indexer      = NULL;
+  line_breaks_init(&self->line_breaks);
 
   return self;
 }
 
 void
 seq_buffer_free (seq_buffer_t* self) {
-  buffer_free(self->buffer);
+  if (self->indexer) {
+    atomic_store(&self->indexer->cancel, true);
+    seq_buffer_index_join(self);
+  }
+
+  free(self->data);
+  if (self->mapping) {
+    munmap((void*)self->mapping, self->length);
+  }
+  line_breaks_free(&self->line_breaks);
   free(self);
 }
 
-event_stack_t*
-event_stack_init (void) {
-  event_stack_t* self  = malloc(sizeof(event_stack_t));
-  self->event_captures = array_init();
-
-  return self;
+const char*
+seq_buffer_state (seq_buffer_t* self) {
+  return self->mapping ? self->mapping : self->data;
 }
 
+// Records the line breaks in a freshly appended slice of the buffer. Slices
+// are only ever appended, so the offsets stay sorted.
 void
-event_stack_free (event_stack_t* self) {
-  array_free(self->event_captures, free);
-  free(self);
+seq_buffer_index_line_breaks (seq_buffer_t* self, unsigned int offset, unsigned int length) {
+  self->indexed = offset + length;
+
+  // An empty buffer may have no storage to offset into
+  if (length == 0) {
+    return;
+  }
+
+  line_scan(seq_buffer_state(self) + offset, length, offset, &self->line_breaks);
 }
 
-bool
-event_stack_empty (event_stack_t* self) {
-  return array_size(self->event_captures) == 0;
+static void*
+seq_buffer_index_worker (void* arg) {
+  line_index_worker_t* w = arg;
+
+  // Steps to each chunk's end rather than adding the chunk size, which would
+  // wrap for a range ending within a chunk of UINT_MAX
+  for (unsigned int offset = w->offset, chunk_end; offset < w->end; offset = chunk_end) {
+    if (atomic_load(w->cancel)) {
+      break;
+    }
+
+    chunk_end = w->end - offset > LINE_INDEX_CHUNK_SZ ? offset + LINE_INDEX_CHUNK_SZ : w->end;
+    line_scan(w->data + offset, chunk_end - offset, offset, &w->line_breaks);
+
+    atomic_store(&w->found, w->line_breaks.size);
+    atomic_store(&w->scanned, chunk_end - w->offset);
+  }
+
+  atomic_store(&w->done, true);
+  return NULL;
 }
 
-piece_descriptor_range_t*
-event_stack_last (event_stack_t* self) {
-  if (array_size(self->event_captures) == 0) {
-    return NULL;
+// Splits the scan across cores once there's enough text to go around; small
+// files get a single worker.
+static unsigned int
+line_index_num_workers (unsigned int length) {
+  long         cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int n     = length / LINE_INDEX_PARALLEL_MIN_SZ;
+
+  if (cores > 0 && n > (unsigned int)cores) {
+    n = cores;
+  }
+
+  if (n > LINE_INDEX_MAX_WORKERS) {
+    n = LINE_INDEX_MAX_WORKERS;
   }
-  return (piece_descriptor_range_t*)array_get(self->event_captures, array_size(self->event_captures) - 1);
+
+  return n ? n : 1;
 }
 
+// Starts indexing the rest of a read-only buffer on `num_workers` background
+// threads. The buffer's text must not change until the scan has been joined.
 void
-event_stack_push (event_stack_t* self, piece_descriptor_range_t* pdr) {
-  array_push(self->event_captures, (void*)pdr);
+seq_buffer_index_async (seq_buffer_t* self, unsigned int num_workers) {
+  unsigned int length = self->length - self->indexed;
+
+  assert(num_workers > 0);
+
+  line_indexer_t* idx = xmalloc(sizeof(line_indexer_t));
+  idx->num_workers    = num_workers;
+  idx->workers        = xmalloc(idx->num_workers * sizeof(line_index_worker_t));
+  atomic_init(&idx->cancel, false);
+
+  unsigned int slice_sz = length / idx->num_workers;
+
+  for (unsigned int i = 0; i < idx->num_workers; i++) {
+    line_index_worker_t* w = &idx->workers[i];
+    w->data                = seq_buffer_state(self);
+    w->offset              = self->indexed + i * slice_sz;
+    w->end                 = i + 1 == idx->num_workers ? self->length : w->offset + slice_sz;
+    w->cancel              = &idx->cancel;
+    line_breaks_init(&w->line_breaks);
+    atomic_init(&w->scanned, 0);
+    atomic_init(&w->found, 0);
+    atomic_init(&w->done, false);
+
+    if (pthread_create(&w->thread, NULL, seq_buffer_index_worker, w) != 0) {
+      panic("[seq_buffer_index_async::%s] failed to start an indexing thread\n", __func__);
+    }
+  }
+
+  self->indexer = idx;
 }
 
-piece_descriptor_range_t*
-event_stack_pop (event_stack_t* self) {
-  piece_descriptor_range_t* pdr = array_pop(self->event_captures);
-  assert(pdr);
-  return pdr;
+bool
+seq_buffer_index_done (seq_buffer_t* self) {
+  if (!self->indexer) {
+    return true;
+  }
+
+  for (unsigned int i = 0; i < self->indexer->num_workers; i++) {
+    if (!atomic_load(&self->indexer->workers[i].done)) {
+      return false;
+    }
+  }
+
+  return true;
 }
 
+// Sums the bytes scanned and line breaks found so far, including the indexed prefix
 void
-event_stack_clear (event_stack_t* self) {
-  array_free(self->event_captures, free);
-  self->event_captures = array_init();
+seq_buffer_index_progress (seq_buffer_t* self, unsigned int* scanned, unsigned int* found) {
+  *scanned = self->indexed;
+  *found   = self->line_breaks.size;
+
+  for (unsigned int i = 0; self->indexer && i < self->indexer->num_workers; i++) {
+    *scanned += atomic_load(&self->indexer->workers[i].scanned);
+    *found   += atomic_load(&self->indexer->workers[i].found);
+  }
 }
 
-piece_descriptor_range_t*
-event_stack_back (event_stack_t* self, unsigned int index) {
-  unsigned int size = array_size(self->event_captures);
-  // TODO:
-  assert(size > 0 && index < size);
-  return (piece_descriptor_range_t*)array_get(self->event_captures, size - index - 1);
+// Waits for the background scan, then stitches each worker's breaks onto the
+// buffer's index in order. The slices are contiguous, so the result is sorted.
+void
+seq_buffer_index_join (seq_buffer_t* self) {
+  line_indexer_t* idx = self->indexer;
+
+  for (unsigned int i = 0; i < idx->num_workers; i++) {
+    pthread_join(idx->workers[i].thread, NULL);
+  }
+
+  unsigned int total = self->line_breaks.size;
+  for (unsigned int i = 0; i < idx->num_workers; i++) {
+    total += idx->workers[i].line_breaks.size;
+  }
+
+  line_breaks_reserve(&self->line_breaks, total);
+
+  for (unsigned int i = 0; i < idx->num_workers; i++) {
+    line_breaks_append(&self->line_breaks, &idx->workers[i].line_breaks);
+    line_breaks_free(&idx->workers[i].line_breaks);
+  }
+
+  // A cancelled scan is only ever joined to free the buffer
+  self->indexed = self->length;
+  self->indexer = NULL;
+
+  free(idx->workers);
+  free(idx);
+}
+
+// Returns the number of line breaks that sit before `offset` in the buffer
+unsigned int
+seq_buffer_line_breaks_before (seq_buffer_t* self, unsigned int offset) {
+  unsigned int lo = 0;
+  unsigned int hi = self->line_breaks.size;
+
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+
+    if (self->line_breaks.offsets[mid] < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
 }
 
 static int id_source = -2;  // TODO:
 
 piece_descriptor_t*
-piece_descriptor_init (void) {
-  piece_descriptor_t* self = xmalloc(sizeof(piece_descriptor_t));
+piece_descriptor_init (pool_t* pool) {
+  piece_descriptor_t* self = pool_alloc(pool);
 
   self->id                 = id_source++;
   self->offset             = 0;
   self->length             = 0;
   self->buffer             = 0;
+  self->newlines           = 0;
   self->next               = NULL;
   self->prev               = NULL;
+  self->left               = NULL;
+  self->right              = NULL;
+  self->parent             = NULL;
+  self->priority           = 0;
+  self->subtree_count      = 0;
+  self->subtree_length     = 0;
+  self->subtree_newlines   = 0;
+  self->pins               = 0;
 
   return self;
 }
 
 void
-piece_descriptor_free (piece_descriptor_t* self) {
-  free(self);
+piece_descriptor_free (piece_descriptor_t* self, pool_t* pool) {
+  pool_release(pool, self);
 }
 
 void
@@ -107,9 +260,193 @@ piece_descriptor_remove (piece_descriptor_t* self) {
   self->next->prev = self->prev;
 }
 
+static unsigned int
+piece_tree_count (piece_descriptor_t* pd) {
+  return pd ? pd->subtree_count : 0;
+}
+
+static unsigned int
+piece_tree_length (piece_descriptor_t* pd) {
+  return pd ? pd->subtree_length : 0;
+}
+
+static unsigned int
+piece_tree_newlines (piece_descriptor_t* pd) {
+  return pd ? pd->subtree_newlines : 0;
+}
+
+// xorshift32; treap priorities only need to be well spread, not unpredictable
+static unsigned int
+piece_tree_next_priority (void) {
+  static unsigned int state  = 2463534242;
+  state                     ^= state << 13;
+  state                     ^= state >> 17;
+  state                     ^= state << 5;
+  return state;
+}
+
+static void
+piece_tree_update (piece_descriptor_t* pd) {
+  pd->subtree_count    = 1 + piece_tree_count(pd->left) + piece_tree_count(pd->right);
+  pd->subtree_length   = pd->length + piece_tree_length(pd->left) + piece_tree_length(pd->right);
+  pd->subtree_newlines = pd->newlines + piece_tree_newlines(pd->left) + piece_tree_newlines(pd->right);
+
+  if (pd->left) {
+    pd->left->parent = pd;
+  }
+  if (pd->right) {
+    pd->right->parent = pd;
+  }
+}
+
+static void
+piece_tree_node_reset (piece_descriptor_t* pd) {
+  pd->left     = NULL;
+  pd->right    = NULL;
+  pd->parent   = NULL;
+  pd->priority = piece_tree_next_priority();
+  piece_tree_update(pd);
+}
+
+static piece_descriptor_t*
+piece_tree_merge (piece_descriptor_t* l, piece_descriptor_t* r) {
+  if (!l) {
+    return r;
+  }
+  if (!r) {
+    return l;
+  }
+
+  if (l->priority > r->priority) {
+    l->right = piece_tree_merge(l->right, r);
+    piece_tree_update(l);
+    return l;
+  }
+
+  r->left = piece_tree_merge(l, r->left);
+  piece_tree_update(r);
+  return r;
+}
+
+// Splits the tree `t` such that its first `k` pieces end up in `l` and the rest in `r`
+static void
+piece_tree_split (piece_descriptor_t* t, unsigned int k, piece_descriptor_t** l, piece_descriptor_t** r) {
+  if (!t) {
+    *l = *r = NULL;
+    return;
+  }
+
+  if (piece_tree_count(t->left) < k) {
+    piece_tree_split(t->right, k - piece_tree_count(t->left) - 1, &t->right, r);
+    piece_tree_update(t);
+    *l = t;
+  } else {
+    piece_tree_split(t->left, k, l, &t->left);
+    piece_tree_update(t);
+    *r = t;
+  }
+}
+
+static void
+piece_tree_set_root (piece_table_t* self, piece_descriptor_t* root) {
+  self->root = root;
+  if (root) {
+    root->parent = NULL;
+  }
+}
+
+// Returns the number of pieces preceding `pd` in the document
+static unsigned int
+piece_tree_rank (piece_descriptor_t* pd) {
+  unsigned int rank = piece_tree_count(pd->left);
+
+  for (; pd->parent; pd = pd->parent) {
+    if (pd->parent->right == pd) {
+      rank += piece_tree_count(pd->parent->left) + 1;
+    }
+  }
+
+  return rank;
+}
+
+// Recomputes the cached totals from `pd` up to the root after `pd` was resized in place
+static void
+piece_tree_refresh (piece_descriptor_t* pd) {
+  for (; pd; pd = pd->parent) {
+    piece_tree_update(pd);
+  }
+}
+
+// Re-syncs the tree with the list after the `n_removed` pieces that sat
+// between `before` and `after` were replaced by whatever is linked there now.
+static void
+piece_tree_replace_span (piece_table_t* self, piece_descriptor_t* before, unsigned int n_removed, piece_descriptor_t* after) {
+  unsigned int        rank = before == self->head ? 0 : piece_tree_rank(before) + 1;
+  piece_descriptor_t* l;
+  piece_descriptor_t* m;
+  piece_descriptor_t* r;
+
+  piece_tree_split(self->root, rank, &l, &r);
+  piece_tree_split(r, n_removed, &m, &r);
+
+  for (piece_descriptor_t* pd = before->next; pd != after; pd = pd->next) {
+    piece_tree_node_reset(pd);
+    l = piece_tree_merge(l, pd);
+  }
+
+  piece_tree_set_root(self, piece_tree_merge(l, r));
+}
+
+// Builds the tree afresh from the list, discarding the old one unvisited, as
+// its nodes may have been freed
+static void
+piece_tree_rebuild (piece_table_t* self) {
+  piece_descriptor_t* root = NULL;
+
+  for (piece_descriptor_t* pd = self->head->next; pd != self->tail; pd = pd->next) {
+    piece_tree_node_reset(pd);
+    root = piece_tree_merge(root, pd);
+  }
+
+  piece_tree_set_root(self, root);
+}
+
+static void
+piece_tree_remove (piece_table_t* self, piece_descriptor_t* pd) {
+  piece_descriptor_t* l;
+  piece_descriptor_t* m;
+  piece_descriptor_t* r;
+
+  piece_tree_split(self->root, piece_tree_rank(pd), &l, &r);
+  piece_tree_split(r, 1, &m, &r);
+  piece_tree_set_root(self, piece_tree_merge(l, r));
+}
+
+static unsigned int
+piece_tree_span_count (piece_descriptor_t* before, piece_descriptor_t* after) {
+  unsigned int n = 0;
+  for (piece_descriptor_t* pd = before->next; pd != after; pd = pd->next) {
+    n++;
+  }
+
+  return n;
+}
+
+// Counts the line breaks in the given slice of a sequence buffer without
+// touching its text
+static unsigned int
+piece_table_count_newlines (piece_table_t* self, unsigned int buffer, unsigned int offset, unsigned int length) {
+  if (length == 0) {
+    return 0;
+  }
+
+  seq_buffer_t* sb = (seq_buffer_t*)array_get(self->buffer_list, buffer);
+  return seq_buffer_line_breaks_before(sb, offset + length) - seq_buffer_line_breaks_before(sb, offset);
+}
+
 piece_descriptor_range_t*
-piece_descriptor_range_init (void) {
-  piece_descriptor_range_t* self = xmalloc(sizeof(piece_descriptor_range_t));
+piece_descriptor_range_init (pool_t* pool) {
+  piece_descriptor_range_t* self = pool_alloc(pool);
   self->is_boundary              = true;
   self->seq_length               = 0;
   self->index                    = 0;
@@ -117,13 +454,22 @@ piece_descriptor_range_init (void) {
   self->group_id                 = 0;
   self->first                    = NULL;
   self->last                     = NULL;
+  self->cursor                   = (undo_cursor_t){0, 0};
+  self->region_index             = 0;
+  self->region_length            = 0;
+  self->parent                   = NULL;
+  self->redo_child               = NULL;
+  self->num_children             = 0;
+  self->seq                      = 0;
+  self->time                     = 0;
+  self->pruned                   = false;
 
   return self;
 }
 
 void
-piece_descriptor_range_free (piece_descriptor_range_t* self) {
-  free(self);
+piece_descriptor_range_free (piece_descriptor_range_t* self, pool_t* pool) {
+  pool_release(pool, self);
 }
 
 void
@@ -187,11 +533,13 @@ piece_descriptor_range_as_boundary (piece_descriptor_range_t* self, piece_descri
 piece_table_t*
 piece_table_init (void) {
   piece_table_t* self            = xmalloc(sizeof(piece_table_t));
-  self->undo_stack               = event_stack_init();
-  self->redo_stack               = event_stack_init();
+  pool_init(&self->descriptors, sizeof(piece_descriptor_t));
+  pool_init(&self->ranges, sizeof(piece_descriptor_range_t));
+
   self->buffer_list              = array_init();
-  self->head                     = piece_descriptor_init();
-  self->tail                     = piece_descriptor_init();
+  self->head                     = piece_descriptor_init(&self->descriptors);
+  self->tail                     = piece_descriptor_init(&self->descriptors);
+  self->root                     = NULL;
   self->frag_1                   = NULL;
   self->frag_2                   = NULL;
   self->seq_length               = 0;
@@ -199,7 +547,33 @@ piece_table_init (void) {
 
   self->last_event_index         = 0;
   self->last_event               = PT_SENTINEL;
-  self->offset_since_dirty_reset = 0;
+  self->saved_seq                = 0;
+  self->group_id                 = 0;
+  self->group_depth              = 0;
+  self->last_group_id            = 0;
+
+  self->journal.file             = NULL;
+  self->journal.offsets          = NULL;
+  self->journal.size             = 0;
+  self->journal.cap              = 0;
+  self->history_meta_budget      = 0;
+
+  self->undo_file.path           = NULL;
+  self->undo_file.file           = NULL;
+  self->undo_file.base_seq       = 0;
+  self->undo_file.base_version   = 0;
+  self->undo_file.sealed_seq     = 0;
+  self->on_change                = NULL;
+  self->on_change_ctx            = NULL;
+
+  self->history.root             = piece_descriptor_range_init(&self->ranges);
+  self->history.root->time       = time(NULL);
+  self->history.current          = self->history.root;
+  self->history.nodes            = NULL;
+  self->history.start            = 0;
+  self->history.size             = 0;
+  self->history.cap              = 0;
+  self->history.last_seq         = 0;
 
   self->head->next               = self->tail;
   self->tail->prev               = self->head;
@@ -207,42 +581,155 @@ piece_table_init (void) {
   return self;
 }
 
-void
-piece_table_setup (piece_table_t* self, char* piece) {
-  unsigned int  length     = piece ? strlen(piece) : 0;
-  seq_buffer_t* add_buffer = piece_table_alloc_add_buffer(self, length);
-  if (piece) {
-    buffer_append(add_buffer->buffer, piece);
-  }
-  add_buffer->length     = length;
+// Seeds the sequence with a single piece spanning the original buffer. The
+// buffer is sized to fit, so later inserts go to a fresh add buffer.
+static void
+piece_table_setup_original (piece_table_t* self, seq_buffer_t* original, unsigned int length) {
+  original->length = length;
 
   unsigned int        id = array_size(self->buffer_list) - 1;
-  piece_descriptor_t* pd = piece_descriptor_init();
+  piece_descriptor_t* pd = piece_descriptor_init(&self->descriptors);
   pd->offset             = 0;
   pd->length             = length;
   pd->id                 = id;
+  pd->newlines           = piece_table_count_newlines(self, original->id, 0, length);
   pd->next               = self->tail;
   pd->prev               = self->head;
   self->head->next       = pd;
   self->tail->prev       = pd;
   self->seq_length       = length;
 
+  piece_tree_node_reset(pd);
+  piece_tree_set_root(self, pd);
+
   piece_table_record_event(self, PT_SENTINEL, 0);
 }
 
 void
-piece_table_free (piece_table_t* self) {
-  event_stack_free(self->undo_stack);
-  event_stack_free(self->redo_stack);
-  array_free(self->buffer_list, (free_fn*)seq_buffer_free);
+piece_table_setup (piece_table_t* self, char* piece) {
+  unsigned int  length     = piece ? strlen(piece) : 0;
+  seq_buffer_t* add_buffer = piece_table_alloc_add_buffer(self, length);
+  if (length > 0) {
+    memcpy(add_buffer->data, piece, length);
+  }
+
+  add_buffer->length = length;
+  seq_buffer_index_line_breaks(add_buffer, 0, length);
+  piece_table_setup_original(self, add_buffer, length);
+}
+
+// Like `piece_table_setup`, but the original text is a read-only mapping which
+// is used in place, never copied. The piece table takes ownership of it and
+// unmaps it on free.
+//
+// Only the first `eager_lines` lines are indexed up front; the rest of the
+// mapping is indexed in the background. Until that scan is merged, line
+// queries only see the indexed prefix, and its last line is incomplete.
+void
+piece_table_setup_mapped (piece_table_t* self, const char* mapping, unsigned int length, unsigned int eager_lines) {
+  seq_buffer_t* original = piece_table_alloc_add_buffer(self, 0);
+  original->mapping      = mapping;
+  original->length       = length;
+  original->max_size     = length;
+
+  while (original->indexed < length && original->line_breaks.size < eager_lines) {
+    unsigned int rest = length - original->indexed;
+    unsigned int step = rest > LINE_INDEX_EAGER_STEP ? LINE_INDEX_EAGER_STEP : rest;
+    seq_buffer_index_line_breaks(original, original->indexed, step);
+  }
 
-  while (self->head) {
-    piece_descriptor_t* d = self->head;
-    piece_descriptor_free(d);
-    self->head = self->head->next;
+  if (original->indexed < length) {
+    seq_buffer_index_async(original, line_index_num_workers(length - original->indexed));
   }
 
-  free(self);
+  piece_table_setup_original(self, original, length);
+}
+
+static seq_buffer_t*
+piece_table_original (piece_table_t* self) {
+  return array_size(self->buffer_list) ? (seq_buffer_t*)array_get(self->buffer_list, 0) : NULL;
+}
+
+bool
+piece_table_indexing (piece_table_t* self) {
+  seq_buffer_t* original = piece_table_original(self);
+  return original && original->indexer;
+}
+
+// Merges the background line index if it has finished, without blocking.
+// Returns true if the line count changed as a result.
+bool
+piece_table_index_poll (piece_table_t* self) {
+  if (!piece_table_indexing(self) || !seq_buffer_index_done(piece_table_original(self))) {
+    return false;
+  }
+
+  piece_table_index_sync(self);
+  return true;
+}
+
+// Waits for the background line index and merges it, then recounts the line
+// breaks of every piece that references the original buffer.
+void
+piece_table_index_sync (piece_table_t* self) {
+  if (!piece_table_indexing(self)) {
+    return;
+  }
+
+  seq_buffer_t* original = piece_table_original(self);
+  seq_buffer_index_join(original);
+
+  for (piece_descriptor_t* pd = self->head->next; pd != self->tail; pd = pd->next) {
+    if (pd->buffer == original->id) {
+      pd->newlines = piece_table_count_newlines(self, pd->buffer, pd->offset, pd->length);
+      piece_tree_refresh(pd);
+    }
+  }
+
+  // Pieces edits swapped out were counted against the partial index too
+  for (unsigned int i = 0; i < self->history.size; i++) {
+    piece_descriptor_range_t* node = self->history.nodes[self->history.start + i];
+
+    for (piece_descriptor_t* pd = node->is_boundary ? NULL : node->first; pd; pd = pd == node->last ? NULL : pd->next) {
+      if (pd->buffer == original->id) {
+        pd->newlines = piece_table_count_newlines(self, pd->buffer, pd->offset, pd->length);
+      }
+    }
+  }
+}
+
+// Waits for the background line index only if the text before `end` isn't all
+// indexed yet, so edits near the top of a large file don't wait on the rest.
+// Original text is never reordered, and until the index is merged other text
+// only goes in before the unindexed part, so the last byte decides.
+static void
+piece_table_index_sync_before (piece_table_t* self, unsigned int end) {
+  if (!piece_table_indexing(self) || end == 0) {
+    return;
+  }
+
+  seq_buffer_t*       original = piece_table_original(self);
+  piece_descriptor_t* pd;
+  unsigned int        pd_index = piece_table_desc_from_index(self, end - 1, &pd);
+
+  if (pd->buffer == original->id && pd->offset + (end - 1 - pd_index) >= original->indexed) {
+    piece_table_index_sync(self);
+  }
+}
+
+// Extrapolates the total line count from the share of the file indexed so far
+unsigned int
+piece_table_line_count_estimate (piece_table_t* self) {
+  if (!piece_table_indexing(self)) {
+    return piece_table_line_count(self);
+  }
+
+  seq_buffer_t* original = piece_table_original(self);
+  unsigned int  scanned;
+  unsigned int  found;
+  seq_buffer_index_progress(original, &scanned, &found);
+
+  return (unsigned long long)found * original->length / scanned + 1;
 }
 
 unsigned int
@@ -250,281 +737,1553 @@ piece_table_size (piece_table_t* self) {
   return self->seq_length;
 }
 
-void
-piece_table_insert (piece_table_t* self, unsigned int index, char* piece, void* metadata) {
-  unsigned int length = strlen(piece);
+unsigned int
+piece_table_line_count (piece_table_t* self) {
+  return piece_tree_newlines(self->root) + 1;
+}
 
-  assert(index <= self->seq_length);
+// Returns the index at which line `lineno` begins, found by descending the tree
+// to the piece holding the line's preceding break.
+unsigned int
+piece_table_line_start (piece_table_t* self, unsigned int lineno) {
+  assert(lineno < piece_table_line_count(self));
 
-  piece_descriptor_t* pd;
-  unsigned int        pd_index   = piece_table_desc_from_index(self, index, &pd);
+  if (lineno == 0) {
+    return 0;
+  }
 
-  unsigned int add_buffer_offset = piece_table_import_buffer(self, piece, length);
+  unsigned int        index = 0;
+  piece_descriptor_t* node  = self->root;
 
-  event_stack_clear(self->redo_stack);
+  while (node) {
+    unsigned int left_newlines = piece_tree_newlines(node->left);
 
-  unsigned int insert_offset        = index - pd_index;
+    if (lineno <= left_newlines) {
+      node = node->left;
+      continue;
+    }
 
-  piece_descriptor_range_t* new_pds = piece_descriptor_range_init();
+    lineno -= left_newlines;
+    index  += piece_tree_length(node->left);
 
-  // Inserting at the end of a prior insertion - at a pd boundary
-  if (insert_offset == 0 && piece_table_can_optimize(self, PT_INSERT, index)) {
-    assert(pd->prev);
-    // Extend the last pd's length
-    piece_descriptor_range_t* ev  = event_stack_last(self->undo_stack);
-    pd->prev->length             += length;
-    ev->length                   += length;
+    if (lineno <= node->newlines) {
+      seq_buffer_t* sb    = (seq_buffer_t*)array_get(self->buffer_list, node->buffer);
+      unsigned int  first = seq_buffer_line_breaks_before(sb, node->offset);
 
-    // Inserting at a pd boundary
-  } else if (insert_offset == 0) {
-    piece_descriptor_range_t* old_pds = piece_table_undo_range_init(self, index, length, metadata);
-    piece_descriptor_range_as_boundary(old_pds, pd->prev, pd);
+      return index + (sb->line_breaks.offsets[first + lineno - 1] - node->offset) + 1;
+    }
+
+    lineno -= node->newlines;
+    index  += node->length;
+    node    = node->right;
+  }
+
+  // Should never get here
+  assert(false);
+  return self->seq_length;
+}
+
+// Returns the line on which `index` falls, i.e. the number of breaks before it
+unsigned int
+piece_table_line_from_index (piece_table_t* self, unsigned int index) {
+  unsigned int        lineno = 0;
+  piece_descriptor_t* node   = self->root;
+
+  while (node) {
+    unsigned int left_length = piece_tree_length(node->left);
+
+    if (index < left_length) {
+      node = node->left;
+      continue;
+    }
+
+    index  -= left_length;
+    lineno += piece_tree_newlines(node->left);
+
+    if (index < node->length) {
+      return lineno + piece_table_count_newlines(self, node->buffer, node->offset, index);
+    }
+
+    index  -= node->length;
+    lineno += node->newlines;
+    node    = node->right;
+  }
+
+  return lineno;
+}
+
+// Releases a node of the undo tree along with the pieces it holds. Those are
+// out of the sequence, so nothing else references them.
+static void
+piece_table_node_free (piece_table_t* self, piece_descriptor_range_t* node) {
+  for (piece_descriptor_t* pd = node->is_boundary ? NULL : node->first; pd;) {
+    piece_descriptor_t* next = pd == node->last ? NULL : pd->next;
+    piece_descriptor_free(pd, &self->descriptors);
+    pd = next;
+  }
+
+  piece_descriptor_range_free(node, &self->ranges);
+}
+
+static inline piece_descriptor_range_t*
+undo_tree_get (undo_tree_t* self, unsigned int i) {
+  return self->nodes[self->start + i];
+}
+
+// Makes room for one more node at the front or back. Nodes come off the front
+// as they are spilled, and go back on as they are reloaded.
+static void
+undo_tree_reserve (undo_tree_t* self, bool front) {
+  if (front ? self->start > 0 : self->start + self->size < self->cap) {
+    return;
+  }
+
+  if (self->size * 2 >= self->cap) {
+    self->cap   = self->cap ? self->cap * 2 : 64;
+    self->nodes = xrealloc(self->nodes, self->cap * sizeof(piece_descriptor_range_t*));
+  }
+
+  unsigned int start = front ? (self->cap - self->size) / 2 : 0;
+  memmove(self->nodes + start, self->nodes + self->start, self->size * sizeof(piece_descriptor_range_t*));
+  self->start = start;
+}
+
+static void
+undo_tree_push (undo_tree_t* self, piece_descriptor_range_t* node) {
+  undo_tree_reserve(self, false);
+  self->nodes[self->start + self->size++] = node;
+}
+
+static void
+undo_tree_unshift (undo_tree_t* self, piece_descriptor_range_t* node) {
+  undo_tree_reserve(self, true);
+  self->nodes[--self->start] = node;
+  self->size++;
+}
+
+static void
+undo_tree_shift (undo_tree_t* self) {
+  self->start++;
+  self->size--;
+}
+
+// Returns the position of the node for state `seq`, or -1 for the root
+static int
+undo_tree_find (undo_tree_t* self, unsigned int seq) {
+  unsigned int lo = 0;
+  unsigned int hi = self->size;
+
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+
+    if (undo_tree_get(self, mid)->seq < seq) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo < self->size && undo_tree_get(self, lo)->seq == seq ? (int)lo : -1;
+}
+
+#define UNDO_FILE_MAGIC    "tblundo2"
+#define UNDO_FILE_MAGIC_SZ 8
+
+typedef enum {
+  UNDO_FILE_EDIT = 1,
+  UNDO_FILE_SAVED,
+} undo_file_record_type;
+
+// Undo file record. An edit is followed by the `old_length` bytes it replaced
+// at `region_index`, then the `new_length` bytes it put there.
+typedef struct {
+  unsigned int  type;
+  unsigned int  seq;
+  unsigned int  parent_seq;
+  unsigned int  group_id;
+  undo_cursor_t cursor;
+  int64_t       time;
+  unsigned int  region_index;
+  // For a save, the length of the text written
+  unsigned int  old_length;
+  unsigned int  new_length;
+  // For a save, the version of the file written
+  uint64_t      version;
+} undo_file_record_t;
+
+// Stops persisting the undo history e.g. after a failed write
+static void
+piece_table_undo_file_close (undo_file_t* self) {
+  if (self->file) {
+    fclose(self->file);
+  }
+  free(self->path);
+
+  self->file = NULL;
+  self->path = NULL;
+}
+
+// Starts the undo file, with the state the file was opened in as its first
+// save. Nothing has been written over the original buffer, so that is its text.
+static bool
+piece_table_undo_file_create (piece_table_t* self) {
+  undo_file_t*       uf       = &self->undo_file;
+  seq_buffer_t*      original = piece_table_original(self);
+  undo_file_record_t record   = {
+      .type       = UNDO_FILE_SAVED,
+      .seq        = uf->base_seq,
+      .old_length = original->length,
+      .version    = uf->base_version,
+  };
+
+  if (!(uf->file = fopen(uf->path, "w+b"))) {
+    return false;
+  }
+
+  return fwrite(UNDO_FILE_MAGIC, UNDO_FILE_MAGIC_SZ, 1, uf->file) == 1 && fwrite(&record, sizeof(record), 1, uf->file) == 1;
+}
+
+// Appends the current edit to the undo file, if it hasn't been yet. Called
+// before the edit stops being current or could be extended further, so edits
+// are written once each, in the order they were made. The sequence is in the
+// state right after the edit, and the node holds the pieces it replaced.
+static void
+piece_table_seal (piece_table_t* self) {
+  undo_file_t*              uf   = &self->undo_file;
+  piece_descriptor_range_t* node = self->history.current;
+
+  if (!uf->path || node == self->history.root || node->seq <= uf->sealed_seq) {
+    return;
+  }
+
+  if (!uf->file && !piece_table_undo_file_create(self)) {
+    piece_table_undo_file_close(uf);
+    return;
+  }
+
+  undo_file_record_t record = {
+    .type         = UNDO_FILE_EDIT,
+    .seq          = node->seq,
+    .parent_seq   = node->parent->seq,
+    .group_id     = node->group_id,
+    .cursor       = node->cursor,
+    .time         = node->time,
+    .region_index = node->region_index,
+    .old_length   = 0,
+    .new_length   = node->region_length,
+  };
+
+  for (piece_descriptor_t* pd = node->is_boundary ? NULL : node->first; pd; pd = pd == node->last ? NULL : pd->next) {
+    record.old_length += pd->length;
+  }
+
+  bool ok = fwrite(&record, sizeof(record), 1, uf->file) == 1;
+
+  for (piece_descriptor_t* pd = node->is_boundary ? NULL : node->first; ok && pd; pd = pd == node->last ? NULL : pd->next) {
+    ok = fwrite(piece_table_desc_state(self, pd), 1, pd->length, uf->file) == pd->length;
+  }
+
+  piece_table_span_iter_t it;
+  const char*             span;
+  unsigned int            length;
+
+  piece_table_span_iter_init(&it, self, node->region_index, node->region_length);
+  while (ok && piece_table_span_iter_next(&it, &span, &length)) {
+    ok = fwrite(span, 1, length, uf->file) == length;
+  }
+
+  if (!ok || fflush(uf->file) != 0) {
+    piece_table_undo_file_close(uf);
+    return;
+  }
+
+  uf->sealed_seq = node->seq;
+}
+
+// Records `node` as an edit made on top of the current state, and applied
+static void
+piece_table_history_add (piece_table_t* self, piece_descriptor_range_t* node) {
+  undo_tree_t* h = &self->history;
+
+  piece_table_seal(self);
+
+  node->parent   = h->current;
+  node->seq      = ++h->last_seq;
+  node->time     = time(NULL);
+
+  h->current->redo_child = node;
+  h->current->num_children++;
+
+  undo_tree_push(h, node);
+  h->current = node;
+}
+
+// Undoes the current edit
+static void
+piece_table_step_back (piece_table_t* self) {
+  piece_descriptor_range_t* node = self->history.current;
+
+  piece_table_restore_desc_ranges(self, node);
+  self->history.current = node->parent;
+}
+
+// Redoes `node`, an edit made on top of the current state
+static void
+piece_table_step_forward (piece_table_t* self, piece_descriptor_range_t* node) {
+  piece_table_restore_desc_ranges(self, node);
+  node->parent->redo_child = node;
+  self->history.current    = node;
+}
+
+// Returns the index at which `pd` starts
+static unsigned int
+piece_tree_offset (piece_table_t* self, piece_descriptor_t* pd) {
+  if (pd == self->head) {
+    return 0;
+  }
+  if (pd == self->tail) {
+    return self->seq_length;
+  }
+
+  unsigned int offset = piece_tree_length(pd->left);
+
+  for (; pd->parent; pd = pd->parent) {
+    if (pd->parent->right == pd) {
+      offset += piece_tree_length(pd->parent->left) + pd->parent->length;
+    }
+  }
+
+  return offset;
+}
+
+// Records where the latest edit's text sits, while the sequence is in the
+// state right after it. A range can then be rebuilt from indices alone.
+static void
+piece_table_measure_last (piece_table_t* self) {
+  piece_descriptor_range_t* pdr    = self->history.current;
+  piece_descriptor_t*       before = pdr->is_boundary ? pdr->first : pdr->first->prev;
+  piece_descriptor_t*       after  = pdr->is_boundary ? pdr->last : pdr->last->next;
+
+  pdr->region_index                = piece_tree_offset(self, before) + before->length;
+  pdr->region_length               = piece_tree_offset(self, after) - pdr->region_index;
+}
+
+// Journal record for one range, followed by its `num_pieces` pieces
+typedef struct {
+  unsigned int  seq_length;
+  unsigned int  index;
+  unsigned int  length;
+  unsigned int  group_id;
+  unsigned int  region_index;
+  unsigned int  region_length;
+  unsigned int  num_pieces;
+  undo_cursor_t cursor;
+  unsigned int  seq;
+  // The state the edit was made on top of
+  unsigned int  parent_seq;
+  time_t        time;
+} undo_record_t;
+
+typedef struct {
+  unsigned int buffer;
+  unsigned int offset;
+  unsigned int length;
+  unsigned int newlines;
+} undo_record_piece_t;
+
+// Bytes of descriptors and ranges held for undo and redo. The add buffer text
+// they refer to isn't counted, as spilling doesn't free it.
+size_t
+piece_table_history_meta_size (piece_table_t* self) {
+  // Every descriptor outside the sequence, sentinels aside, is held for undo or redo
+  unsigned int held = self->descriptors.live - piece_tree_count(self->root) - 2;
+  return self->ranges.live * self->ranges.elem_size + held * self->descriptors.elem_size;
+}
+
+unsigned int
+piece_table_history_spilled (piece_table_t* self) {
+  return self->journal.size;
+}
+
+void
+piece_table_set_history_meta_budget (piece_table_t* self, size_t budget) {
+  self->history_meta_budget = budget;
+}
+
+// Drops every branch off the root but the one the current state is on
+static void
+piece_table_prune_root (piece_table_t* self) {
+  undo_tree_t*              h    = &self->history;
+  piece_descriptor_range_t* keep = h->root->redo_child;
+  unsigned int              n    = 0;
+
+  // Parents are always made before their children
+  for (unsigned int i = 0; i < h->size; i++) {
+    piece_descriptor_range_t* node = undo_tree_get(h, i);
+    node->pruned                   = node->parent == h->root ? node != keep : node->parent->pruned;
+  }
+
+  for (unsigned int i = 0; i < h->size; i++) {
+    piece_descriptor_range_t* node = undo_tree_get(h, i);
+
+    if (node->pruned) {
+      piece_table_node_free(self, node);
+    } else {
+      h->nodes[h->start + n++] = node;
+    }
+  }
+
+  h->size               = n;
+  h->root->num_children = 1;
+}
+
+// Appends the oldest edit in memory to the journal and frees its pieces. Its
+// node becomes the root. Branches off the old root go, as the journal only
+// keeps a single line of history. Returns false if it couldn't be written,
+// leaving the edit in place.
+static bool
+piece_table_spill_oldest (piece_table_t* self) {
+  undo_journal_t* j = &self->journal;
+  undo_tree_t*    h = &self->history;
+
+  if (!j->file && !(j->file = tmpfile())) {
+    return false;
+  }
+
+  if (h->root->num_children > 1) {
+    piece_table_prune_root(self);
+  }
+
+  piece_descriptor_range_t* pdr    = h->root->redo_child;
+  undo_record_t             record = {
+                .seq_length    = pdr->seq_length,
+                .index         = pdr->index,
+                .length        = pdr->length,
+                .group_id      = pdr->group_id,
+                .region_index  = pdr->region_index,
+                .region_length = pdr->region_length,
+                .num_pieces    = 0,
+                .cursor        = pdr->cursor,
+                .seq           = pdr->seq,
+                .parent_seq    = h->root->seq,
+                .time          = pdr->time,
+  };
+
+  assert(pdr == undo_tree_get(h, 0));
+
+  for (piece_descriptor_t* pd = pdr->is_boundary ? NULL : pdr->first; pd; pd = pd == pdr->last ? NULL : pd->next) {
+    record.num_pieces++;
+  }
+
+  fseek(j->file, 0, SEEK_END);
+  long offset = ftell(j->file);
+  bool ok     = offset >= 0 && fwrite(&record, sizeof(record), 1, j->file) == 1;
+
+  for (piece_descriptor_t* pd = pdr->is_boundary ? NULL : pdr->first; ok && pd; pd = pd == pdr->last ? NULL : pd->next) {
+    undo_record_piece_t piece = {pd->buffer, pd->offset, pd->length, pd->newlines};
+    ok                        = fwrite(&piece, sizeof(piece), 1, j->file) == 1;
+  }
+
+  if (!ok || fflush(j->file) != 0) {
+    if (offset >= 0 && ftruncate(fileno(j->file), offset) == 0) {
+      clearerr(j->file);
+    }
+    return false;
+  }
+
+  if (j->size == j->cap) {
+    j->cap     = j->cap ? j->cap * 2 : 64;
+    j->offsets = xrealloc(j->offsets, j->cap * sizeof(long));
+  }
+  j->offsets[j->size++] = offset;
+
+  undo_tree_shift(h);
+
+  for (piece_descriptor_t* pd = pdr->is_boundary ? NULL : pdr->first; pd;) {
+    piece_descriptor_t* next = pd == pdr->last ? NULL : pd->next;
+    piece_descriptor_free(pd, &self->descriptors);
+    pd = next;
+  }
+  piece_descriptor_range_free(h->root, &self->ranges);
+
+  pdr->parent = NULL;
+  piece_descriptor_range_as_boundary(pdr, NULL, NULL);
+  h->root     = pdr;
+
+  return true;
+}
+
+// Keeps the history within budget. The latest edit always stays in memory,
+// as the next one may extend it.
+static void
+piece_table_spill_history (piece_table_t* self) {
+  undo_tree_t* h = &self->history;
+
+  while (self->history_meta_budget && piece_table_history_meta_size(self) > self->history_meta_budget &&
+         h->current != h->root && h->root->redo_child != h->current) {
+    if (!piece_table_spill_oldest(self)) {
+      break;
+    }
+  }
+}
+
+// Points the nodes that are restored after `pd` at `pd_next` instead
+static void
+piece_table_retarget_before (undo_tree_t* h, piece_descriptor_t* pd, piece_descriptor_t* pd_next) {
+  for (unsigned int i = 0; i < h->size; i++) {
+    piece_descriptor_range_t* pdr = undo_tree_get(h, i);
+
+    if (pdr->is_boundary && pdr->first == pd) {
+      pdr->first = pd_next;
+    } else if (!pdr->is_boundary && pdr->first->prev == pd) {
+      pdr->first->prev = pd_next;
+    }
+  }
+}
+
+// Returns the piece that ends at `index`, splitting the piece there if need
+// be. The left half keeps the original descriptor.
+static piece_descriptor_t*
+piece_table_boundary_at (piece_table_t* self, unsigned int index) {
+  piece_descriptor_t* pd;
+  unsigned int        pd_index = piece_table_desc_from_index(self, index, &pd);
+
+  if (pd_index == index) {
+    return pd->prev;
+  }
+
+  unsigned int        split = index - pd_index;
+  piece_descriptor_t* right = piece_descriptor_init(&self->descriptors);
+  right->buffer             = pd->buffer;
+  right->offset             = pd->offset + split;
+  right->length             = pd->length - split;
+  right->newlines           = pd->newlines - piece_table_count_newlines(self, pd->buffer, pd->offset, split);
+  right->prev               = pd;
+  right->next               = pd->next;
+
+  pd->length                = split;
+  pd->newlines             -= right->newlines;
+  pd->next->prev            = right;
+  pd->next                  = right;
+
+  piece_tree_refresh(pd);
+  piece_tree_replace_span(self, pd, 0, right->next);
+
+  piece_table_retarget_before(&self->history, pd, right);
+  return pd;
+}
+
+// Reads the newest journal record back into the root of the undo tree, which
+// it was spilled from, and puts a new root before it. Only possible with the
+// sequence at the root state, though its pieces may have been split or merged
+// since.
+static bool
+piece_table_unspill (piece_table_t* self) {
+  undo_journal_t*           j = &self->journal;
+  undo_tree_t*              h = &self->history;
+  piece_descriptor_range_t* x = h->root;
+  undo_record_t             record;
+
+  if (j->size == 0 || h->current != h->root) {
+    return false;
+  }
+
+  long offset = j->offsets[j->size - 1];
+  if (fseek(j->file, offset, SEEK_SET) != 0 || fread(&record, sizeof(record), 1, j->file) != 1) {
+    panic("[piece_table_unspill::%s] failed to read the undo journal\n", __func__);
+  }
+
+  piece_table_index_sync(self);
+  piece_table_break(self);
+  self->frag_1 = self->frag_2 = NULL;
+
+  piece_descriptor_t* before = piece_table_boundary_at(self, record.region_index);
+  piece_descriptor_t* last   = record.region_length ? piece_table_boundary_at(self, record.region_index + record.region_length) : before;
+
+  assert(x->seq == record.seq);
+
+  x->seq_length              = record.seq_length;
+  x->index                   = record.index;
+  x->length                  = record.length;
+  x->group_id                = record.group_id;
+  x->region_index            = record.region_index;
+  x->region_length           = record.region_length;
+  x->cursor                  = record.cursor;
+  x->time                    = record.time;
+  x->first                   = NULL;
+  x->last                    = NULL;
+
+  for (unsigned int i = 0; i < record.num_pieces; i++) {
+    undo_record_piece_t piece;
+    if (fread(&piece, sizeof(piece), 1, j->file) != 1) {
+      panic("[piece_table_unspill::%s] failed to read the undo journal\n", __func__);
+    }
+
+    piece_descriptor_t* pd = piece_descriptor_init(&self->descriptors);
+    pd->buffer             = piece.buffer;
+    pd->offset             = piece.offset;
+    pd->length             = piece.length;
+    // Spilled while the line index was incomplete, perhaps
+    pd->newlines           = piece_table_count_newlines(self, piece.buffer, piece.offset, piece.length);
+    piece_descriptor_range_append(x, pd);
+  }
+
+  if (x->is_boundary) {
+    piece_descriptor_range_as_boundary(x, before, last->next);
+  } else {
+    x->first->prev = before;
+    x->last->next  = last->next;
+  }
+
+  piece_descriptor_range_t* root = piece_descriptor_range_init(&self->ranges);
+  root->seq                      = record.parent_seq;
+  root->redo_child               = x;
+  root->num_children             = 1;
+
+  // When the new root's state was made is on the record before
+  if (j->size > 1) {
+    undo_record_t prev;
+    if (fseek(j->file, j->offsets[j->size - 2], SEEK_SET) != 0 || fread(&prev, sizeof(prev), 1, j->file) != 1) {
+      panic("[piece_table_unspill::%s] failed to read the undo journal\n", __func__);
+    }
+    root->time = prev.time;
+  }
+
+  x->parent                      = root;
+  h->root                        = root;
+  undo_tree_unshift(h, x);
+
+  j->size--;
+  if (ftruncate(fileno(j->file), offset) != 0) {
+    panic("[piece_table_unspill::%s] failed to truncate the undo journal\n", __func__);
+  }
+
+  return true;
+}
+
+// Returns the edit that undo would revert, reloading spilled history as needed
+static piece_descriptor_range_t*
+piece_table_undo_head (piece_table_t* self) {
+  undo_tree_t* h = &self->history;
+
+  if (h->current == h->root) {
+    piece_table_unspill(self);
+  }
+
+  return h->current == h->root ? NULL : h->current;
+}
+
+// Has `fn` told of every change to the text from here on; NULL stops it
+void
+piece_table_on_change (piece_table_t* self, piece_table_change_fn* fn, void* ctx) {
+  self->on_change     = fn;
+  self->on_change_ctx = ctx;
+}
+
+static inline void
+piece_table_changed (piece_table_t* self, unsigned int index, unsigned int removed, unsigned int inserted) {
+  if (self->on_change) {
+    self->on_change(self->on_change_ctx, self, index, removed, inserted);
+  }
+}
+
+// Inserts the `length` bytes at `piece`, which may include NULs
+void
+piece_table_insert_n (piece_table_t* self, unsigned int index, const char* piece, unsigned int length, const undo_cursor_t* cursor) {
+  assert(index <= self->seq_length);
+
+  // Piece line counts are only exact over the indexed part of the original
+  piece_table_index_sync_before(self, index);
+
+  piece_descriptor_t* pd;
+  unsigned int        pd_index   = piece_table_desc_from_index(self, index, &pd);
+
+  unsigned int add_buffer_offset = piece_table_import_buffer(self, piece, length);
+
+  unsigned int insert_offset        = index - pd_index;
+
+  piece_descriptor_range_t* new_pds = piece_descriptor_range_init(&self->ranges);
+
+  // Inserting at the end of a prior insertion - at a pd boundary
+  if (insert_offset == 0 && piece_table_can_optimize(self, PT_INSERT, index)) {
+    assert(pd->prev);
+    // Extend the last pd's length
+    piece_descriptor_range_t* ev  = self->history.current;
+    pd->prev->length             += length;
+    pd->prev->newlines           += piece_table_count_newlines(self, self->add_buffer_id, add_buffer_offset, length);
+    ev->length                   += length;
+
+    piece_tree_refresh(pd->prev);
+
+    // Inserting at a pd boundary
+  } else if (insert_offset == 0) {
+    piece_descriptor_range_t* old_pds = piece_table_undo_range_init(self, index, length, cursor);
+    piece_descriptor_range_as_boundary(old_pds, pd->prev, pd);
+
+    piece_descriptor_t* pd1 = piece_descriptor_init(&self->descriptors);
+    pd1->length             = length;
+    pd1->buffer             = self->add_buffer_id;
+    pd1->offset             = add_buffer_offset;
+    pd1->newlines           = piece_table_count_newlines(self, pd1->buffer, pd1->offset, length);
+
+    piece_descriptor_range_append(new_pds, pd1);
+    piece_table_swap_desc_ranges(self, old_pds, new_pds);
+    // Inserting in the middle of a piece
+  } else {
+    piece_descriptor_range_t* old_pds = piece_table_undo_range_init(self, index, length, cursor);
+    piece_descriptor_range_append(old_pds, pd);
+
+    piece_descriptor_t* pd1 = piece_descriptor_init(&self->descriptors);
+    pd1->length             = insert_offset;
+    pd1->buffer             = pd->buffer;
+    pd1->offset             = pd->offset;
+    pd1->newlines           = piece_table_count_newlines(self, pd->buffer, pd->offset, insert_offset);
+    piece_descriptor_range_append(new_pds, pd1);
+
+    piece_descriptor_t* pd2 = piece_descriptor_init(&self->descriptors);
+    pd2->length             = length;
+    pd2->buffer             = self->add_buffer_id;
+    pd2->offset             = add_buffer_offset;
+    pd2->newlines           = piece_table_count_newlines(self, pd2->buffer, pd2->offset, length);
+    piece_descriptor_range_append(new_pds, pd2);
+
+    piece_descriptor_t* pd3 = piece_descriptor_init(&self->descriptors);
+    pd3->length             = pd->length - insert_offset;
+    pd3->buffer             = pd->buffer;
+    pd3->offset             = pd->offset + insert_offset;
+    pd3->newlines           = pd->newlines - pd1->newlines;
+    piece_descriptor_range_append(new_pds, pd3);
+
+    piece_table_swap_desc_ranges(self, old_pds, new_pds);
+  }
+
+  piece_descriptor_range_free(new_pds, &self->ranges);
+  self->seq_length += length;
+
+  piece_table_changed(self, index, 0, length);
+  piece_table_measure_last(self);
+  piece_table_spill_history(self);
+  piece_table_record_event(self, PT_INSERT, index + length);
+}
+
+void
+piece_table_insert (piece_table_t* self, unsigned int index, char* piece, const undo_cursor_t* cursor) {
+  piece_table_insert_n(self, index, piece, strlen(piece), cursor);
+}
+
+void
+piece_table_delete (piece_table_t* self, unsigned int index, unsigned int length, piece_table_event ev, const undo_cursor_t* cursor) {
+  assert(length != 0);
+  assert(length <= self->seq_length);
+  assert(index <= self->seq_length - length);
+
+  piece_table_index_sync_before(self, index + length);
+
+  piece_descriptor_t* pd;
+  unsigned int        pd_index = piece_table_desc_from_index(self, index, &pd);
+
+  unsigned int rm_offset       = index - pd_index;
+  unsigned int rm_length       = length;
+
+  bool append_pd_range         = false;
+
+  piece_descriptor_range_t* evr;
+  piece_descriptor_range_t* new_pds = piece_descriptor_range_init(&self->ranges);
+  piece_descriptor_range_t* old_pds = piece_descriptor_range_init(&self->ranges);
+
+  // Forward-delete
+  if (index == pd_index && piece_table_can_optimize(self, PT_DELETE, index)) {
+    evr              = self->history.current;
+    evr->length     += length;
+
+    append_pd_range  = true;
+
+    if (self->frag_2) {
+      if (length < self->frag_2->length) {
+        self->frag_2->newlines -= piece_table_count_newlines(self, self->frag_2->buffer, self->frag_2->offset, length);
+        self->frag_2->length   -= length;
+        self->frag_2->offset   += length;
+        self->seq_length       -= length;
+
+        piece_tree_refresh(self->frag_2);
+
+        goto done;
+      } else {
+        rm_length -= pd->length;
+        pd         = pd->next;
+
+        piece_tree_remove(self, self->frag_2);
+        piece_descriptor_remove(self->frag_2);
+        self->frag_2 = NULL;
+      }
+    }
+    // Backward delete
+  } else if (index + length == pd_index + pd->length && piece_table_can_optimize(self, PT_DELETE, index + length)) {
+    evr              = self->history.current;
+    evr->length     += length;
+    evr->index      -= index;
+
+    append_pd_range  = false;
+
+    if (self->frag_1) {
+      if (length < self->frag_1->length) {
+        self->frag_1->newlines = piece_table_count_newlines(self, self->frag_1->buffer, self->frag_1->offset, self->frag_1->length - length);
+        self->frag_1->length  -= length;
+        self->frag_1->offset  += 0;
+        self->seq_length      -= length;
+
+        piece_tree_refresh(self->frag_1);
+        goto done;
+      } else {
+        rm_length -= self->frag_1->length;
+        piece_tree_remove(self, self->frag_1);
+        piece_descriptor_remove(self->frag_1);
+        self->frag_1 = NULL;
+      }
+    }
+  } else {
+    append_pd_range = true;
+
+    self->frag_1 = self->frag_2 = NULL;
+
+    evr                         = piece_table_undo_range_init(self, index, length, cursor);
+  }
+
+  // Deletion starts midway through a piece2
+  if (rm_offset != 0) {
+    piece_descriptor_t* npd = piece_descriptor_init(&self->descriptors);
+    npd->offset             = pd->offset;
+    npd->length             = rm_offset;
+    npd->buffer             = pd->buffer;
+    npd->newlines           = piece_table_count_newlines(self, pd->buffer, pd->offset, rm_offset);
+    piece_descriptor_range_append(new_pds, npd);
+
+    self->frag_1 = new_pds->first;
+
+    if (rm_offset + rm_length < pd->length) {
+      piece_descriptor_t* npd2 = piece_descriptor_init(&self->descriptors);
+      npd2->offset             = pd->offset + rm_offset + rm_length;
+      npd2->length             = pd->length - rm_offset - rm_length;
+      npd2->buffer             = pd->buffer;
+      npd2->newlines           = pd->newlines - piece_table_count_newlines(self, pd->buffer, pd->offset, rm_offset + rm_length);
+      piece_descriptor_range_append(new_pds, npd2);
+
+      self->frag_2 = new_pds->last;
+    }
+
+    rm_length -= min(rm_length, pd->length - rm_offset);
+
+    piece_descriptor_range_append(old_pds, pd);
+    pd = pd->next;
+  }
+
+  while (rm_length > 0 && pd != self->tail) {
+    if (rm_length < pd->length) {
+      piece_descriptor_t* npd = piece_descriptor_init(&self->descriptors);
+      npd->offset             = pd->offset + rm_length;
+      npd->length             = pd->length - rm_length;
+      npd->buffer             = pd->buffer;
+      npd->newlines           = pd->newlines - piece_table_count_newlines(self, pd->buffer, pd->offset, rm_length);
+      piece_descriptor_range_append(new_pds, npd);
+
+      self->frag_2 = new_pds->last;
+    }
+
+    rm_length -= min(rm_length, pd->length);
+
+    piece_descriptor_range_append(old_pds, pd);
+    pd = pd->next;
+  }
+
+  piece_table_swap_desc_ranges(self, old_pds, new_pds);
+  self->seq_length -= length;
+
+  if (append_pd_range) {
+    piece_descriptor_range_append_range(evr, old_pds);
+  } else {
+    piece_descriptor_range_prepend_range(evr, old_pds);
+  }
+
+done:
+  piece_descriptor_range_free(new_pds, &self->ranges);
+  piece_descriptor_range_free(old_pds, &self->ranges);
+
+  piece_table_changed(self, index, length, 0);
+  piece_table_measure_last(self);
+  piece_table_spill_history(self);
+  piece_table_record_event(self, PT_DELETE, index);
+}
+
+piece_descriptor_range_t*
+piece_table_undo_range_init (piece_table_t* self, unsigned int index, unsigned int length, const undo_cursor_t* cursor) {
+  piece_descriptor_range_t* undo_range = piece_descriptor_range_init(&self->ranges);
+  undo_range->seq_length               = self->seq_length;
+  undo_range->index                    = index;
+  undo_range->length                   = length;
+  undo_range->group_id                 = self->group_id;
+
+  if (cursor) {
+    undo_range->cursor = *cursor;
+  }
+
+  piece_table_history_add(self, undo_range);
+
+  return undo_range;
+}
+
+// Undoes the latest edit, or group of edits. Returns the cursor from before
+// it, which stays valid until the next edit, or NULL if there was nothing to undo.
+const undo_cursor_t*
+piece_table_undo (piece_table_t* self) {
+  piece_descriptor_range_t* node = piece_table_undo_head(self);
+  if (!node) {
+    return NULL;
+  }
+
+  unsigned int         group_id = node->group_id;
+  const undo_cursor_t* cursor;
+
+  piece_table_break(self);
+
+  do {
+    cursor = &node->cursor;
+    piece_table_step_back(self);
+  } while (group_id != 0 && (node = piece_table_undo_head(self)) && node->group_id == group_id);
+
+  return cursor;
+}
+
+// Redoes the latest undone edit, or group of edits, on the latest branch
+const undo_cursor_t*
+piece_table_redo (piece_table_t* self) {
+  piece_descriptor_range_t* node = self->history.current->redo_child;
+  if (!node) {
+    return NULL;
+  }
+
+  unsigned int         group_id = node->group_id;
+  const undo_cursor_t* cursor;
+
+  piece_table_break(self);
+
+  do {
+    cursor = &node->cursor;
+    piece_table_step_forward(self, node);
+  } while (group_id != 0 && (node = self->history.current->redo_child) && node->group_id == group_id);
+
+  return cursor;
+}
+
+// Moves the sequence to the state `target` leaves it in, by way of the
+// nearest state both it and the current one descend from. Only the pieces of
+// the edits in between are swapped. Returns the cursor of the last edit
+// undone or redone, or NULL if already there.
+static const undo_cursor_t*
+piece_table_travel_to (piece_table_t* self, piece_descriptor_range_t* target) {
+  undo_tree_t*              h      = &self->history;
+  piece_descriptor_range_t* a      = h->current;
+  piece_descriptor_range_t* b      = target;
+  const undo_cursor_t*      cursor = NULL;
+
+  // A node is always made after its parent, so the newer of the two can't be
+  // the other's ancestor
+  while (a != b) {
+    if (a->seq > b->seq) {
+      a = a->parent;
+    } else {
+      b = b->parent;
+    }
+  }
+
+  piece_table_break(self);
+
+  while (h->current != a) {
+    cursor = &h->current->cursor;
+    piece_table_step_back(self);
+  }
+
+  for (b = target; b != a; b = b->parent) {
+    b->parent->redo_child = b;
+  }
+
+  while (h->current != target) {
+    cursor = &h->current->redo_child->cursor;
+    piece_table_step_forward(self, h->current->redo_child);
+  }
+
+  return cursor;
+}
+
+// Goes back, or with a positive count forward, `steps` states in the order
+// they were made, across branches. Stops at either end of the history.
+const undo_cursor_t*
+piece_table_travel_steps (piece_table_t* self, int steps) {
+  undo_tree_t*         h      = &self->history;
+  int                  i      = h->current == h->root ? -1 : undo_tree_find(h, h->current->seq);
+  long                 target = (long)i + steps;
+  const undo_cursor_t* cursor;
+
+  if (target >= (long)h->size) {
+    target = (long)h->size - 1;
+  }
+
+  if (target >= 0) {
+    return piece_table_travel_to(self, undo_tree_get(h, target));
+  }
+
+  // Past what is in memory; keep going back through the journal
+  cursor = piece_table_travel_to(self, h->root);
+
+  for (long n = -1 - target; n > 0 && piece_table_undo_head(self); n--) {
+    cursor = &h->current->cursor;
+    piece_table_step_back(self);
+  }
+
+  return cursor;
+}
+
+// Goes to the latest state made at or before `when`, or the oldest state
+// there is
+const undo_cursor_t*
+piece_table_travel_time (piece_table_t* self, time_t when) {
+  undo_tree_t*              h  = &self->history;
+  unsigned int              lo = 0;
+  unsigned int              hi = h->size;
+  piece_descriptor_range_t* node;
+  const undo_cursor_t*      cursor;
+
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+
+    if (undo_tree_get(h, mid)->time <= when) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo > 0) {
+    return piece_table_travel_to(self, undo_tree_get(h, lo - 1));
+  }
+
+  cursor = piece_table_travel_to(self, h->root);
+
+  while ((node = piece_table_undo_head(self)) && node->time > when) {
+    cursor = &node->cursor;
+    piece_table_step_back(self);
+  }
+
+  return cursor;
+}
+
+// When the current state was made
+time_t
+piece_table_state_time (piece_table_t* self) {
+  return self->history.current->time;
+}
+
+// Drops all undo history, keeping the text as it is
+void
+piece_table_history_clear (piece_table_t* self) {
+  undo_tree_t*              h    = &self->history;
+  piece_descriptor_range_t* root = piece_descriptor_range_init(&self->ranges);
+
+  piece_table_break(self);
+
+  root->seq                      = h->current->seq;
+  root->time                     = h->current->time;
+
+  for (unsigned int i = 0; i < h->size; i++) {
+    piece_table_node_free(self, undo_tree_get(h, i));
+  }
+  piece_descriptor_range_free(h->root, &self->ranges);
+
+  h->root    = root;
+  h->current = root;
+  h->start   = 0;
+  h->size    = 0;
+
+  if (self->journal.file && ftruncate(fileno(self->journal.file), 0) != 0) {
+    panic("[piece_table_history_clear::%s] failed to truncate the undo journal\n", __func__);
+  }
+  self->journal.size = 0;
+
+  piece_table_break(self);
+  self->frag_1 = self->frag_2 = NULL;
+}
+
+bool
+piece_table_can_undo (piece_table_t* self) {
+  return self->history.current != self->history.root || self->journal.size > 0;
+}
+
+bool
+piece_table_can_redo (piece_table_t* self) {
+  return self->history.current->redo_child != NULL;
+}
+
+// Replaces the `old_length` bytes at `index` with `s`, as an edit of its own.
+// Returns its node.
+static piece_descriptor_range_t*
+piece_table_replace (piece_table_t* self, unsigned int index, unsigned int old_length, const char* s, unsigned int length, const undo_cursor_t* cursor) {
+  piece_table_index_sync_before(self, index + old_length);
+  piece_table_break(self);
+  self->frag_1 = self->frag_2 = NULL;
+
+  piece_descriptor_t*       before  = piece_table_boundary_at(self, index);
+  piece_descriptor_t*       last    = old_length ? piece_table_boundary_at(self, index + old_length) : before;
+  piece_descriptor_range_t* old_pds = piece_table_undo_range_init(self, index, length, cursor);
+  piece_descriptor_range_t* new_pds = piece_descriptor_range_init(&self->ranges);
+
+  if (old_length) {
+    old_pds->first       = before->next;
+    old_pds->last        = last;
+    old_pds->is_boundary = false;
+  } else {
+    piece_descriptor_range_as_boundary(old_pds, before, before->next);
+  }
+
+  if (length) {
+    unsigned int        offset = piece_table_import_buffer(self, s, length);
+    piece_descriptor_t* pd     = piece_descriptor_init(&self->descriptors);
+    pd->buffer                 = self->add_buffer_id;
+    pd->offset                 = offset;
+    pd->length                 = length;
+    pd->newlines               = piece_table_count_newlines(self, pd->buffer, offset, length);
+    piece_descriptor_range_append(new_pds, pd);
+  }
+
+  piece_table_swap_desc_ranges(self, old_pds, new_pds);
+  piece_descriptor_range_free(new_pds, &self->ranges);
 
-    piece_descriptor_t* pd1 = piece_descriptor_init();
-    pd1->length             = length;
-    pd1->buffer             = self->add_buffer_id;
-    pd1->offset             = add_buffer_offset;
+  self->seq_length = self->seq_length - old_length + length;
+  piece_table_changed(self, index, old_length, length);
+  piece_table_measure_last(self);
 
-    piece_descriptor_range_append(new_pds, pd1);
-    piece_table_swap_desc_ranges(self, old_pds, new_pds);
-    // Inserting in the middle of a piece
-  } else {
-    piece_descriptor_range_t* old_pds = piece_table_undo_range_init(self, index, length, metadata);
-    piece_descriptor_range_append(old_pds, pd);
+  return old_pds;
+}
 
-    piece_descriptor_t* pd1 = piece_descriptor_init();
-    pd1->length             = insert_offset;
-    pd1->buffer             = pd->buffer;
-    pd1->offset             = pd->offset;
-    piece_descriptor_range_append(new_pds, pd1);
+// An edit read back from the undo file, with its text
+typedef struct {
+  undo_file_record_t record;
+  char*              text;
+} undo_file_edit_t;
 
-    piece_descriptor_t* pd2 = piece_descriptor_init();
-    pd2->length             = length;
-    pd2->buffer             = self->add_buffer_id;
-    pd2->offset             = add_buffer_offset;
-    piece_descriptor_range_append(new_pds, pd2);
+static int
+undo_file_find (undo_file_edit_t* edits, unsigned int n, unsigned int seq) {
+  unsigned int lo = 0;
+  unsigned int hi = n;
 
-    piece_descriptor_t* pd3 = piece_descriptor_init();
-    pd3->length             = pd->length - insert_offset;
-    pd3->buffer             = pd->buffer;
-    pd3->offset             = pd->offset + insert_offset;
-    piece_descriptor_range_append(new_pds, pd3);
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
 
-    piece_table_swap_desc_ranges(self, old_pds, new_pds);
+    if (edits[mid].record.seq < seq) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
 
-  self->seq_length += length;
+  return lo < n && edits[lo].record.seq == seq ? (int)lo : -1;
+}
 
-  piece_table_record_event(self, PT_INSERT, index + length);
+// Whether `length` bytes at `index` lie within the sequence
+static inline bool
+piece_table_in_bounds (piece_table_t* self, unsigned int index, unsigned int length) {
+  return index <= self->seq_length && length <= self->seq_length - index;
 }
 
-void
-piece_table_delete (piece_table_t* self, unsigned int index, unsigned int length, piece_table_event ev, void* metadata) {
-  assert(length != 0);
-  assert(length <= self->seq_length);
-  assert(index <= self->seq_length - length);
+// Rebuilds the undo tree from the edits in an undo file, with the sequence in
+// the state `saved_seq` left it in. The edits that led there are backed out to
+// reach the oldest state, then every edit is redone on top of its parent.
+// Returns false, with the sequence as it was, if the edits don't fit the text.
+static bool
+piece_table_history_rebuild (piece_table_t* self, undo_file_edit_t* edits, unsigned int n, unsigned int saved_seq) {
+  undo_tree_t* h        = &self->history;
+  unsigned int root_seq = saved_seq;
+
+  for (int i = undo_file_find(edits, n, saved_seq); i >= 0; i = undo_file_find(edits, n, root_seq)) {
+    undo_file_record_t* r = &edits[i].record;
+
+    if (!piece_table_in_bounds(self, r->region_index, r->new_length)) {
+      while (h->current != h->root) {
+        piece_table_step_back(self);
+      }
+      piece_table_history_clear(self);
+      return false;
+    }
 
-  piece_descriptor_t* pd;
-  unsigned int        pd_index = piece_table_desc_from_index(self, index, &pd);
+    piece_table_replace(self, r->region_index, r->new_length, edits[i].text, r->old_length, NULL);
+    root_seq = r->parent_seq;
+  }
 
-  unsigned int rm_offset       = index - pd_index;
-  unsigned int rm_length       = length;
+  piece_table_history_clear(self);
+  h->root->seq = root_seq;
+  h->last_seq  = root_seq;
 
-  bool append_pd_range         = false;
+  for (unsigned int i = 0; i < n; i++) {
+    undo_file_record_t*       r      = &edits[i].record;
+    int                       k      = undo_tree_find(h, r->parent_seq);
+    piece_descriptor_range_t* parent = k >= 0 ? undo_tree_get(h, k) : r->parent_seq == root_seq ? h->root : NULL;
 
-  piece_descriptor_range_t* evr;
-  piece_descriptor_range_t* new_pds = piece_descriptor_range_init();
-  piece_descriptor_range_t* old_pds = piece_descriptor_range_init();
+    // Edits off the oldest state's line of history don't fit in the tree
+    if (!parent) {
+      continue;
+    }
 
-  // Forward-delete
-  if (index == pd_index && piece_table_can_optimize(self, PT_DELETE, index)) {
-    evr              = event_stack_back(self->undo_stack, 0);
-    evr->length     += length;
+    piece_table_travel_to(self, parent);
+    if (!piece_table_in_bounds(self, r->region_index, r->old_length)) {
+      continue;
+    }
 
-    append_pd_range  = true;
+    piece_descriptor_range_t* node = piece_table_replace(self, r->region_index, r->old_length, edits[i].text + r->old_length, r->new_length, &r->cursor);
+    node->seq                      = r->seq;
+    node->time                     = r->time;
+    node->group_id                 = r->group_id;
+    h->last_seq                    = r->seq;
 
-    if (self->frag_2) {
-      if (length < self->frag_2->length) {
-        self->frag_2->length -= length;
-        self->frag_2->offset += length;
-        self->seq_length     -= length;
+    if (r->group_id > self->last_group_id) {
+      self->last_group_id = r->group_id;
+    }
+  }
 
-        goto done;
-      } else {
-        rm_length -= pd->length;
-        pd         = pd->next;
+  int k = undo_tree_find(h, saved_seq);
+  piece_table_travel_to(self, k >= 0 ? undo_tree_get(h, k) : h->root);
+  piece_table_break(self);
 
-        piece_descriptor_remove(self->frag_2);
+  self->saved_seq = saved_seq;
+  piece_table_spill_history(self);
+
+  return true;
+}
+
+// Keeps the undo history in an undo file at `path`. If there is one already,
+// and it saved the file at `version`, the undo tree is restored from it, and
+// further edits are appended. Otherwise it is replaced on the next edit. The
+// version is whatever tells the file's states apart e.g. its size and mtime;
+// reading the text to tell would mean reading the whole file. Call right after
+// the file is opened. Returns whether history was restored.
+bool
+piece_table_history_load (piece_table_t* self, const char* path, uint64_t version) {
+  undo_file_t*       uf      = &self->undo_file;
+  undo_file_edit_t*  edits   = NULL;
+  unsigned int       n_edits = 0;
+  unsigned int       cap     = 0;
+  bool               ok      = false;
+  long               end     = 0;
+  FILE*              file    = fopen(path, "r+b");
+  undo_file_record_t record;
+  undo_file_record_t saved;
+  char               magic[UNDO_FILE_MAGIC_SZ];
+
+  uf->base_seq               = self->history.current->seq;
+  uf->base_version           = version;
+  uf->sealed_seq             = self->history.last_seq;
+
+  if (!file || fread(magic, UNDO_FILE_MAGIC_SZ, 1, file) != 1 || memcmp(magic, UNDO_FILE_MAGIC, UNDO_FILE_MAGIC_SZ) != 0) {
+    goto done;
+  }
+
+  struct stat st;
+  if (fstat(fileno(file), &st) == -1) {
+    goto done;
+  }
+
+  end = ftell(file);
+
+  // A record cut short by a crash ends the file
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    // Bytes left in the file after the record; an edit can't hold more
+    off_t left = st.st_size - ftell(file);
+
+    if (record.type == UNDO_FILE_SAVED) {
+      if (record.old_length == self->seq_length && record.version == version) {
+        saved = record;
+        ok    = true;
+      }
+    } else if (record.type == UNDO_FILE_EDIT && record.parent_seq < record.seq && (n_edits == 0 || edits[n_edits - 1].record.seq < record.seq)) {
+      size_t length = (size_t)record.old_length + record.new_length;
+      if (left < 0 || length >= UINT_MAX || (off_t)length > left) {
+        break;
       }
-    }
-    // Backward delete
-  } else if (index + length == pd_index + pd->length && piece_table_can_optimize(self, PT_DELETE, index + length)) {
-    evr              = event_stack_last(self->undo_stack);
-    evr->length     += length;
-    evr->index      -= index;
 
-    append_pd_range  = false;
+      char* text = xmalloc(length + 1);
 
-    if (self->frag_1) {
-      if (length < self->frag_1->length) {
-        self->frag_1->length -= length;
-        self->frag_1->offset += 0;
-        self->seq_length     -= length;
-        goto done;
-      } else {
-        rm_length -= self->frag_1->length;
-        piece_descriptor_remove(self->frag_1);
+      if (fread(text, 1, length, file) != length) {
+        free(text);
+        break;
       }
-    }
-  } else {
-    append_pd_range = true;
 
-    self->frag_1 = self->frag_2 = NULL;
+      if (n_edits == cap) {
+        cap   = cap ? cap * 2 : 64;
+        edits = xrealloc(edits, cap * sizeof(undo_file_edit_t));
+      }
+      edits[n_edits++] = (undo_file_edit_t){record, text};
+    } else {
+      break;
+    }
 
-    evr                         = piece_table_undo_range_init(self, index, length, metadata);
+    end = ftell(file);
   }
 
-  event_stack_clear(self->redo_stack);
+  ok = ok && piece_table_history_rebuild(self, edits, n_edits, saved.seq);
 
-  // Deletion starts midway through a piece2
-  if (rm_offset != 0) {
-    piece_descriptor_t* npd = piece_descriptor_init();
-    npd->offset             = pd->offset;
-    npd->length             = rm_offset;
-    npd->buffer             = pd->buffer;
-    piece_descriptor_range_append(new_pds, npd);
+done:
+  if (ok && ftruncate(fileno(file), end) == 0 && fseek(file, 0, SEEK_END) == 0) {
+    uf->file       = file;
+    uf->sealed_seq = self->history.last_seq;
+  } else if (file) {
+    ok = false;
+    fclose(file);
+  }
 
-    self->frag_1 = new_pds->first;
+  for (unsigned int i = 0; i < n_edits; i++) {
+    free(edits[i].text);
+  }
+  free(edits);
 
-    if (rm_offset + rm_length < pd->length) {
-      piece_descriptor_t* npd2 = piece_descriptor_init();
-      npd2->offset             = pd->offset + rm_offset + rm_length;
-      npd2->length             = pd->length - rm_offset - rm_length;
-      npd2->buffer             = pd->buffer;
-      piece_descriptor_range_append(new_pds, npd2);
+  uf->path = s_copy(path);
+  return ok;
+}
 
-      self->frag_2 = new_pds->last;
-    }
+// Records in the undo file that the text in state `mark`, `length` bytes, is
+// what the file now holds, at `version`
+void
+piece_table_history_saved (piece_table_t* self, unsigned int mark, size_t length, uint64_t version) {
+  undo_file_t* uf = &self->undo_file;
 
-    rm_length -= min(rm_length, pd->length - rm_offset);
+  if (!uf->path || (!uf->file && mark == uf->base_seq)) {
+    return;
+  }
 
-    piece_descriptor_range_append(old_pds, pd);
-    pd = pd->next;
+  if (!uf->file && !piece_table_undo_file_create(self)) {
+    piece_table_undo_file_close(uf);
+    return;
   }
 
-  while (rm_length > 0 && pd != self->tail) {
-    if (rm_length < pd->length) {
-      piece_descriptor_t* npd = piece_descriptor_init();
-      npd->offset             = pd->offset + rm_length;
-      npd->length             = pd->length - rm_length;
-      npd->buffer             = pd->buffer;
-      piece_descriptor_range_append(new_pds, npd);
+  undo_file_record_t record = {
+    .type       = UNDO_FILE_SAVED,
+    .seq        = mark,
+    .old_length = length,
+    .version    = version,
+  };
 
-      self->frag_2 = new_pds->last;
-    }
+  if (fwrite(&record, sizeof(record), 1, uf->file) != 1 || fflush(uf->file) != 0) {
+    piece_table_undo_file_close(uf);
+  }
+}
 
-    rm_length -= min(rm_length, pd->length);
+void
+piece_table_free (piece_table_t* self) {
+  piece_table_seal(self);
+  piece_table_undo_file_close(&self->undo_file);
 
-    piece_descriptor_range_append(old_pds, pd);
-    pd = pd->next;
-  }
+  array_free(self->buffer_list, (free_fn*)seq_buffer_free);
 
-  piece_table_swap_desc_ranges(self, old_pds, new_pds);
-  self->seq_length -= length;
+  // Every descriptor and range, live or held for undo, goes with the pools
+  pool_free(&self->descriptors);
+  pool_free(&self->ranges);
 
-  if (append_pd_range) {
-    piece_descriptor_range_append_range(evr, old_pds);
-  } else {
-    piece_descriptor_range_prepend_range(evr, old_pds);
+  if (self->journal.file) {
+    fclose(self->journal.file);
   }
+  free(self->journal.offsets);
+  free(self->history.nodes);
 
-done:
-  piece_table_record_event(self, PT_DELETE, index);
+  free(self);
 }
 
-piece_descriptor_range_t*
-piece_table_undo_range_init (piece_table_t* self, unsigned int index, unsigned int length, void* metadata) {
-  piece_descriptor_range_t* undo_range = piece_descriptor_range_init();
-  undo_range->seq_length               = self->seq_length;
-  undo_range->index                    = index;
-  undo_range->length                   = length;
-  undo_range->metadata                 = metadata;
+// Opens an undo group: every edit until the matching `piece_table_group_end`
+// is undone and redone as one. Groups nest; only the outermost one counts.
+void
+piece_table_group_begin (piece_table_t* self) {
+  if (self->group_depth++ == 0) {
+    piece_table_break(self);
+    self->group_id = ++self->last_group_id;
+  }
+}
 
-  event_stack_push(self->undo_stack, undo_range);
+void
+piece_table_group_end (piece_table_t* self) {
+  assert(self->group_depth > 0);
 
-  return undo_range;
+  if (--self->group_depth == 0) {
+    piece_table_break(self);
+    self->group_id = 0;
+  }
 }
 
-void*
-piece_table_undo (piece_table_t* self) {
-  return piece_table_do_stack_event(self, self->undo_stack, self->redo_stack);
+// Positions `self` at `index`, to walk the `length` bytes from there
+void
+piece_table_span_iter_init (piece_table_span_iter_t* self, piece_table_t* pt, unsigned int index, unsigned int length) {
+  self->pt        = pt;
+  self->pd        = pt->tail;
+  self->offset    = 0;
+  self->remaining = length;
+
+  if (length) {
+    self->offset = index - piece_table_desc_from_index(pt, index, &self->pd);
+  }
 }
 
-void*
-piece_table_redo (piece_table_t* self) {
-  return piece_table_do_stack_event(self, self->redo_stack, self->undo_stack);
+// Yields the next slice of the range, pointing straight into the buffer the
+// piece references. Returns false once the range, or the sequence, runs out.
+bool
+piece_table_span_iter_next (piece_table_span_iter_t* self, const char** span, unsigned int* length) {
+  while (self->remaining && self->pd && self->pd != self->pt->tail) {
+    piece_descriptor_t* pd     = self->pd;
+    unsigned int        offset = self->offset;
+    unsigned int        n      = pd->length - offset;
+
+    if (n > self->remaining) {
+      n = self->remaining;
+    }
+
+    self->pd     = pd->next;
+    self->offset = 0;
+
+    if (n) {
+      *span            = piece_table_desc_state(self->pt, pd) + offset;
+      *length          = n;
+      self->remaining -= n;
+      return true;
+    }
+  }
+
+  return false;
 }
 
 unsigned int
 piece_table_render (piece_table_t* self, unsigned int index, unsigned int length, char* dest) {
-  // TODO: cache
-  unsigned int total = 0;
+  piece_table_span_iter_t it;
+  const char*             span;
+  unsigned int            span_length;
+  unsigned int            total = 0;
+
+  piece_table_span_iter_init(&it, self, index, length);
+  while (piece_table_span_iter_next(&it, &span, &span_length)) {
+    memcpy(dest + total, span, span_length);
+    total += span_length;
+  }
 
-  piece_descriptor_t* pd;
-  unsigned int        pd_index  = piece_table_desc_from_index(self, index, &pd);
-  unsigned int        pd_offset = index - pd_index;
+  if (total == length) {
+    dest[total] = '\0';
+  }
+
+  return total;
+}
 
-  while (length && (pd && pd != self->tail)) {
-    unsigned int copy_len = min(pd->length - pd_offset, length);
-    char* src = buffer_state(((seq_buffer_t*)array_get(self->buffer_list, pd->buffer))->buffer);
+// Writes a batch of slices in full. Short writes leave us partway through an
+// iovec, so we resume from there; `iov` is consumed in the process.
+static io_write_all_result
+piece_table_writev_all (int fd, struct iovec* iov, int n, size_t* total, atomic_size_t* progress) {
+  while (n > 0) {
+    ssize_t written = writev(fd, iov, n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
 
-    memcpy(dest, src + pd->offset + pd_offset, copy_len * sizeof(char));
+      return IO_WRITE_ALL_ERR;
+    }
 
-    dest      += copy_len;
-    length    -= copy_len;
-    total     += copy_len;
-    pd         = pd->next;
-    pd_offset  = 0;
-  }
+    if (written == 0) {
+      return IO_WRITE_ALL_INCOMPLETE;
+    }
 
-  if (length == 0) {
-    memcpy(dest, "", 1);
+    *total += written;
+    if (progress) {
+      atomic_store(progress, *total);
+    }
+
+    for (; n > 0 && (size_t)written >= iov->iov_len; iov++, n--) {
+      written -= iov->iov_len;
+    }
+
+    if (n > 0) {
+      iov->iov_base  = (char*)iov->iov_base + written;
+      iov->iov_len  -= written;
+    }
   }
 
-  return total;
+  return IO_WRITE_ALL_OK;
 }
 
-#include "globals.h"
+// Captures the sequence as it stands as a list of buffer slices, so it can be
+// written out while editing carries on. Buffers never move and are only ever
+// appended to past the bytes in use, so the slices stay valid. Ends the
+// current undo event too, so edits made from here on are never merged into one
+// already saved.
+piece_table_snapshot_t*
+piece_table_snapshot (piece_table_t* self) {
+  piece_table_snapshot_t* snap = xmalloc(sizeof(piece_table_snapshot_t));
+
+  piece_table_break(self);
+
+  unsigned int num_pieces = 0;
+  for (piece_descriptor_t* pd = self->head->next; pd != self->tail; pd = pd->next) {
+    num_pieces++;
+  }
 
-void*
-piece_table_do_stack_event (piece_table_t* self, event_stack_t* src, event_stack_t* dest) {
-  if (event_stack_empty(src)) {
-    return NULL;  // TODO:
+  snap->slices     = xmalloc((num_pieces ? num_pieces : 1) * sizeof(struct iovec));
+  snap->num_slices = 0;
+  snap->length     = self->seq_length;
+  snap->dirty_mark = piece_table_dirty_mark(self);
+  atomic_init(&snap->written, 0);
+
+  for (piece_descriptor_t* pd = self->head->next; pd != self->tail; pd = pd->next) {
+    if (pd->length) {
+      snap->slices[snap->num_slices].iov_base = piece_table_desc_state(self, pd);
+      snap->slices[snap->num_slices].iov_len  = pd->length;
+      snap->num_slices++;
+    }
   }
 
-  unsigned int group_id;
-  void*        metadata;
+  return snap;
+}
 
-  piece_table_record_event(self, PT_SENTINEL, 0);
-  group_id = event_stack_last(src)->group_id;
+void
+piece_table_snapshot_free (piece_table_snapshot_t* self) {
+  free(self->slices);
+  free(self);
+}
 
-  piece_descriptor_range_t* range;
-  do {
-    range    = event_stack_last(src);
-    metadata = range->metadata;
-    event_stack_pop(src);
-    event_stack_push(dest, range);
-    piece_table_restore_desc_ranges(self, range);
-  } while (!event_stack_empty(src) && (event_stack_last(src)->group_id == group_id && group_id != 0));
+// Writes a snapshot to `fd` without rendering it: slices are gathered straight
+// from their buffers, a batch per writev. Safe to call from any thread while
+// the piece table is being edited. `written` tracks progress.
+io_write_all_result
+piece_table_snapshot_write (piece_table_snapshot_t* self, int fd, size_t* n_write_ptr) {
+  struct iovec iov[PT_WRITE_IOV_BATCH];
+  size_t       total = 0;
+
+  *n_write_ptr = 0;
+  if (fd < 0) {
+    return IO_WRITE_ALL_INVALID;
+  }
+
+  for (unsigned int i = 0; i < self->num_slices; i += PT_WRITE_IOV_BATCH) {
+    int n = self->num_slices - i < PT_WRITE_IOV_BATCH ? self->num_slices - i : PT_WRITE_IOV_BATCH;
+    memcpy(iov, self->slices + i, n * sizeof(struct iovec));
+
+    io_write_all_result r = piece_table_writev_all(fd, iov, n, &total, &self->written);
+    if (r != IO_WRITE_ALL_OK) {
+      *n_write_ptr = total;
+      return r;
+    }
+  }
 
-  return metadata;
+  *n_write_ptr = total;
+  return total == self->length ? IO_WRITE_ALL_OK : IO_WRITE_ALL_INCOMPLETE;
 }
 
+#include "globals.h"
+
 seq_buffer_t*
 piece_table_alloc_buffer (piece_table_t* self, unsigned int max_size) {
   seq_buffer_t* sb = seq_buffer_init();
   sb->length       = 0;
   sb->max_size     = max_size;
+  sb->data         = max_size ? xmalloc(max_size) : NULL;
   sb->id           = array_size(self->buffer_list);
   array_push(self->buffer_list, sb);
   return sb;
@@ -537,15 +2296,19 @@ piece_table_alloc_add_buffer (piece_table_t* self, unsigned int max_size) {
   return sb;
 }
 
+// Appends `length` bytes of `s` to the add buffer and returns their offset.
+// Once a chunk is full the next one is started; pieces larger than a chunk get
+// one of their own.
 unsigned int
-piece_table_import_buffer (piece_table_t* self, char* s, unsigned int length) {
+piece_table_import_buffer (piece_table_t* self, const char* s, unsigned int length) {
   seq_buffer_t* buf = (seq_buffer_t*)array_get(self->buffer_list, self->add_buffer_id);
-  if (buf->length + length >= buf->max_size) {
-    buf = piece_table_alloc_add_buffer(self, length + 0x10000);
+  if (buf->length + length > buf->max_size) {
+    buf = piece_table_alloc_add_buffer(self, length > PT_ADD_CHUNK_SZ ? length : PT_ADD_CHUNK_SZ);
     piece_table_record_event(self, PT_SENTINEL, 0);
   }
 
-  buffer_append(buf->buffer, s);
+  memcpy(buf->data + buf->length, s, length);
+  seq_buffer_index_line_breaks(buf, buf->length, length);
 
   unsigned int ret  = buf->length;
   buf->length      += length;
@@ -557,6 +2320,15 @@ void
 piece_table_swap_desc_ranges (piece_table_t* self, piece_descriptor_range_t* src, piece_descriptor_range_t* dest) {
   assert(src);
 
+  // Nothing to swap; the removal was handled entirely by the delete optimizations
+  if (src->is_boundary && dest->is_boundary) {
+    return;
+  }
+
+  piece_descriptor_t* before    = src->is_boundary ? src->first : src->first->prev;
+  piece_descriptor_t* after     = src->is_boundary ? src->last : src->last->next;
+  unsigned int        n_removed = piece_tree_span_count(before, after);
+
   if (src->is_boundary) {
     if (!dest->is_boundary) {
       assert(src->first);
@@ -588,10 +2360,16 @@ piece_table_swap_desc_ranges (piece_table_t* self, piece_descriptor_range_t* src
       dest->last->next       = src->last->next;
     }
   }
+
+  piece_tree_replace_span(self, before, n_removed, after);
 }
 
 void
 piece_table_restore_desc_ranges (piece_table_t* self, piece_descriptor_range_t* pdr) {
+  piece_descriptor_t* before    = pdr->is_boundary ? pdr->first : pdr->first->prev;
+  piece_descriptor_t* after     = pdr->is_boundary ? pdr->last : pdr->last->next;
+  unsigned int        n_removed = piece_tree_span_count(before, after);
+
   if (pdr->is_boundary) {
     piece_descriptor_t* first = pdr->first->next;
     piece_descriptor_t* last  = pdr->last->prev;
@@ -649,36 +2427,188 @@ piece_table_restore_desc_ranges (piece_table_t* self, piece_descriptor_range_t*
     }
   }
 
+  piece_tree_replace_span(self, before, n_removed, after);
+
   unsigned int tmp = pdr->seq_length;
   pdr->seq_length  = self->seq_length;
   self->seq_length = tmp;
+
+  if (self->on_change) {
+    unsigned int index    = piece_tree_offset(self, before) + before->length;
+    unsigned int inserted = piece_tree_offset(self, after) - index;
+    piece_table_changed(self, index, inserted + pdr->seq_length - self->seq_length, inserted);
+  }
 }
 
 unsigned int
 piece_table_desc_from_index (piece_table_t* self, unsigned int index, piece_descriptor_t** pd) {
-  unsigned int curr_index = 0;
-  unsigned int pd_index   = 0;
+  unsigned int        pd_index = 0;
+  piece_descriptor_t* node     = self->root;
+
+  while (node) {
+    unsigned int left_length = piece_tree_length(node->left);
 
-  for (*pd = self->head->next; (*pd)->next; *pd = (*pd)->next) {
-    if (index >= curr_index && index < curr_index + (*pd)->length) {
-      // if (pd_index) {
-      pd_index = curr_index;
-      // }
+    if (index < left_length) {
+      node = node->left;
+      continue;
+    }
+
+    index    -= left_length;
+    pd_index += left_length;
 
+    if (index < node->length) {
+      *pd = node;
       return pd_index;
     }
 
-    curr_index += (*pd)->length;
+    index    -= node->length;
+    pd_index += node->length;
+    node      = node->right;
   }
 
   // Insert at tail
-  if (*pd && index == curr_index) {
-    pd_index = curr_index;
-    return pd_index;
+  assert(index == 0);
+  *pd = self->tail;
+  return pd_index;
+}
+
+char*
+piece_table_desc_state (piece_table_t* self, piece_descriptor_t* pd) {
+  seq_buffer_t* sb = (seq_buffer_t*)array_get(self->buffer_list, pd->buffer);
+  return (char*)seq_buffer_state(sb) + pd->offset;
+}
+
+unsigned int
+piece_table_piece_count (piece_table_t* self) {
+  return piece_tree_count(self->root);
+}
+
+// Flags the pieces each node of the undo tree is restored between. The region
+// between them must keep exactly the pieces the node expects, and the pieces
+// themselves must survive.
+static void
+piece_table_pin_history (undo_tree_t* h, bool pin) {
+  for (unsigned int i = 0; i < h->size; i++) {
+    piece_descriptor_range_t* pdr    = undo_tree_get(h, i);
+    piece_descriptor_t*       before = pdr->is_boundary ? pdr->first : pdr->first->prev;
+    piece_descriptor_t*       after  = pdr->is_boundary ? pdr->last : pdr->last->next;
+
+    if (before) {
+      before->pins = pin ? before->pins | PT_PIN_BEFORE : 0;
+    }
+    if (after) {
+      after->pins = pin ? after->pins | PT_PIN_AFTER : 0;
+    }
   }
+}
 
-  // Should never get here
-  assert(false);
+// Whether `pd` can be folded into the piece before it. `pd` goes away, so
+// nothing may reference it; its predecessor grows at the end, so no region
+// may start right after it.
+static inline bool
+piece_table_can_absorb (piece_table_t* self, piece_descriptor_t* pd) {
+  piece_descriptor_t* prev = pd->prev;
+
+  return prev != self->head && !pd->pins && !(prev->pins & PT_PIN_BEFORE);
+}
+
+static void
+piece_table_absorb (piece_table_t* self, piece_descriptor_t* pd) {
+  pd->prev->length   += pd->length;
+  pd->prev->newlines += pd->newlines;
+
+  piece_descriptor_remove(pd);
+  piece_descriptor_free(pd, &self->descriptors);
+}
+
+// Copies the run of small pieces starting at `pd` into the add buffer and
+// points `pd` at the copy. Returns the number of pieces removed.
+static unsigned int
+piece_table_repack (piece_table_t* self, piece_descriptor_t* pd) {
+  char                text[PT_COMPACT_MAX_REPACK];
+  unsigned int        length   = pd->length;
+  unsigned int        newlines = pd->newlines;
+  unsigned int        n        = 0;
+  piece_descriptor_t* end      = pd->next;
+
+  if (pd->pins & PT_PIN_BEFORE || pd->length >= PT_COMPACT_SMALL_PIECE) {
+    return 0;
+  }
+
+  memcpy(text, piece_table_desc_state(self, pd), pd->length);
+
+  for (; end != self->tail && !end->pins && end->length < PT_COMPACT_SMALL_PIECE; end = end->next) {
+    if (length + end->length > PT_COMPACT_MAX_REPACK) {
+      break;
+    }
+
+    memcpy(text + length, piece_table_desc_state(self, end), end->length);
+    length   += end->length;
+    newlines += end->newlines;
+    n++;
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  pd->offset   = piece_table_import_buffer(self, text, length);
+  pd->buffer   = self->add_buffer_id;
+  pd->length   = length;
+  pd->newlines = newlines;
+
+  while (pd->next != end) {
+    piece_descriptor_t* next = pd->next;
+    piece_descriptor_remove(next);
+    piece_descriptor_free(next, &self->descriptors);
+  }
+
+  return n;
+}
+
+// Merges neighbouring pieces that reference adjacent slices of the same
+// buffer and, if `repack`, copies runs of small pieces into one. Pieces the
+// undo and redo stacks are restored around are left alone, so history stays
+// intact. Returns the number of pieces removed.
+unsigned int
+piece_table_compact (piece_table_t* self, bool repack) {
+  // Piece line counts aren't final until the original buffer is indexed
+  if (piece_table_indexing(self)) {
+    return 0;
+  }
+
+  unsigned int n_removed = 0;
+
+  // Pieces may move; the next edit can't extend the last one in place
+  piece_table_break(self);
+  self->frag_1 = self->frag_2 = NULL;
+
+  piece_table_pin_history(&self->history, true);
+
+  for (piece_descriptor_t* pd = self->head->next; pd != self->tail;) {
+    if (repack) {
+      n_removed += piece_table_repack(self, pd);
+    }
+
+    piece_descriptor_t* next = pd->next;
+    piece_descriptor_t* prev = pd->prev;
+
+    if (piece_table_can_absorb(self, pd) && prev->buffer == pd->buffer && prev->offset + prev->length == pd->offset) {
+      piece_table_absorb(self, pd);
+      n_removed++;
+    }
+
+    pd = next;
+  }
+
+  piece_table_pin_history(&self->history, false);
+
+  // Absorbed pieces went back to the pool while still in the tree
+  if (n_removed > 0) {
+    piece_tree_rebuild(self);
+  }
+
+  return n_removed;
 }
 
 void
@@ -692,17 +2622,33 @@ piece_table_can_optimize (piece_table_t* self, piece_table_event ev, unsigned in
   return self->last_event == ev && self->last_event_index == index;
 }
 
+// Ends the current edit; whatever comes next is an edit of its own
 void
 piece_table_break (piece_table_t* self) {
+  piece_table_seal(self);
   self->last_event = PT_SENTINEL;
 }
 
 bool
 piece_table_dirty (piece_table_t* self) {
-  return (array_size(self->undo_stack->event_captures) - self->offset_since_dirty_reset) != 0;
+  return self->history.current->seq != self->saved_seq;
 }
 
 void
 piece_table_dirty_reset (piece_table_t* self) {
-  self->offset_since_dirty_reset = array_size(self->undo_stack->event_captures);
+  piece_table_dirty_reset_to(self, piece_table_dirty_mark(self));
+}
+
+// Marks the current state, so it can later be recorded as the saved one even
+// if further edits were made in the meantime
+unsigned int
+piece_table_dirty_mark (piece_table_t* self) {
+  // The next edit has to be a state of its own, rather than extend this one
+  piece_table_break(self);
+  return self->history.current->seq;
+}
+
+void
+piece_table_dirty_reset_to (piece_table_t* self, unsigned int mark) {
+  self->saved_seq = mark;
 }
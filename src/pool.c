@@ -0,0 +1,78 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+#include "xmalloc.h"
+
+#define POOL_MIN_SLAB 16
+#define POOL_MAX_SLAB 1024
+
+void
+pool_init (pool_t* self, size_t elem_size) {
+  size_t align = _Alignof(max_align_t);
+
+  // Room for the free list link, and every object stays aligned
+  if (elem_size < sizeof(void*)) {
+    elem_size = sizeof(void*);
+  }
+
+  self->elem_size = (elem_size + align - 1) / align * align;
+  self->slabs     = NULL;
+  self->free_list = NULL;
+  self->live      = 0;
+}
+
+void
+pool_free (pool_t* self) {
+  while (self->slabs) {
+    pool_slab_t* slab = self->slabs;
+    self->slabs       = slab->next;
+    free(slab);
+  }
+
+  self->free_list = NULL;
+  self->live      = 0;
+}
+
+static pool_slab_t*
+pool_grow (pool_t* self) {
+  unsigned int capacity = self->slabs ? self->slabs->capacity * 2 : POOL_MIN_SLAB;
+  if (capacity > POOL_MAX_SLAB) {
+    capacity = POOL_MAX_SLAB;
+  }
+
+  pool_slab_t* slab = xmalloc(sizeof(pool_slab_t) + capacity * self->elem_size);
+  slab->next        = self->slabs;
+  slab->capacity    = capacity;
+  slab->used        = 0;
+  self->slabs       = slab;
+
+  return slab;
+}
+
+void*
+pool_alloc (pool_t* self) {
+  void* elem;
+
+  if (self->free_list) {
+    elem            = self->free_list;
+    self->free_list = *(void**)elem;
+  } else {
+    pool_slab_t* slab = self->slabs;
+    if (!slab || slab->used == slab->capacity) {
+      slab = pool_grow(self);
+    }
+
+    elem = (char*)slab->data + slab->used++ * self->elem_size;
+  }
+
+  self->live++;
+  return elem;
+}
+
+void
+pool_release (pool_t* self, void* elem) {
+  *(void**)elem   = self->free_list;
+  self->free_list = elem;
+  self->live--;
+}
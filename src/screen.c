@@ -0,0 +1,363 @@
+#include "screen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keypress.h"
+#include "xmalloc.h"
+
+#define SCREEN_MAX_PARAMS 16
+// Unchanged cells a run will write through rather than repositioning; about
+// the size of a cursor move
+#define SCREEN_RUN_GAP    8
+
+static const screen_cell_t blank = {' ', 0, -1, -1};
+
+// Interpreter state while loading a frame
+typedef struct {
+  screen_cell_t pen;
+  unsigned int  x;
+  unsigned int  y;
+  // Set once a row's last column is written; the next character wraps
+  bool          wrap;
+} screen_writer_t;
+
+static inline bool
+screen_cell_equal (const screen_cell_t* a, const screen_cell_t* b) {
+  return a->ch == b->ch && a->flags == b->flags && a->fg == b->fg && a->bg == b->bg;
+}
+
+static inline bool
+screen_attrs_equal (const screen_cell_t* a, const screen_cell_t* b) {
+  return a->flags == b->flags && a->fg == b->fg && a->bg == b->bg;
+}
+
+static void
+screen_fill (screen_cell_t* cells, unsigned int n, screen_cell_t cell) {
+  for (unsigned int i = 0; i < n; i++) {
+    cells[i] = cell;
+  }
+}
+
+void
+screen_init (screen_t* self, unsigned int rows, unsigned int cols) {
+  self->front = NULL;
+  self->back  = NULL;
+  screen_resize(self, rows, cols);
+}
+
+void
+screen_free (screen_t* self) {
+  free(self->front);
+  free(self->back);
+  self->front = NULL;
+  self->back  = NULL;
+}
+
+void
+screen_resize (screen_t* self, unsigned int rows, unsigned int cols) {
+  self->rows  = rows;
+  self->cols  = cols;
+  self->front = xrealloc(self->front, (rows * cols + 1) * sizeof(screen_cell_t));
+  self->back  = xrealloc(self->back, (rows * cols + 1) * sizeof(screen_cell_t));
+  screen_fill(self->back, rows * cols, blank);
+  screen_invalidate(self);
+}
+
+// Forgets what the terminal is showing e.g. after it was cleared behind our back
+void
+screen_invalidate (screen_t* self) {
+  self->valid = false;
+}
+
+static void
+screen_erase (screen_t* self, screen_writer_t* w, unsigned int from, unsigned int to) {
+  if (w->y >= self->rows) {
+    return;
+  }
+
+  // Erased cells take the current background, as with most terminals
+  screen_cell_t cell = {' ', 0, -1, w->pen.bg};
+  screen_fill(self->back + w->y * self->cols + from, to - from, cell);
+}
+
+static void
+screen_load_sgr (screen_writer_t* w, int* params, unsigned int n) {
+  if (n == 0) {
+    w->pen = blank;
+    return;
+  }
+
+  for (unsigned int i = 0; i < n; i++) {
+    int p = params[i] < 0 ? 0 : params[i];
+
+    switch (p) {
+      case 0: w->pen = blank; break;
+      case 7: w->pen.flags |= SCREEN_INVERT; break;
+      case 27: w->pen.flags &= ~SCREEN_INVERT; break;
+      case 39: w->pen.fg = -1; break;
+      case 49: w->pen.bg = -1; break;
+      case 38:
+      case 48: {
+        if (i + 2 < n && params[i + 1] == 5) {
+          if (p == 38) {
+            w->pen.fg = params[i + 2];
+          } else {
+            w->pen.bg = params[i + 2];
+          }
+          i += 2;
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Applies the control sequence whose parameters start at `s[i]`, just past the
+// "ESC [". Returns the index of its final byte.
+static size_t
+screen_load_csi (screen_t* self, screen_writer_t* w, const char* s, size_t length, size_t i) {
+  int          params[SCREEN_MAX_PARAMS];
+  unsigned int n          = 0;
+  int          cur        = -1;
+  bool         is_private = i < length && s[i] == '?';
+
+  for (i += is_private; i < length; i++) {
+    char c = s[i];
+
+    if (c >= '0' && c <= '9') {
+      cur = (cur < 0 ? 0 : cur) * 10 + (c - '0');
+      continue;
+    }
+
+    if (c == ';') {
+      if (n < SCREEN_MAX_PARAMS) {
+        params[n++] = cur;
+      }
+      cur = -1;
+      continue;
+    }
+
+    if (c < '@' || c > '~') {
+      continue;
+    }
+
+    if ((cur >= 0 || n > 0) && n < SCREEN_MAX_PARAMS) {
+      params[n++] = cur;
+    }
+
+    // Private modes e.g. cursor visibility don't touch the cells
+    if (is_private) {
+      return i;
+    }
+
+    int p0 = n > 0 && params[0] > 0 ? params[0] : 0;
+
+    switch (c) {
+      case 'm': screen_load_sgr(w, params, n); break;
+      case 'H': {
+        unsigned int row = p0 ? p0 : 1;
+        unsigned int col = n > 1 && params[1] > 0 ? params[1] : 1;
+
+        w->y    = row - 1;
+        w->x    = col - 1 < self->cols ? col - 1 : self->cols - 1;
+        w->wrap = false;
+        break;
+      }
+      case 'K': {
+        unsigned int from = p0 == 0 ? w->x : 0;
+        unsigned int to   = p0 == 1 ? w->x + 1 : self->cols;
+
+        screen_erase(self, w, from, to);
+        w->wrap = false;
+        break;
+      }
+      case 'J': {
+        if (p0 == 2) {
+          screen_cell_t cell = {' ', 0, -1, w->pen.bg};
+          screen_fill(self->back, self->rows * self->cols, cell);
+        }
+        break;
+      }
+    }
+
+    return i;
+  }
+
+  return length;
+}
+
+// Composes the next frame by replaying `s` - the same bytes that would
+// otherwise be written to the terminal - over a blank back buffer
+void
+screen_load (screen_t* self, const char* s, size_t length) {
+  screen_writer_t w = {blank, 0, 0, false};
+
+  screen_fill(self->back, self->rows * self->cols, blank);
+
+  for (size_t i = 0; i < length; i++) {
+    char c = s[i];
+
+    if (c == ESC_SEQ_CHAR && i + 1 < length && s[i + 1] == '[') {
+      i = screen_load_csi(self, &w, s, length, i + 2);
+      continue;
+    }
+
+    if (c == '\r') {
+      w.x    = 0;
+      w.wrap = false;
+      continue;
+    }
+
+    if (c == '\n') {
+      w.y++;
+      w.wrap = false;
+      continue;
+    }
+
+    if (w.wrap) {
+      w.x    = 0;
+      w.wrap = false;
+      w.y++;
+    }
+
+    if (w.y < self->rows) {
+      screen_cell_t* cell = &self->back[w.y * self->cols + w.x];
+      *cell               = w.pen;
+      cell->ch            = c;
+    }
+
+    if (++w.x == self->cols) {
+      w.x    = self->cols - 1;
+      w.wrap = true;
+    }
+  }
+}
+
+static void
+screen_emit_pen (frame_buffer_t* out, screen_cell_t* pen, const screen_cell_t* cell) {
+  if (screen_attrs_equal(pen, cell)) {
+    return;
+  }
+
+  char sgr[48];
+  int  n = snprintf(sgr, sizeof(sgr), ESC_SEQ "[0");
+
+  if (cell->flags & SCREEN_INVERT) {
+    n += snprintf(sgr + n, sizeof(sgr) - n, ";7");
+  }
+  if (cell->fg >= 0) {
+    n += snprintf(sgr + n, sizeof(sgr) - n, ";38;5;%d", cell->fg);
+  }
+  if (cell->bg >= 0) {
+    n += snprintf(sgr + n, sizeof(sgr) - n, ";48;5;%d", cell->bg);
+  }
+  snprintf(sgr + n, sizeof(sgr) - n, "m");
+
+  frame_buffer_append(out, sgr);
+  *pen = *cell;
+}
+
+static void
+screen_emit_move (frame_buffer_t* out, unsigned int y, unsigned int x) {
+  char curs[32];
+  snprintf(curs, sizeof(curs), ESC_SEQ_CURSOR_POS_FMT, y + 1, x + 1);
+  frame_buffer_append(out, curs);
+}
+
+static inline bool
+screen_cell_is_blank (const screen_cell_t* cell) {
+  return screen_cell_equal(cell, &blank);
+}
+
+// Columns only line up with bytes for printable ASCII rows. Rows with
+// multi-byte characters, tabs or other control bytes are always rewritten
+// whole, so a sequence is never split and the terminal places each byte.
+static bool
+screen_row_is_plain (const screen_cell_t* row, unsigned int cols) {
+  for (unsigned int x = 0; x < cols; x++) {
+    unsigned char ch = row[x].ch;
+    if (ch >= 0x80 || ch < 0x20) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void
+screen_flush_row (screen_t* self, unsigned int y, screen_cell_t* pen, frame_buffer_t* out) {
+  screen_cell_t* front = self->front + y * self->cols;
+  screen_cell_t* back  = self->back + y * self->cols;
+  unsigned int   cols  = self->cols;
+
+  // Default blanks from `tail` on are cleared with one erase
+  unsigned int tail = cols;
+  while (tail > 0 && screen_cell_is_blank(&back[tail - 1])) {
+    tail--;
+  }
+
+  bool whole = !screen_row_is_plain(back, cols) || !screen_row_is_plain(front, cols);
+
+  for (unsigned int x = 0; x < cols;) {
+    if (screen_cell_equal(&front[x], &back[x])) {
+      x++;
+      continue;
+    }
+
+    if (whole) {
+      x = 0;
+    }
+
+    screen_emit_move(out, y, x);
+
+    if (x >= tail) {
+      screen_emit_pen(out, pen, &blank);
+      frame_buffer_append(out, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
+      break;
+    }
+
+    // Extend the run over short stretches of unchanged cells
+    unsigned int run_end = x + 1;
+    for (unsigned int i = run_end; i < tail && i - run_end < SCREEN_RUN_GAP; i++) {
+      if (whole || !screen_cell_equal(&front[i], &back[i])) {
+        run_end = i + 1;
+      }
+    }
+
+    for (; x < run_end; x++) {
+      screen_emit_pen(out, pen, &back[x]);
+      frame_buffer_append_char(out, back[x].ch);
+    }
+
+    if (whole && tail < cols) {
+      screen_emit_pen(out, pen, &blank);
+      frame_buffer_append(out, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
+      break;
+    }
+  }
+
+  memcpy(front, back, cols * sizeof(screen_cell_t));
+}
+
+// Writes the escape sequences that turn the front buffer into the back
+// buffer to `out`, and swaps them. Leaves the pen at the default.
+void
+screen_flush (screen_t* self, frame_buffer_t* out) {
+  screen_cell_t pen = blank;
+
+  if (!self->valid) {
+    frame_buffer_append(out, ESC_SEQ_NORM_COLOR ESC_SEQ_CLEAR_SCREEN);
+    screen_fill(self->front, self->rows * self->cols, blank);
+    self->valid = true;
+  }
+
+  for (unsigned int y = 0; y < self->rows; y++) {
+    screen_flush_row(self, y, &pen, out);
+  }
+
+  if (!screen_attrs_equal(&pen, &blank)) {
+    frame_buffer_append(out, ESC_SEQ_NORM_COLOR);
+  }
+}
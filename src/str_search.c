@@ -1,28 +1,18 @@
 #include "str_search.h"
 
-#include <alloca.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include "calc.h"
-#include "libutil/libutil.h"
-
-static bool
-has_prefix (char *s, char *prefix) {
-  size_t s_len      = strlen(s);
-  size_t prefix_len = strlen(prefix);
-  char  *sub_s      = s_substr(s, 0, prefix_len, false);
-
-  return s_len >= prefix_len && s_equals(sub_s ? sub_s : "", prefix);
-}
+#include "xmalloc.h"
 
+// Length of the longest common suffix of `a` and `b`
 static int
-longest_common_suffix (char *a, char *b) {
-  int    i     = 0;
-  size_t a_len = strlen(a);
-  size_t b_len = strlen(b);
+longest_common_suffix (const char *a, size_t a_len, const char *b, size_t b_len) {
+  int i = 0;
 
-  for (; a_len && i < b_len; i++) {
+  for (; i < (int)a_len && i < (int)b_len; i++) {
     if (a[a_len - 1 - i] != b[b_len - 1 - i]) {
       break;
     }
@@ -31,30 +21,36 @@ longest_common_suffix (char *a, char *b) {
   return i;
 }
 
-void
+// Builds the tables for `pattern`. Returns false for a pattern too long for
+// them to index, which is then only to be freed.
+bool
 string_finder_init (string_finder_t *self, char *pattern) {
-  self->pattern_len = strlen(pattern);
-  self->pattern     = pattern;
+  self->pattern_len      = strlen(pattern);
+  self->pattern          = pattern;
 
-  int last          = self->pattern_len - 1;
+  if (self->pattern_len > INT_MAX) {
+    self->good_suffix_skip = NULL;
+    self->tail             = NULL;
+    return false;
+  }
+
+  self->good_suffix_skip = xmalloc((self->pattern_len + 1) * sizeof(int));
+  self->tail             = xmalloc(self->pattern_len + 1);
 
-  self->bad_char_skip[256];
-  self->good_suffix_skip = alloca(self->pattern_len + 2);
+  int last               = self->pattern_len - 1;
 
   for (int i = 0; i < 256; i++) {
     self->bad_char_skip[i] = self->pattern_len;
   }
 
   for (int i = 0; i < last; i++) {
-    self->bad_char_skip[self->pattern[i]] = last - i;
+    self->bad_char_skip[(unsigned char)self->pattern[i]] = last - i;
   }
 
+  // Where pattern[i + 1:] is also a prefix, the pattern can shift to align it
   int last_prefix = last;
   for (int i = last; i >= 0; i--) {
-    char *prefix = s_substr(self->pattern, i + 1, self->pattern_len - 1, true);
-
-    bool cond    = prefix ? has_prefix(self->pattern, prefix) : has_prefix(self->pattern, "");
-    if (cond) {
+    if (memcmp(self->pattern, self->pattern + i + 1, last - i) == 0) {
       last_prefix = i + 1;
     }
 
@@ -62,34 +58,101 @@ string_finder_init (string_finder_t *self, char *pattern) {
   }
 
   for (int i = 0; i < last; i++) {
-    char  *suffix     = s_substr(self->pattern, 1, i + 1, false);
-    size_t suffix_len = suffix ? longest_common_suffix(self->pattern, suffix) : 0;
+    int suffix_len = longest_common_suffix(self->pattern, self->pattern_len, self->pattern + 1, i);
 
     if (self->pattern[i - suffix_len] != self->pattern[last - suffix_len]) {
       self->good_suffix_skip[last - suffix_len] = suffix_len + last - i;
     }
   }
+
+  string_finder_start(self, 0);
+  return true;
 }
 
-int
-string_finder_next (string_finder_t *self, char *text, unsigned int find_n) {
-  int    i        = self->pattern_len - 1;
-  size_t text_len = strlen(text);
+void
+string_finder_free (string_finder_t *self) {
+  free(self->good_suffix_skip);
+  free(self->tail);
+}
 
-  while (i < (int)text_len) {
-    int j = self->pattern_len - 1;
+// Starts a search of text fed span by span, from index `from`
+void
+string_finder_start (string_finder_t *self, unsigned int from) {
+  self->offset   = from;
+  self->next     = from;
+  self->tail_len = 0;
+}
+
+// Byte `k` of the tail followed by the span
+static inline unsigned char
+string_finder_at (string_finder_t *self, const char *span, size_t k) {
+  return k < self->tail_len ? self->tail[k] : span[k - self->tail_len];
+}
 
-    while (j >= 0 && text[i] == self->pattern[j]) {
+// Searches the next span of the text in place. Returns true with `index` set
+// to that of a match ending in it, and is to be fed the same span again for
+// the next one; or false once there are no more, to be fed the span that
+// follows.
+bool
+string_finder_feed (string_finder_t *self, const char *span, unsigned int length, unsigned int *index) {
+  size_t m    = self->pattern_len;
+  // Index of the tail's first byte
+  size_t base = self->offset - self->tail_len;
+
+  while (self->next + m <= self->offset + length) {
+    // Text index (from the tail's start) aligned with pattern[j - 1]
+    size_t i = self->next + m - 1 - base;
+    size_t j = m;
+
+    while (j > 0 && string_finder_at(self, span, i) == (unsigned char)self->pattern[j - 1]) {
       i--;
       j--;
     }
 
-    if ((int)j < 0) {
-      return i + 1;
+    if (j == 0) {
+      *index = self->next++;
+      return true;
     }
 
-    i += max(self->bad_char_skip[text[i]], self->good_suffix_skip[j]);
+    size_t bad_skip   = self->bad_char_skip[string_finder_at(self, span, i)];
+    size_t good_skip  = self->good_suffix_skip[j - 1];
+
+    i                += bad_skip > good_skip ? bad_skip : good_skip;
+    self->next        = base + i - (m - 1);
+  }
+
+  // Carry the bytes the next window can start in
+  size_t keep = m > 0 ? m - 1 : 0;
+
+  if (keep > self->tail_len + length) {
+    keep = self->tail_len + length;
+  }
+
+  if (keep <= length) {
+    memcpy(self->tail, span + length - keep, keep);
+  } else {
+    memmove(self->tail, self->tail + self->tail_len - (keep - length), keep - length);
+    memcpy(self->tail + keep - length, span, length);
+  }
+
+  self->tail_len  = keep;
+  self->offset   += length;
+
+  return false;
+}
+
+// Finds match `find_n` of the pattern in `text`, counting from 0. Returns
+// whether there is one, with `index` set to its index.
+bool
+string_finder_next (string_finder_t *self, char *text, unsigned int find_n, unsigned int *index) {
+  unsigned int text_len = strlen(text);
+  bool         found;
+
+  string_finder_start(self, 0);
+
+  while ((found = string_finder_feed(self, text, text_len, index)) && find_n > 0) {
+    find_n--;
   }
 
-  return -1;
+  return found;
 }
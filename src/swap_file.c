@@ -0,0 +1,443 @@
+#include "swap_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "xmalloc.h"
+
+#define SWAP_FILE_MAGIC    "tblswap1"
+#define SWAP_FILE_MAGIC_SZ 8
+
+typedef enum {
+  SWAP_FILE_CHANGE = 1,
+  SWAP_FILE_BASE,
+} swap_file_record_type;
+
+// Swap file record. A change is followed by the `inserted` bytes it put at
+// `index`, in place of `removed` bytes.
+typedef struct {
+  unsigned int     type;
+  unsigned int     index;
+  unsigned int     removed;
+  unsigned int     inserted;
+  // For a base, the changes logged before it
+  unsigned int     mark;
+  swap_file_base_t base;
+} swap_file_record_t;
+
+bool
+swap_file_base_of (const char* filepath, swap_file_base_t* base) {
+  struct stat st;
+
+  memset(base, 0, sizeof(swap_file_base_t));
+  if (stat(filepath, &st) == -1) {
+    return false;
+  }
+
+  base->dev        = st.st_dev;
+  base->ino        = st.st_ino;
+  base->size       = st.st_size;
+  base->mtime_sec  = st.st_mtim.tv_sec;
+  base->mtime_nsec = st.st_mtim.tv_nsec;
+
+  return true;
+}
+
+// Makes room for `n` more pending bytes. The lock must be held.
+static char*
+swap_file_reserve (swap_file_t* self, size_t n) {
+  if (self->pending_len + n > self->pending_cap) {
+    self->pending_cap = self->pending_cap ? self->pending_cap : 4096;
+    while (self->pending_len + n > self->pending_cap) {
+      self->pending_cap *= 2;
+    }
+    self->pending = xrealloc(self->pending, self->pending_cap);
+  }
+
+  char* dest         = self->pending + self->pending_len;
+  self->pending_len += n;
+  return dest;
+}
+
+// Queues the start of a log over `base`. The lock must be held.
+static void
+swap_file_queue_header (swap_file_t* self, const swap_file_base_t* base) {
+  swap_file_record_t record = {.type = SWAP_FILE_BASE, .mark = 0, .base = *base};
+
+  memcpy(swap_file_reserve(self, SWAP_FILE_MAGIC_SZ), SWAP_FILE_MAGIC, SWAP_FILE_MAGIC_SZ);
+  memcpy(swap_file_reserve(self, sizeof(record)), &record, sizeof(record));
+}
+
+static void
+swap_file_write_all (int fd, const char* s, size_t n) {
+  while (n > 0) {
+    ssize_t written = write(fd, s, n);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Nothing to be done; the log is best effort
+      return;
+    }
+
+    s += written;
+    n -= written;
+  }
+}
+
+// Writes out whatever was logged every `sync_ms`, and syncs it. Runs until
+// the swap file is closed, then writes out the rest.
+static void*
+swap_file_run (void* arg) {
+  swap_file_t* self      = arg;
+  char*        batch     = NULL;
+  size_t       batch_cap = 0;
+
+  pthread_mutex_lock(&self->lock);
+
+  while (true) {
+    if (!self->stop) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec  += self->sync_ms / 1000;
+      deadline.tv_nsec += (long)(self->sync_ms % 1000) * 1000000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+
+      pthread_cond_timedwait(&self->wake, &self->lock, &deadline);
+    }
+
+    // Take the pending records, leaving the spare buffer in their place
+    char*  pending     = self->pending;
+    size_t pending_len = self->pending_len;
+    size_t pending_cap = self->pending_cap;
+    bool   reset       = self->reset;
+    bool   stop        = self->stop;
+
+    self->pending      = batch;
+    self->pending_cap  = batch_cap;
+    self->pending_len  = 0;
+    self->reset        = false;
+    batch              = pending;
+    batch_cap          = pending_cap;
+
+    pthread_mutex_unlock(&self->lock);
+
+    if (reset && ftruncate(self->fd, 0) == -1) {
+      // Appending to the old log would leave it unreadable past this point
+      pending_len = 0;
+    }
+
+    if (pending_len > 0) {
+      swap_file_write_all(self->fd, batch, pending_len);
+      fdatasync(self->fd);
+    }
+
+    if (stop) {
+      break;
+    }
+
+    pthread_mutex_lock(&self->lock);
+  }
+
+  free(batch);
+  return NULL;
+}
+
+// Replays the changes logged after the last save of the file `base` describes
+// onto `pt`. `log` is a swap file's contents. Returns the number replayed, or
+// -1 if it holds no save of that file.
+static int
+swap_file_replay (const char* log, size_t length, const swap_file_base_t* base, piece_table_t* pt) {
+  const char*        end  = log + length;
+  const char*        p    = log + SWAP_FILE_MAGIC_SZ;
+  unsigned int       n    = 0;
+  int                from = -1;
+  swap_file_record_t record;
+
+  if (length < SWAP_FILE_MAGIC_SZ || memcmp(log, SWAP_FILE_MAGIC, SWAP_FILE_MAGIC_SZ) != 0) {
+    return -1;
+  }
+
+  // Find the last save of the file as it is now. A record cut short by a
+  // crash ends the log.
+  while ((size_t)(end - p) >= sizeof(record)) {
+    memcpy(&record, p, sizeof(record));
+
+    if (record.type == SWAP_FILE_BASE) {
+      if (memcmp(&record.base, base, sizeof(swap_file_base_t)) == 0 && record.mark <= n) {
+        from = record.mark;
+      }
+    } else if (record.type == SWAP_FILE_CHANGE && (size_t)(end - p) - sizeof(record) >= record.inserted) {
+      n++;
+      p += record.inserted;
+    } else {
+      break;
+    }
+
+    p += sizeof(record);
+  }
+
+  if (from == -1) {
+    return -1;
+  }
+
+  // Replay the changes it doesn't hold
+  end = p;
+  n   = 0;
+
+  for (p = log + SWAP_FILE_MAGIC_SZ; p < end; p += sizeof(record)) {
+    memcpy(&record, p, sizeof(record));
+    if (record.type != SWAP_FILE_CHANGE) {
+      continue;
+    }
+
+    const char* inserted  = p + sizeof(record);
+    p                    += record.inserted;
+
+    if (from > 0) {
+      from--;
+      continue;
+    }
+
+    if (record.index > pt->seq_length || record.removed > pt->seq_length - record.index) {
+      break;
+    }
+
+    if (record.removed) {
+      piece_table_delete(pt, record.index, record.removed, PT_DELETE, NULL);
+    }
+
+    if (record.inserted) {
+      piece_table_insert_n(pt, record.index, inserted, record.inserted, NULL);
+    }
+
+    n++;
+  }
+
+  return n;
+}
+
+// Reads the whole swap file. Returns NULL if it is empty.
+static char*
+swap_file_read (int fd, size_t* length) {
+  struct stat st;
+  char*       log = NULL;
+
+  *length         = 0;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    log = xmalloc(st.st_size);
+
+    while (*length < (size_t)st.st_size) {
+      ssize_t n = pread(fd, log + *length, st.st_size - *length, *length);
+      if (n <= 0) {
+        break;
+      }
+      *length += n;
+    }
+  }
+
+  return log;
+}
+
+// Opens the swap file at `path`, and locks it for this session. Returns -1,
+// with `status` set, if it can't be opened or another session holds it.
+static int
+swap_file_lock (const char* path, swap_file_status* status) {
+  int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+
+  if (fd == -1) {
+    *status = SWAP_FILE_ERR;
+    return -1;
+  }
+
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+    *status = errno == EWOULDBLOCK ? SWAP_FILE_IN_USE : SWAP_FILE_ERR;
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Starts a swap file at `path` for `pt`, whose text is that of the file `base`
+// describes, and logs its every change from here on. A swap file left there
+// by a session that didn't exit cleanly is replayed onto `pt` first, and
+// `n_recovered` set to the number of changes recovered. One left over a
+// different file is moved aside to `path~`, rather than lost. Returns NULL if
+// the swap file is held by another session, or can't be opened; `status`
+// tells which.
+swap_file_t*
+swap_file_open (const char* path, const swap_file_base_t* base, unsigned int sync_ms, piece_table_t* pt, int* n_recovered, swap_file_status* status) {
+  size_t length = 0;
+  char*  log    = NULL;
+  int    fd     = swap_file_lock(path, status);
+
+  *n_recovered  = 0;
+
+  if (fd == -1) {
+    return NULL;
+  }
+
+  *status           = SWAP_FILE_OK;
+  log               = swap_file_read(fd, &length);
+
+  swap_file_t* self = xmalloc(sizeof(swap_file_t));
+  self->path        = s_copy(path);
+  self->fd          = fd;
+  self->pending     = NULL;
+  self->pending_len = 0;
+  self->pending_cap = 0;
+  self->reset       = false;
+  self->stop        = false;
+  self->sync_ms     = sync_ms;
+  self->num_changes = 0;
+
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_cond_init(&self->wake, NULL);
+  swap_file_queue_header(self, base);
+
+  // The recovered changes are logged anew, so they survive another crash
+  piece_table_on_change(pt, swap_file_on_change, self);
+
+  int n = log ? swap_file_replay(log, length, base, pt) : 0;
+  piece_table_break(pt);
+  free(log);
+
+  if (n == -1) {
+    // Another file's changes; keep them for the user to recover by hand
+    char* aside = s_fmt("%s~", path);
+    bool  moved = rename(path, aside) == 0;
+
+    free(aside);
+    close(fd);
+
+    *status = SWAP_FILE_ERR;
+    fd      = moved ? swap_file_lock(path, status) : -1;
+
+    if (fd == -1) {
+      piece_table_on_change(pt, NULL, NULL);
+      pthread_mutex_destroy(&self->lock);
+      pthread_cond_destroy(&self->wake);
+      free(self->pending);
+      free(self->path);
+      free(self);
+      return NULL;
+    }
+
+    self->fd = fd;
+    *status  = SWAP_FILE_MOVED_ASIDE;
+  } else {
+    *n_recovered = n;
+  }
+
+  // Only now that the log is replayed can it start over
+  ftruncate(fd, 0);
+
+  // The recovered changes are only in memory until the new log holds them;
+  // don't leave that to the writer's first sync
+  if (*n_recovered > 0) {
+    swap_file_write_all(fd, self->pending, self->pending_len);
+    fdatasync(fd);
+    self->pending_len = 0;
+  }
+
+  if (pthread_create(&self->thread, NULL, swap_file_run, self) != 0) {
+    panic("failed to start the swap file writer for %s\n", path);
+  }
+
+  return self;
+}
+
+// Stops logging and writes out the rest. The swap file is deleted if
+// `remove`, as there is nothing to recover after a clean exit.
+void
+swap_file_close (swap_file_t* self, bool remove) {
+  pthread_mutex_lock(&self->lock);
+  self->stop = true;
+  pthread_cond_signal(&self->wake);
+  pthread_mutex_unlock(&self->lock);
+
+  pthread_join(self->thread, NULL);
+
+  // Unlinked while still locked, so another session can't take it over first
+  if (remove) {
+    unlink(self->path);
+  }
+  close(self->fd);
+
+  pthread_mutex_destroy(&self->lock);
+  pthread_cond_destroy(&self->wake);
+  free(self->pending);
+  free(self->path);
+  free(self);
+}
+
+// `piece_table_change_fn` that logs the change. Only copies the inserted text;
+// the writer does the rest.
+void
+swap_file_on_change (void* ctx, piece_table_t* pt, unsigned int index, unsigned int removed, unsigned int inserted) {
+  swap_file_t*            self   = ctx;
+  swap_file_record_t      record = {.type = SWAP_FILE_CHANGE, .index = index, .removed = removed, .inserted = inserted};
+  piece_table_span_iter_t it;
+  const char*             span;
+  unsigned int            length;
+
+  pthread_mutex_lock(&self->lock);
+
+  memcpy(swap_file_reserve(self, sizeof(record)), &record, sizeof(record));
+
+  piece_table_span_iter_init(&it, pt, index, inserted);
+  while (piece_table_span_iter_next(&it, &span, &length)) {
+    memcpy(swap_file_reserve(self, length), span, length);
+  }
+
+  self->num_changes++;
+  pthread_mutex_unlock(&self->lock);
+}
+
+// The number of changes logged so far, to pass to `swap_file_saved` once
+// the text as of now is written
+unsigned int
+swap_file_mark (swap_file_t* self) {
+  pthread_mutex_lock(&self->lock);
+  unsigned int mark = self->num_changes;
+  pthread_mutex_unlock(&self->lock);
+
+  return mark;
+}
+
+// Records that the file `base` describes holds the text as of `mark`. With
+// nothing changed since, the log starts over.
+void
+swap_file_saved (swap_file_t* self, unsigned int mark, const swap_file_base_t* base) {
+  pthread_mutex_lock(&self->lock);
+
+  // A mark from before the log last started over
+  if (mark > self->num_changes) {
+    pthread_mutex_unlock(&self->lock);
+    return;
+  }
+
+  if (mark == self->num_changes) {
+    self->pending_len = 0;
+    self->reset       = true;
+    self->num_changes = 0;
+    swap_file_queue_header(self, base);
+  } else {
+    swap_file_record_t record = {.type = SWAP_FILE_BASE, .mark = mark, .base = *base};
+    memcpy(swap_file_reserve(self, sizeof(record)), &record, sizeof(record));
+  }
+
+  pthread_mutex_unlock(&self->lock);
+}
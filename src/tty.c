@@ -21,6 +21,7 @@
 
 void
 tty_disable_raw_mode (void) {
+  write(STDOUT_FILENO, ESC_SEQ_PASTE_MODE_OFF, sizeof(ESC_SEQ_PASTE_MODE_OFF) - 1);
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &editor.tty.og_tty);
 }
 
@@ -78,6 +79,9 @@ tty_enable_raw_mode (void) {
   if ((ret = tcsetattr(STDIN_FILENO, TCSAFLUSH, &tty)) != 0) {
     panic("Call to tcsetattr failed with return code %d\n", ret);
   }
+
+  // Have pastes arrive wrapped in markers, so they can be inserted in one go
+  write(STDOUT_FILENO, ESC_SEQ_PASTE_MODE_ON, sizeof(ESC_SEQ_PASTE_MODE_ON) - 1);
 }
 
 unsigned int
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "command_bar.h"
@@ -14,12 +15,51 @@
 #include "keypress.h"
 #include "line_buffer.h"
 #include "line_editor.h"
+#include "screen.h"
 #include "status_bar.h"
 
+// Undo history smaller than this is not worth a status bar entry
+#define WINDOW_HISTORY_SHOW_MIN (1 << 20)
+
 unsigned int line_pad = 0;
 
+// When the last frame was written out
+static struct timespec last_frame;
+
+// Formats a byte count compactly e.g. 512B, 48.0K, 1.5M
+static void
+window_format_bytes (char* out, size_t n_out, size_t n) {
+  if (n < 1024) {
+    snprintf(out, n_out, "%zuB", n);
+  } else if (n < 1024 * 1024) {
+    snprintf(out, n_out, "%.1fK", n / 1024.0);
+  } else {
+    snprintf(out, n_out, "%.1fM", n / (1024.0 * 1024.0));
+  }
+}
+
+// Undo history bookkeeping memory, once there's enough of it to be worth showing
+static void
+window_format_history (char* out, size_t n_out) {
+  size_t       size    = line_buffer_history_meta_size(editor.line_ed.r);
+  unsigned int spilled = line_buffer_history_spilled(editor.line_ed.r);
+  char         bytes[16];
+
+  out[0] = '\0';
+  if (size < WINDOW_HISTORY_SHOW_MIN && spilled == 0) {
+    return;
+  }
+
+  window_format_bytes(bytes, sizeof(bytes), size);
+  if (spilled) {
+    snprintf(out, n_out, "| Undo %s, %u on disk ", bytes, spilled);
+  } else {
+    snprintf(out, n_out, "| Undo %s ", bytes);
+  }
+}
+
 void
-window_draw_status_bar (buffer_t* buf) {
+window_draw_status_bar (frame_buffer_t* buf) {
   // TODO: Cleanup
   bool has_file         = !!editor.filepath;
   bool is_dirty         = line_buffer_dirty(editor.line_ed.r);
@@ -55,47 +95,80 @@ window_draw_status_bar (buffer_t* buf) {
 
   status_bar_set_left_component_msg(file_info);
 
-  char* curs_info = s_fmt("| Ln %d, Col %d ", lineno, colno);
-  status_bar_set_right_component_msg(curs_info);
+  char* curs_info;
+  if (editor_saving()) {
+    curs_info = s_fmt("| Saving %u%% | Ln %d, Col %d ", editor_save_progress(), lineno, colno);
+  } else if (line_buffer_indexing(editor.line_ed.r)) {
+    curs_info = s_fmt("| ~%u lines | Ln %d, Col %d ", line_buffer_line_count_estimate(editor.line_ed.r), lineno, colno);
+  } else {
+    curs_info = s_fmt("| Ln %d, Col %d ", lineno, colno);
+  }
+
+  char history[48];
+  window_format_history(history, sizeof(history));
 
-  buffer_append(buf, ESC_SEQ_INVERT_COLOR);
+  // The undo history goes in only if there's room for it
+  if (history[0] && strlen(editor.s_bar.left_component) + strlen(history) + strlen(curs_info) <= num_cols) {
+    status_bar_set_right_component_msg("%s%s", history, curs_info);
+  } else {
+    status_bar_set_right_component_msg(curs_info);
+  }
+
+  frame_buffer_append(buf, ESC_SEQ_INVERT_COLOR);
 
   unsigned int component_len = strlen(editor.s_bar.left_component) + strlen(editor.s_bar.right_component);
 
-  buffer_append(buf, editor.s_bar.left_component);
-  for (unsigned int len = 0; len < num_cols - component_len; len++) {
-    buffer_append(buf, " ");
+  frame_buffer_append(buf, editor.s_bar.left_component);
+  if (component_len < num_cols) {
+    frame_buffer_fill(buf, ' ', num_cols - component_len);
   }
-  buffer_append(buf, editor.s_bar.right_component);
+  frame_buffer_append(buf, editor.s_bar.right_component);
 
-  buffer_append(buf, ESC_SEQ_NORM_COLOR);
+  frame_buffer_append(buf, ESC_SEQ_NORM_COLOR);
   free(file_info);
   free(curs_info);
 }
 
+// Appends `length` bytes of `r` from `index`, straight from its pieces
+static void
+window_draw_text (frame_buffer_t* buf, line_buffer_t* r, unsigned int index, unsigned int length) {
+  piece_table_span_iter_t it;
+  const char*             span;
+  unsigned int            span_length;
+
+  piece_table_span_iter_init(&it, r->pt, index, length);
+  while (piece_table_span_iter_next(&it, &span, &span_length)) {
+    frame_buffer_append_with(buf, span, span_length);
+  }
+}
+
 void
-window_draw_command_bar (buffer_t* buf) {
+window_draw_command_bar (frame_buffer_t* buf) {
   if (editor.mode == COMMAND_MODE) {
     unsigned int num_cols = window_get_num_cols();
     if (editor.cmode == CB_MESSAGE) {
-      buffer_append(buf, editor.cbar_msg);
-      for (unsigned int len = 0; len < num_cols - strlen(editor.cbar_msg); len++) {
-        buffer_append(buf, " ");
+      // Messages wider than the terminal are cut off
+      size_t msg_len = strlen(editor.cbar_msg);
+      if (msg_len > num_cols) {
+        msg_len = num_cols;
       }
-      buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
+
+      frame_buffer_append_with(buf, editor.cbar_msg, msg_len);
+      frame_buffer_fill(buf, ' ', num_cols - msg_len);
+      frame_buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
       return;
     }
 
-    buffer_append(buf, COMMAND_BAR_PREFIX);
+    frame_buffer_append(buf, COMMAND_BAR_PREFIX);
 
-    line_info_t* row = (line_info_t*)array_get(editor.c_bar.r->line_info, 0);
-    if (!row) {
-      buffer_append(buf, " ");
-      buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
+    line_info_t row;
+    if (!line_buffer_get_line_info(editor.c_bar.r, 0, &row)) {
+      frame_buffer_append(buf, " ");
+      frame_buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
       return;
     }
 
-    int len = row->line_length - (cursor_get_col_off(&editor.c_bar));
+    int len = row.line_length - (cursor_get_col_off(&editor.c_bar));
     if (len < 0) {
       len = 0;
     }
@@ -104,21 +177,16 @@ window_draw_command_bar (buffer_t* buf) {
       len = (num_cols - 1);
     }
 
-    char line[row->line_length];
-    line_buffer_get_line(editor.c_bar.r, 0, line);
-
-    for (unsigned int i = cursor_get_col_off(&editor.c_bar); i < cursor_get_col_off(&editor.c_bar) + len; i++) {
-      buffer_append_char(buf, line[i]);
-    }
+    window_draw_text(buf, editor.c_bar.r, row.line_start + cursor_get_col_off(&editor.c_bar), len);
 
     if (len == 0) {
-      buffer_append(buf, " ");
+      frame_buffer_append(buf, " ");
     }
   } else {
-    buffer_append(buf, " ");
+    frame_buffer_append(buf, " ");
   }
 
-  buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
+  frame_buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
 }
 
 static void
@@ -173,7 +241,7 @@ window_compute_select_range (unsigned int row_num, line_info_t* current_line, in
 }
 
 static void
-window_draw_row (buffer_t* buf, line_info_t* row, unsigned int lineno, int select_start, int select_end, bool is_current) {
+window_draw_row (frame_buffer_t* buf, line_info_t* row, int select_start, int select_end, bool is_current) {
   int len = row->line_length - (cursor_get_col_off(&editor.line_ed));
   if (len < 0) {
     len = 0;
@@ -191,35 +259,24 @@ window_draw_row (buffer_t* buf, line_info_t* row, unsigned int lineno, int selec
     select_end = len + cursor_get_col_off(&editor.line_ed) - 1;
   }
 
-  char line[row->line_length];
-  line_buffer_get_line(editor.line_ed.r, lineno, line);
-
   bool is_selected = select_end != -1 && cursor_is_select_active(&editor.line_ed) && select_end >= select_start;
 
-  // Start at &line[col_off], go for `len` chars
-  for (unsigned int i = cursor_get_col_off(&editor.line_ed); i < cursor_get_col_off(&editor.line_ed) + len; i++) {
-    if (is_selected) {
-      if (i == select_start) {
-        buffer_append(buf, ESC_SEQ_BG_COLOR(218));
-      }
-    }
+  // Start at col_off, go for `len` chars, copying around the selection
+  unsigned int start = row->line_start;
+  unsigned int i     = cursor_get_col_off(&editor.line_ed);
+  unsigned int end   = i + len;
 
-    char tmp[2];
-    tmp[0] = line[i];
-    tmp[1] = '\0';
+  if (is_selected && (unsigned int)select_start < end) {
+    window_draw_text(buf, editor.line_ed.r, start + i, select_start - i);
+    frame_buffer_append(buf, ESC_SEQ_BG_COLOR(218));
+    i = select_start;
 
-    buffer_append(buf, tmp);
-
-    if (is_selected) {
-      if (i == select_end) {
-        if (is_current) {
-          buffer_append(buf, ESC_SEQ_BG_COLOR(238));
-        } else {
-          buffer_append(buf, ESC_SEQ_NORM_COLOR);
-        }
-      }
-    }
+    window_draw_text(buf, editor.line_ed.r, start + i, select_end + 1 - i);
+    frame_buffer_append(buf, is_current ? ESC_SEQ_BG_COLOR(238) : ESC_SEQ_NORM_COLOR);
+    i = select_end + 1;
   }
+
+  window_draw_text(buf, editor.line_ed.r, start + i, end - i);
 }
 
 extern inline unsigned int
@@ -236,22 +293,29 @@ void
 window_clear (void) {
   write(STDOUT_FILENO, ESC_SEQ_CLEAR_SCREEN, 4);
   write(STDOUT_FILENO, ESC_SEQ_CURSOR_POS, 3);
+  screen_invalidate(&editor.screen);
 }
 
 void
 window_refresh (void) {
+  editor_save_poll();
+  line_buffer_refresh(editor.line_ed.r);
   window_scroll();
 
-  buffer_t* buf = buffer_init(NULL);
-
-  // Hide and later show the cursor to prevent flickering when drawing the grid
-  buffer_append(buf, ESC_SEQ_CURSOR_HIDE);
-  buffer_append(buf, ESC_SEQ_CURSOR_POS);
+  // Compose the frame, then write out only what changed since the last one
+  frame_buffer_t* frame = editor.frame;
+  frame_buffer_reset(frame);
+  window_draw_rows(frame);
+  window_draw_status_bar(frame);
+  window_draw_command_bar(frame);
+  screen_load(&editor.screen, frame_buffer_state(frame), frame_buffer_size(frame));
 
-  window_draw_rows(buf);
+  frame_buffer_t* buf = editor.out;
+  frame_buffer_reset(buf);
 
-  window_draw_status_bar(buf);
-  window_draw_command_bar(buf);
+  // Hide and later show the cursor to prevent flickering while drawing
+  frame_buffer_append(buf, ESC_SEQ_CURSOR_HIDE);
+  screen_flush(&editor.screen, buf);
 
   switch (editor.mode) {
     case EDIT_MODE: {
@@ -269,10 +333,22 @@ window_refresh (void) {
     }
   }
 
-  buffer_append(buf, ESC_SEQ_CURSOR_SHOW);
+  frame_buffer_append(buf, ESC_SEQ_CURSOR_SHOW);
 
-  write(STDOUT_FILENO, buffer_state(buf), buffer_size(buf));
-  buffer_free(buf);
+  write(STDOUT_FILENO, frame_buffer_state(buf), frame_buffer_size(buf));
+  clock_gettime(CLOCK_MONOTONIC, &last_frame);
+}
+
+// Returns how long until the frame rate allows the next refresh, 0 if it does now
+int
+window_frame_wait_ms (void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long elapsed_ms  = (now.tv_sec - last_frame.tv_sec) * 1000 + (now.tv_nsec - last_frame.tv_nsec) / 1000000;
+  long interval_ms = 1000 / (editor.conf.frame_rate ? editor.conf.frame_rate : DEFAULT_FRAME_RATE);
+
+  return elapsed_ms >= interval_ms ? 0 : (int)(interval_ms - elapsed_ms);
 }
 
 void
@@ -297,7 +373,7 @@ window_scroll (void) {
 }
 
 void
-window_draw_rows (buffer_t* buf) {
+window_draw_rows (frame_buffer_t* buf) {
   unsigned int lineno = cursor_get_row_off(&editor.line_ed);
   line_pad            = log10(editor.line_ed.r->num_lines) + 1;
 
@@ -311,27 +387,29 @@ window_draw_rows (buffer_t* buf) {
     unsigned int visible_row_idx = y + cursor_get_row_off(&editor.line_ed);
     // If the visible row index is > the number of buffered rows...
     if (visible_row_idx >= editor.line_ed.r->num_lines) {
-      buffer_append(buf, editor.conf.ln_prefix);
+      frame_buffer_append(buf, editor.conf.ln_prefix);
     } else {
-      bool  is_current_line = visible_row_idx == cursor_get_y(&editor.line_ed);
-      char* lineno_str      = s_fmt("%*ld ", line_pad, ++lineno);
+      bool is_current_line = visible_row_idx == cursor_get_y(&editor.line_ed);
 
       // Highlighted lineno
       if (is_current_line) {
-        buffer_append(buf, ESC_SEQ_COLOR(3));
+        frame_buffer_append(buf, ESC_SEQ_COLOR(3));
       }
 
-      buffer_append(buf, lineno_str);
-      free(lineno_str);
+      frame_buffer_append_uint(buf, ++lineno, line_pad);
+      frame_buffer_append_char(buf, ' ');
 
       // Highlight the current row where the cursor is
       if (is_current_line) {
-        buffer_append(buf, ESC_SEQ_NORM_COLOR);
-        buffer_append(buf, ESC_SEQ_BG_COLOR(238));
+        frame_buffer_append(buf, ESC_SEQ_NORM_COLOR);
+        frame_buffer_append(buf, ESC_SEQ_BG_COLOR(238));
       }
 
       // Has row content; render it...
-      line_info_t* current_row = (line_info_t*)array_get(editor.line_ed.r->line_info, visible_row_idx);
+      line_info_t  current_row_info;
+      line_info_t* current_row = line_buffer_get_line_info(editor.line_ed.r, visible_row_idx, &current_row_info)
+                                 ? &current_row_info
+                                 : NULL;
 
       // TODO: refactor
       int select_start = -1;
@@ -386,7 +464,7 @@ window_draw_rows (buffer_t* buf) {
       }
 
       if (current_row) {
-        window_draw_row(buf, current_row, visible_row_idx, select_start, select_end, is_current_line);
+        window_draw_row(buf, current_row, select_start, select_end, is_current_line);
       }
 
       if (is_current_line) {
@@ -394,16 +472,13 @@ window_draw_rows (buffer_t* buf) {
         // If it's the current row, reset the highlight after drawing the row
         int padding_len = (window_get_num_cols() + cursor_get_col_off(&editor.line_ed)) - (current_row_len + line_pad + 1);
         if (padding_len > 0) {
-          for (int i = 0; i < padding_len; i++) {
-            buffer_append(buf, " ");  // Highlight entire row till the end
-          }
+          frame_buffer_fill(buf, ' ', padding_len);  // Highlight entire row till the end
         }
-        buffer_append(buf, ESC_SEQ_NORM_COLOR);
+        frame_buffer_append(buf, ESC_SEQ_NORM_COLOR);
       }
     }
 
     // Clear line to the right of the cursor
-    buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
-    buffer_append(buf, CRLF);
+    frame_buffer_append(buf, ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF);
   }
 }
@@ -0,0 +1,20 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "editor.h"
+#include "file.h"
+#include "globals.h"
+
+static inline double
+bench_now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void run_line_scan_bench(void);
+
+#endif /* BENCH_H */
@@ -0,0 +1,97 @@
+#include "line_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "xmalloc.h"
+
+#define BENCH_INPUT_SZ (256u << 20)
+#define BENCH_ROUNDS   5
+
+typedef struct {
+  const char*   name;
+  line_scan_fn* scan;
+} line_scan_kernel_t;
+
+// Fills `s` with lines of `line_length` bytes, counting the line break
+static void
+fill_lines (char* s, unsigned int length, unsigned int line_length) {
+  memset(s, 'x', length);
+
+  if (line_length == 0) {
+    return;
+  }
+
+  for (unsigned int i = line_length - 1; i < length; i += line_length) {
+    s[i] = '\n';
+  }
+}
+
+// Returns the best throughput of a kernel over a few rounds, in GB/s
+static double
+bench_kernel (line_scan_fn* scan, const char* s, unsigned int length) {
+  double        best = 0;
+  line_breaks_t lb;
+  line_breaks_init(&lb);
+
+  for (unsigned int round = 0; round < BENCH_ROUNDS; round++) {
+    lb.size      = 0;
+    double start = bench_now();
+    scan(s, length, 0, &lb);
+    double elapsed = bench_now() - start;
+
+    double gbps = length / elapsed / 1e9;
+    if (gbps > best) {
+      best = gbps;
+    }
+  }
+
+  line_breaks_free(&lb);
+  return best;
+}
+
+void
+run_line_scan_bench (void) {
+  line_scan_kernel_t kernels[] = {
+    {"scalar", line_scan_scalar},
+#ifdef LINE_SCAN_X86
+    {"sse2",   line_scan_sse2  },
+    {"avx2",   line_scan_avx2  },
+#endif
+    {"auto",   line_scan       },
+  };
+  unsigned int line_lengths[] = {0, 16, 80, 4096};
+
+  char* s = xmalloc(BENCH_INPUT_SZ);
+
+  printf("line_scan: %u MiB input, best of %d rounds (GB/s)\n", BENCH_INPUT_SZ >> 20, BENCH_ROUNDS);
+  printf("%-10s", "line len");
+  for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    printf("%10s", kernels[k].name);
+  }
+  printf("\n");
+
+  for (unsigned int l = 0; l < sizeof(line_lengths) / sizeof(line_lengths[0]); l++) {
+    fill_lines(s, BENCH_INPUT_SZ, line_lengths[l]);
+
+    if (line_lengths[l]) {
+      printf("%-10u", line_lengths[l]);
+    } else {
+      printf("%-10s", "none");
+    }
+
+    for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+#ifdef LINE_SCAN_X86
+      if (kernels[k].scan == line_scan_avx2 && !__builtin_cpu_supports("avx2")) {
+        printf("%10s", "n/a");
+        continue;
+      }
+#endif
+      printf("%10.2f", bench_kernel(kernels[k].scan, s, BENCH_INPUT_SZ));
+    }
+    printf("\n");
+  }
+
+  free(s);
+}
@@ -0,0 +1,11 @@
+#include "bench.h"
+
+editor_t      editor;
+file_handle_t logger;
+
+int
+main () {
+  run_line_scan_bench();
+
+  return 0;
+}
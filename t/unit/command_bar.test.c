@@ -6,9 +6,7 @@
 #include "tests.h"
 #include "window.h"
 
-#define RESET_BUFFERS() \
-  buffer_free(buf);     \
-  buf = buffer_init(NULL)
+#define RESET_BUFFERS() frame_buffer_reset(buf)
 
 unsigned int
 tty_get_window_size (unsigned int *rows, unsigned int *cols) {
@@ -20,6 +18,8 @@ tty_get_window_size (unsigned int *rows, unsigned int *cols) {
 static void
 setup (void) {
   editor_init(&editor);
+  editor.conf.undo_file = false;
+  editor.conf.swap_file = false;
   editor_open("./t/fixtures/file.txt");
 }
 
@@ -36,20 +36,20 @@ test_basic_draw_command_bar (void) {
 
   editor.mode   = COMMAND_MODE;
   editor.cmode  = CB_INPUT;
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   CALL_N_TIMES(3, line_editor_insert_char(&editor.c_bar, 'x'));
 
   window_draw_command_bar(buf);
 
-  is(buffer_state(buf), COMMAND_BAR_PREFIX "xxx" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "draws the command bar");
+  is(frame_buffer_state(buf), COMMAND_BAR_PREFIX "xxx" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "draws the command bar");
 
   RESET_BUFFERS();
 
   command_bar_clear(&editor.c_bar);
   window_draw_command_bar(buf);
 
-  is(buffer_state(buf), COMMAND_BAR_PREFIX " " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "empty command bar after clear");
+  is(frame_buffer_state(buf), COMMAND_BAR_PREFIX " " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "empty command bar after clear");
 
   RESET_BUFFERS();
 
@@ -57,7 +57,7 @@ test_basic_draw_command_bar (void) {
   line_editor_delete_line_before_x(&editor.c_bar);
   window_draw_command_bar(buf);
 
-  is(buffer_state(buf), COMMAND_BAR_PREFIX " " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "empty command bar after delete line");
+  is(frame_buffer_state(buf), COMMAND_BAR_PREFIX " " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "empty command bar after delete line");
 
   RESET_BUFFERS();
 
@@ -65,21 +65,46 @@ test_basic_draw_command_bar (void) {
   CALL_N_TIMES(3, line_editor_insert_char(&editor.c_bar, 'x'));
   window_draw_command_bar(buf);
 
-  is(buffer_state(buf), COMMAND_BAR_PREFIX "xxx" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "command bar has prefix and text in command mode");
+  is(frame_buffer_state(buf), COMMAND_BAR_PREFIX "xxx" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "command bar has prefix and text in command mode");
 
   RESET_BUFFERS();
 
   command_bar_set_message_mode(&editor.c_bar, "test");
   window_draw_command_bar(buf);
-  is(buffer_state(buf), "test                                              " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "command bar has message in command.message mode");
+  is(frame_buffer_state(buf), "test                                              " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "command bar has message in command.message mode");
 
-  buffer_free(buf);
+  RESET_BUFFERS();
+
+  editor.win.cols = 8;
+  command_bar_set_message_mode(&editor.c_bar, "Wrote 12 bytes to a/long/path");
+  window_draw_command_bar(buf);
+  is(frame_buffer_state(buf), "Wrote 12" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "cuts off messages wider than the terminal");
+
+  frame_buffer_free(buf);
+}
+
+static void
+test_travel_count_out_of_range (void) {
+  const char *commands[] = {"earlier 99999999999999999999h", "later 596524h", "earlier 2147483648"};
+
+  for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+    mode_chmod(COMMAND_MODE);
+
+    for (const char *c = commands[i]; *c; c++) {
+      line_editor_insert_char(&editor.c_bar, *c);
+    }
+
+    command_bar_process_command(&editor.c_bar);
+
+    ok(editor.cmode == CB_MESSAGE && strncmp(editor.cbar_msg, "Invalid count", 13) == 0, "rejects counts that overflow an int (%s)", commands[i]);
+  }
 }
 
 void
 run_command_bar_tests (void) {
   void (*functions[])() = {
     test_basic_draw_command_bar,
+    test_travel_count_out_of_range,
   };
 
   for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
@@ -1,3 +1,8 @@
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "command_bar.h"
 #include "const.h"
 #include "editor.h"
 #include "keypress.h"
@@ -13,6 +18,9 @@ tty_get_window_size (unsigned int *rows, unsigned int *cols) {
 static void
 setup (void) {
   editor_init(&editor);
+  // Keep the fixtures free of undo and swap files
+  editor.conf.undo_file  = false;
+  editor.conf.swap_file  = false;
   // Undo the offset for the status and command bars since we're not drawing them.
   editor.win.rows += 2;
 }
@@ -22,19 +30,34 @@ teardown (void) {
   editor_free(&editor);
 }
 
+// Saves as `:w! filepath` would, and waits for the write to land
+static void
+save_from_command_bar (const char *filepath) {
+  char *command = s_fmt("w! %s", filepath);
+
+  mode_chmod(COMMAND_MODE);
+  for (char *c = command; *c; c++) {
+    line_editor_insert_char(&editor.c_bar, *c);
+  }
+
+  command_bar_process_command(&editor.c_bar);
+  editor_save_wait();
+  free(command);
+}
+
 /* clang-format off */
 static void
 test_editor_open (void) {
   editor_open("./t/fixtures/file.txt");
 
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
   window_draw_rows(buf);
 
   ok(editor.line_ed.r->num_lines == 38, "has 38 lines");
   ok(editor.line_ed.curs.x == 0, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 0, "cursor at cell zero");
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     ESC_SEQ_COLOR(3) "  1 " ESC_SEQ_NORM_COLOR ESC_SEQ_BG_COLOR(238) "amateuros                                     "
     ESC_SEQ_NORM_COLOR ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  2 bash" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
@@ -78,16 +101,234 @@ test_editor_open (void) {
     "each line is rendered correctly"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 /* clang-format on */
 
+static void
+test_editor_save (void) {
+  char  template[] = "/tmp/tabloid-save-XXXXXX";
+  char  expected[1024];
+  char  actual[1024];
+  FILE* fd;
+
+  close(mkstemp(template));
+
+  editor_open("./t/fixtures/file.txt");
+  line_buffer_insert(editor.line_ed.r, 0, 1, "edited ", NULL);
+
+  unsigned int sz      = piece_table_render(editor.line_ed.r->pt, 0, piece_table_size(editor.line_ed.r->pt), expected);
+  char*        message = s_fmt("Wrote %u bytes to %s", sz, template);
+  save_from_command_bar(template);
+
+  fd                   = fopen(template, "rb");
+  size_t n_read        = fread(actual, 1, sizeof(actual), fd);
+  fclose(fd);
+  unlink(template);
+
+  is(editor.cbar_msg, message, "reports the number of bytes written");
+  free(message);
+  ok(n_read == sz && memcmp(actual, expected, sz) == 0, "writes the edited document");
+}
+
+static void
+test_editor_save_over_open_file (void) {
+  char        dir_template[] = "/tmp/tabloid-save-XXXXXX";
+  char       *dir            = mkdtemp(dir_template);
+  char       *path           = s_fmt("%s/file.txt", dir);
+  char        expected[1024];
+  char        actual[1024];
+  struct stat st;
+
+  FILE  *src    = fopen("./t/fixtures/file.txt", "rb");
+  FILE  *dest   = fopen(path, "wb");
+  size_t n_read = fread(expected, 1, sizeof(expected), src);
+  fwrite(expected, 1, n_read, dest);
+  fclose(src);
+  fclose(dest);
+  chmod(path, 0640);
+
+  editor_open(path);
+  line_buffer_insert(editor.line_ed.r, 0, 2, "edited ", NULL);
+
+  unsigned int sz = piece_table_render(editor.line_ed.r->pt, 0, piece_table_size(editor.line_ed.r->pt), expected);
+  save_from_command_bar(path);
+
+  dest   = fopen(path, "rb");
+  n_read = fread(actual, 1, sizeof(actual), dest);
+  fclose(dest);
+
+  ok(n_read == sz && memcmp(actual, expected, sz) == 0, "replaces the open file with the edited document");
+
+  // The original pieces still read from the replaced file's mapping
+  piece_table_render(editor.line_ed.r->pt, 0, sz, actual);
+  ok(memcmp(actual, expected, sz) == 0, "the buffer is intact after replacing its backing file");
+
+  ok(stat(path, &st) == 0 && (st.st_mode & 07777) == 0640, "keeps the file's permissions");
+  ok(!line_buffer_dirty(editor.line_ed.r), "clears the dirty flag");
+
+  unlink(path);
+  ok(rmdir(dir) == 0, "leaves no temp file behind");
+  free(path);
+}
+
+static void
+test_editor_save_async (void) {
+  char  template[] = "/tmp/tabloid-save-XXXXXX";
+  char  expected[1024];
+  char  actual[1024];
+  FILE* fd;
+
+  close(mkstemp(template));
+
+  editor_open("./t/fixtures/file.txt");
+  line_buffer_insert(editor.line_ed.r, 0, 0, "a", NULL);
+
+  unsigned int sz = piece_table_render(editor.line_ed.r->pt, 0, piece_table_size(editor.line_ed.r->pt), expected);
+
+  ok(editor_save_async(template), "starts a background save");
+  ok(!editor_save_async(template), "refuses to start a second save while one is running");
+
+  // Keep typing where we left off while the save runs
+  line_buffer_insert(editor.line_ed.r, 1, 0, "b", NULL);
+  editor_save_wait();
+
+  fd            = fopen(template, "rb");
+  size_t n_read = fread(actual, 1, sizeof(actual), fd);
+  fclose(fd);
+
+  ok(n_read == sz && memcmp(actual, expected, sz) == 0, "writes the document as it was when the save started");
+  ok(line_buffer_dirty(editor.line_ed.r), "edits made during the save keep the buffer dirty");
+
+  piece_table_render(editor.line_ed.r->pt, 0, 2, actual);
+  ok(memcmp(actual, "ab", 2) == 0, "edits made during the save are kept");
+
+  unlink(template);
+}
+
+static void
+test_editor_open_too_large (void) {
+  char template[] = "/tmp/tabloid-large-XXXXXX";
+  int  fd         = mkstemp(template);
+
+  // Sparse, so nothing is actually written
+  ftruncate(fd, (off_t)UINT_MAX + 1);
+  close(fd);
+
+  editor_open(template);
+  ok(editor.filepath == NULL && editor.mode == COMMAND_MODE, "reports files over 4 GiB instead of opening them");
+
+  unlink(template);
+}
+
+static void
+test_editor_save_failure (void) {
+  save_from_command_bar("/nonexistent/file.txt");
+  ok(!editor_saving(), "a failed write finishes");
+  ok(editor.mode == COMMAND_MODE && editor.cmode == CB_MESSAGE, "a failed write is reported, not fatal");
+  is(editor.cbar_msg, "Failed to write /nonexistent/file.txt", "names the file it failed to write");
+}
+
+static void
+test_editor_undo_file (void) {
+  char  dir_template[] = "/tmp/tabloid-undo-XXXXXX";
+  char *dir            = mkdtemp(dir_template);
+  char *path           = s_fmt("%s/file.txt", dir);
+  char *undo_path      = s_fmt("%s/.file.txt.undo", dir);
+  char  actual[64];
+  FILE *fd;
+
+  fd = fopen(path, "wb");
+  fputs("hello world\n", fd);
+  fclose(fd);
+
+  editor.conf.undo_file = true;
+  editor_open(path);
+  line_buffer_insert(editor.line_ed.r, 5, 0, ",", NULL);
+  line_buffer_break(editor.line_ed.r);
+  line_buffer_insert(editor.line_ed.r, 12, 0, "!", NULL);
+  save_from_command_bar(path);
+
+  ok(file_exists(undo_path), "keeps the undo history beside the file");
+
+  // Reopen the file as a new session would
+  editor_open(path);
+  ok(!line_buffer_dirty(editor.line_ed.r), "reopens in the saved state");
+
+  line_editor_undo(&editor.line_ed);
+  line_editor_undo(&editor.line_ed);
+  piece_table_render(editor.line_ed.r->pt, 0, piece_table_size(editor.line_ed.r->pt), actual);
+  is(actual, "hello world\n", "restores the undo history");
+
+  line_editor_redo(&editor.line_ed);
+  piece_table_render(editor.line_ed.r->pt, 0, piece_table_size(editor.line_ed.r->pt), actual);
+  is(actual, "hello, world\n", "restores the redo history");
+
+  // Changed behind the editor's back; the history no longer applies
+  fd = fopen(path, "wb");
+  fputs("goodbye\n", fd);
+  fclose(fd);
+
+  editor_open(path);
+  ok(line_buffer_undo(editor.line_ed.r) == NULL, "ignores the undo history of a changed file");
+
+  unlink(undo_path);
+  unlink(path);
+  rmdir(dir);
+  free(undo_path);
+  free(path);
+}
+
+static void
+test_editor_swap_file (void) {
+  char  dir_template[] = "/tmp/tabloid-swap-XXXXXX";
+  char *dir            = mkdtemp(dir_template);
+  char *path           = s_fmt("%s/file.txt", dir);
+  char *swap_path      = s_fmt("%s/.file.txt.swp", dir);
+  char  actual[64];
+  FILE *fd;
+
+  fd = fopen(path, "wb");
+  fputs("hello world\n", fd);
+  fclose(fd);
+
+  editor.conf.swap_file = true;
+  editor_open(path);
+  line_buffer_insert(editor.line_ed.r, 5, 0, ",", NULL);
+  save_from_command_bar(path);
+  line_buffer_insert(editor.line_ed.r, 12, 0, "!", NULL);
+
+  // Crash, leaving the swap file behind
+  piece_table_on_change(editor.line_ed.r->pt, NULL, NULL);
+  swap_file_close(editor.swap, false);
+  editor.swap = NULL;
+
+  editor_open(path);
+  piece_table_render(editor.line_ed.r->pt, 0, piece_table_size(editor.line_ed.r->pt), actual);
+  is(actual, "hello, world!\n", "recovers the changes made since the last save");
+  ok(line_buffer_dirty(editor.line_ed.r), "recovered changes are unsaved");
+
+  editor_close_swap();
+  ok(!file_exists(swap_path), "removes the swap file on a clean exit");
+
+  unlink(path);
+  rmdir(dir);
+  free(swap_path);
+  free(path);
+}
+
 void
 run_file_mgmt_tests (void) {
   void (*functions[])() = {
-    // TODO: editor_save tests
     test_editor_open,
+    test_editor_save,
+    test_editor_save_over_open_file,
+    test_editor_save_async,
+    test_editor_save_failure,
+    test_editor_open_too_large,
+    test_editor_undo_file,
+    test_editor_swap_file,
   };
 
   for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
@@ -0,0 +1,53 @@
+#include "frame_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+
+static void
+test_frame_buffer_appends (void) {
+  frame_buffer_t* buf = frame_buffer_init();
+
+  frame_buffer_append(buf, "ab");
+  frame_buffer_append_with(buf, "cdef", 2);
+  frame_buffer_append_char(buf, '|');
+  frame_buffer_fill(buf, '.', 3);
+  frame_buffer_append_uint(buf, 42, 4);
+  frame_buffer_append_uint(buf, 0, 0);
+  frame_buffer_append_uint(buf, 123456, 2);
+
+  is(frame_buffer_state(buf), "abcd|...  420123456", "appends strings, runs of a char and padded integers");
+  ok(frame_buffer_size(buf) == 19, "tracks the length");
+
+  frame_buffer_free(buf);
+}
+
+static void
+test_frame_buffer_growth (void) {
+  frame_buffer_t* buf = frame_buffer_init();
+
+  for (unsigned int i = 0; i < 10000; i++) {
+    frame_buffer_append(buf, "0123456789");
+  }
+
+  bool intact = frame_buffer_size(buf) == 100000;
+  for (unsigned int i = 0; intact && i < 100000; i++) {
+    intact = frame_buffer_state(buf)[i] == (char)('0' + i % 10);
+  }
+  ok(intact, "grows past its initial capacity");
+
+  size_t capacity = buf->capacity;
+  frame_buffer_reset(buf);
+  frame_buffer_fill(buf, 'x', 50000);
+
+  ok(buf->capacity == capacity && frame_buffer_size(buf) == 50000, "reuses its memory after a reset");
+
+  frame_buffer_free(buf);
+}
+
+void
+run_frame_buffer_tests (void) {
+  test_frame_buffer_appends();
+  test_frame_buffer_growth();
+}
@@ -0,0 +1,72 @@
+#include "keypress.h"
+
+#include <unistd.h>
+
+#include "tests.h"
+
+static void
+setup (void) {
+  editor_init(&editor);
+  editor.conf.undo_file = false;
+  editor.conf.swap_file = false;
+  editor_open("./t/fixtures/file.txt");
+}
+
+static void
+teardown (void) {
+  editor_free(&editor);
+}
+
+// Handles `n` keypresses read from `input`, as though typed at the terminal
+static void
+type (const char* input, unsigned int n) {
+  int fds[2];
+  int saved = dup(STDIN_FILENO);
+
+  pipe(fds);
+  write(fds[1], input, strlen(input));
+  close(fds[1]);
+  dup2(fds[0], STDIN_FILENO);
+  close(fds[0]);
+
+  for (unsigned int i = 0; i < n; i++) {
+    keypress_handle();
+  }
+
+  dup2(saved, STDIN_FILENO);
+  close(saved);
+}
+
+static void
+test_keypress_f9 (void) {
+  char line[64];
+
+  type(ESC_SEQ "[20~x", 2);
+
+  line_buffer_get_line(editor.line_ed.r, 0, line);
+  ok(line[0] == 'x', "F9 doesn't swallow the next keypress");
+}
+
+static void
+test_keypress_paste (void) {
+  char line[64];
+
+  type(ESC_SEQ "[200~ab" ESC_SEQ_PASTE_END, 1);
+
+  line_buffer_get_line(editor.line_ed.r, 0, line);
+  ok(line[0] == 'a' && line[1] == 'b', "inserts bracketed pastes");
+}
+
+void
+run_keypress_tests (void) {
+  void (*functions[])() = {
+    test_keypress_f9,
+    test_keypress_paste,
+  };
+
+  for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+    setup();
+    functions[i]();
+    teardown();
+  }
+}
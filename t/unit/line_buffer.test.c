@@ -1,6 +1,8 @@
 #include "line_buffer.h"
 
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "piece_table.h"
 #include "tests.h"
@@ -15,14 +17,21 @@ get_line (line_buffer_t* lb, int lineno) {
   return buf;
 }
 
-static cursor_t*
+static line_info_t li_buf;
+
+static line_info_t*
+get_line_info (line_buffer_t* lb, int lineno) {
+  return line_buffer_get_line_info(lb, lineno, &li_buf) ? &li_buf : NULL;
+}
+
+static bool
+has_lines (line_buffer_t* lb, unsigned int n) {
+  return get_line_info(lb, n - 1) && !get_line_info(lb, n);
+}
+
+static undo_cursor_t
 create_test_cursor (int x, int y) {
-  cursor_t* curs = xmalloc(sizeof(cursor_t));
-  curs->x        = x;
-  curs->y        = y;
-  curs->col_off  = x;
-  curs->row_off  = x;
-  return curs;
+  return (undo_cursor_t){x, y};
 }
 
 static void
@@ -31,22 +40,22 @@ test_line_buffer (void) {
   line_buffer_t* lb  = line_buffer_init(raw);
   line_buffer_refresh(lb);
 
-  ok(array_size(lb->line_info) == 4, "has 4 lines");
+  ok(has_lines(lb, 4), "has 4 lines");
   ok(lb->num_lines == 4, "num_lines field is correct");
 
-  line_info_t* li = array_get(lb->line_info, 0);
+  line_info_t* li = get_line_info(lb, 0);
   ok(li->line_start == 0, "correct line start 1");
   ok(li->line_length == 5, "correct line length 1");
 
-  li = array_get(lb->line_info, 1);
+  li = get_line_info(lb, 1);
   ok(li->line_start == 6, "correct line start 2");
   ok(li->line_length == 5, "correct line length 2");
 
-  li = array_get(lb->line_info, 2);
+  li = get_line_info(lb, 2);
   ok(li->line_start == 12, "correct line start 3");
   ok(li->line_length == 4, "correct line length 3");
 
-  li = array_get(lb->line_info, 3);
+  li = get_line_info(lb, 3);
   ok(li->line_start == 17, "correct line start 4");
   ok(li->line_length == 9, "correct line length 4");
 
@@ -59,10 +68,35 @@ test_line_buffer_get_all (void) {
   line_buffer_t* lb  = line_buffer_init(raw);
   line_buffer_refresh(lb);
 
-  char* s = xmalloc(0);
-
-  line_buffer_get_all(lb, &s);
+  char* s = line_buffer_get_all(lb);
   is(s, raw, "retrieves the full buffer state");
+
+  free(s);
+  line_buffer_free(lb);
+}
+
+static void
+test_line_buffer_search (void) {
+  line_buffer_t*  lb = line_buffer_init("hello world");
+  string_finder_t sf;
+  unsigned int    index;
+
+  // Spread "lo wor" over four pieces
+  line_buffer_insert(lb, 5, 0, ",", NULL);
+  line_buffer_insert(lb, 7, 0, "new ", NULL);
+  line_buffer_delete_n(lb, 5, 0, 1, NULL);
+  line_buffer_insert(lb, 0, 0, "lo ", NULL);
+
+  string_finder_init(&sf, "lo new wor");
+  ok(line_buffer_search(lb, &sf, 0, &index) && index == 6, "finds a match that straddles pieces");
+  string_finder_free(&sf);
+
+  string_finder_init(&sf, "lo");
+  ok(line_buffer_search(lb, &sf, 1, &index) && index == 6, "searches from the given index");
+  ok(!line_buffer_search(lb, &sf, 7, &index), "finds nothing past the last match");
+  string_finder_free(&sf);
+
+  line_buffer_free(lb);
 }
 
 static void
@@ -109,22 +143,22 @@ test_line_buffer_newline (void) {
   // accidentally newline on 'em
   line_buffer_insert(lb, 9, 3, nl, NULL);
 
-  ok(array_size(lb->line_info) == 5, "has 5 lines");
+  ok(has_lines(lb, 5), "has 5 lines");
   ok(lb->num_lines == 5, "num_lines field is correct");
 
-  line_info_t* li = array_get(lb->line_info, 0);
+  line_info_t* li = get_line_info(lb, 0);
   ok(li->line_start == 0, "correct line start 1");
   ok(li->line_length == 5, "correct line length 1");
 
-  li = array_get(lb->line_info, 1);
+  li = get_line_info(lb, 1);
   ok(li->line_start == 6, "correct line start 2");
   ok(li->line_length == 5, "correct line length 2");
 
-  li = array_get(lb->line_info, 2);
+  li = get_line_info(lb, 2);
   ok(li->line_start == 12, "correct line start 3");
   ok(li->line_length == 4, "correct line length 3");
 
-  li = array_get(lb->line_info, 3);
+  li = get_line_info(lb, 3);
   ok(li->line_start == 17, "correct line start 4");
   ok(li->line_length == 9, "correct line length 4");
 
@@ -142,18 +176,18 @@ test_line_buffer_newlines_only (void) {
   line_buffer_insert(lb, 0, 0, nl, NULL);
   line_buffer_insert(lb, 0, 1, nl, NULL);
 
-  ok(array_size(lb->line_info) == 3, "has 3 lines");
+  ok(has_lines(lb, 3), "has 3 lines");
   ok(lb->num_lines == 3, "num_lines field is correct");
 
-  line_info_t* li = array_get(lb->line_info, 0);
+  line_info_t* li = get_line_info(lb, 0);
   ok(li->line_start == 0, "correct line start 1");
   ok(li->line_length == 0, "correct line length 1");
 
-  li = array_get(lb->line_info, 1);
+  li = get_line_info(lb, 1);
   ok(li->line_start == 1, "correct line start 2");
   ok(li->line_length == 0, "correct line length 2");
 
-  li = array_get(lb->line_info, 2);
+  li = get_line_info(lb, 2);
   ok(li->line_start == 2, "correct line start 3");
   ok(li->line_length == 0, "correct line length 3");
 
@@ -166,7 +200,7 @@ test_line_buffer_get_line (void) {
   line_buffer_t* lb  = line_buffer_init(raw);
   line_buffer_refresh(lb);
 
-  ok(array_size(lb->line_info) == 4, "has 4 lines");
+  ok(has_lines(lb, 4), "has 4 lines");
   ok(lb->num_lines == 4, "num_lines field is correct");
 
   is(get_line(lb, 0), "hello", "returns the expected line");
@@ -182,7 +216,7 @@ test_line_buffer_get_line (void) {
 
   line_buffer_insert(lb, 5, 0, "x", NULL);
 
-  ok(array_size(lb->line_info) == 4, "has 4 lines");
+  ok(has_lines(lb, 4), "has 4 lines");
   ok(lb->num_lines == 4, "num_lines field is correct");
 
   is(get_line(lb, 0), "hellox", "returns the expected line");
@@ -201,7 +235,7 @@ test_line_buffer_get_line (void) {
 
   line_buffer_insert(lb, 5, 3, "x", NULL);
 
-  ok(array_size(lb->line_info) == 4, "has 4 lines");
+  ok(has_lines(lb, 4), "has 4 lines");
   ok(lb->num_lines == 4, "num_lines field is correct");
 
   is(get_line(lb, 0), "hellox", "returns the expected line");
@@ -220,7 +254,7 @@ test_line_buffer_get_line (void) {
 
   line_buffer_insert(lb, 3, 3, "x", NULL);
 
-  ok(array_size(lb->line_info) == 4, "has 4 lines");
+  ok(has_lines(lb, 4), "has 4 lines");
   ok(lb->num_lines == 4, "num_lines field is correct");
 
   is(get_line(lb, 0), "hello", "returns the expected line");
@@ -233,7 +267,7 @@ test_line_buffer_get_line (void) {
 
   line_buffer_delete(lb, -1, 1, NULL);
 
-  ok(array_size(lb->line_info) == 3, "has 3 lines");
+  ok(has_lines(lb, 3), "has 3 lines");
   ok(lb->num_lines == 3, "num_lines field is correct");
 
   is(get_line(lb, 0), "hellowxxrld", "returns the expected line");
@@ -250,7 +284,7 @@ test_line_buffer_undo (void) {
   line_buffer_t* lb = line_buffer_init(NULL);
   line_buffer_refresh(lb);
 
-  cursor_t *c1, *c2, *c3, *c4, *c5, *c6, *c7, *c8, *c9;
+  undo_cursor_t c1, c2, c3, c4, c5, c6, c7, c8, c9;
   c1 = create_test_cursor(0, 0);
   c2 = create_test_cursor(1, 0);
   c3 = create_test_cursor(2, 0);
@@ -258,26 +292,21 @@ test_line_buffer_undo (void) {
   // persisted.
   c4 = create_test_cursor(3, 0);
 
-  line_buffer_insert(lb, 0, 0, "h", (void*)c1);
-  line_buffer_insert(lb, 1, 0, "e", (void*)c2);
-  line_buffer_insert(lb, 2, 0, "l", (void*)c3);
-  line_buffer_delete(lb, 2, 0, (void*)c4);
+  line_buffer_insert(lb, 0, 0, "h", &c1);
+  line_buffer_insert(lb, 1, 0, "e", &c2);
+  line_buffer_insert(lb, 2, 0, "l", &c3);
+  line_buffer_delete(lb, 2, 0, &c4);
 
-  cursor_t* curs = (cursor_t*)line_buffer_undo(lb);
+  const undo_cursor_t* curs = line_buffer_undo(lb);
   ok(curs->x == 3, "stored cursor is the correct value");
   ok(curs->y == 0, "stored cursor is the correct value");
   is(get_line(lb, 0), "hel", "undo reverts the delete char");
 
-  curs = (cursor_t*)line_buffer_undo(lb);
+  curs = line_buffer_undo(lb);
   ok(curs->x == 0, "stored cursor is now zero'd");
   ok(curs->y == 0, "stored cursor is now zero'd");
   is(get_line(lb, 0), "", "second undo reverts the entire word");
 
-  free(c1);
-  free(c2);
-  free(c3);
-  free(c4);
-
   c1 = create_test_cursor(0, 0);
   c2 = create_test_cursor(1, 0);
   c3 = create_test_cursor(2, 0);
@@ -288,56 +317,46 @@ test_line_buffer_undo (void) {
   c8 = create_test_cursor(2, 1);
   c9 = create_test_cursor(5, 0);
 
-  line_buffer_insert(lb, 0, 0, "o", (void*)c1);
-  line_buffer_insert(lb, 1, 0, "n", (void*)c2);
-  line_buffer_insert(lb, 2, 0, "e", (void*)c3);
+  line_buffer_insert(lb, 0, 0, "o", &c1);
+  line_buffer_insert(lb, 1, 0, "n", &c2);
+  line_buffer_insert(lb, 2, 0, "e", &c3);
   piece_table_break(lb->pt);  // Simulate what we do when char is delimiter
-  line_buffer_insert(lb, 3, 0, " ", (void*)c4);
-  line_buffer_insert(lb, 4, 0, "x", (void*)c5);
-  line_buffer_delete(lb, 4, 0, (void*)c9);
-  line_buffer_insert(lb, 4, 0, "\n", (void*)c5);
-  line_buffer_insert(lb, 0, 1, "t", (void*)c6);
-  line_buffer_insert(lb, 1, 1, "w", (void*)c7);
-  line_buffer_insert(lb, 2, 1, "o", (void*)c8);
+  line_buffer_insert(lb, 3, 0, " ", &c4);
+  line_buffer_insert(lb, 4, 0, "x", &c5);
+  line_buffer_delete(lb, 4, 0, &c9);
+  line_buffer_insert(lb, 4, 0, "\n", &c5);
+  line_buffer_insert(lb, 0, 1, "t", &c6);
+  line_buffer_insert(lb, 1, 1, "w", &c7);
+  line_buffer_insert(lb, 2, 1, "o", &c8);
 
   ok(lb->num_lines == 2, "has two lines");
   is(get_line(lb, 0), "one ", "first line correct");
   is(get_line(lb, 1), "two", "second line correct");
 
-  cursor_t* meta_c = (cursor_t*)line_buffer_undo(lb);
+  const undo_cursor_t* meta_c = line_buffer_undo(lb);
   ok(meta_c->y == 0, "sets cursor back to previous line");
   ok(meta_c->x == 4, "sets cursor back to previous line");
   ok(lb->num_lines == 1, "has one line now");
   is(get_line(lb, 0), "one ", "is the state before the newline");
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   ok(meta_c->y == 0, "sets the cursor after the un-deleted char");
   ok(meta_c->x == 5, "sets the cursor after the un-deleted char");
   ok(lb->num_lines == 1, "still has one line");
   is(get_line(lb, 0), "one x", "reverts the delete");
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   ok(meta_c->y == 0, "sets the cursor back to right after the first word");
   ok(meta_c->x == 3, "sets the cursor back to right after the first word");
   ok(lb->num_lines == 1, "still has one line");
   is(get_line(lb, 0), "one", "is just the first word now");
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   ok(meta_c->y == 0, "sets the cursor back to cell zero");
   ok(meta_c->x == 0, "sets the cursor back to cell zero");
   ok(lb->num_lines == 1, "still one line");
   is(get_line(lb, 0), "", "no content doe");
 
-  free(c1);
-  free(c2);
-  free(c3);
-  free(c4);
-  free(c5);
-  free(c6);
-  free(c7);
-  free(c8);
-  free(c9);
-
   line_buffer_free(lb);
 }
 
@@ -346,7 +365,7 @@ test_line_buffer_undo_delete_blocks (void) {
   line_buffer_t* lb = line_buffer_init("hello world");
   line_buffer_refresh(lb);
 
-  cursor_t *c1, *c2, *c3, *c4, *c5, *c6;
+  undo_cursor_t c1, c2, c3, c4, c5, c6;
   c1 = create_test_cursor(11, 0);
   c2 = create_test_cursor(10, 0);
   c3 = create_test_cursor(9, 0);
@@ -354,20 +373,20 @@ test_line_buffer_undo_delete_blocks (void) {
   c5 = create_test_cursor(4, 0);
   c6 = create_test_cursor(3, 0);
 
-  line_buffer_delete(lb, 10, 0, (void*)c1);
-  line_buffer_delete(lb, 9, 0, (void*)c2);
-  line_buffer_delete(lb, 8, 0, (void*)c3);
+  line_buffer_delete(lb, 10, 0, &c1);
+  line_buffer_delete(lb, 9, 0, &c2);
+  line_buffer_delete(lb, 8, 0, &c3);
 
-  line_buffer_delete(lb, 4, 0, (void*)c4);
-  line_buffer_delete(lb, 3, 0, (void*)c5);
-  line_buffer_delete(lb, 2, 0, (void*)c6);
+  line_buffer_delete(lb, 4, 0, &c4);
+  line_buffer_delete(lb, 3, 0, &c5);
+  line_buffer_delete(lb, 2, 0, &c6);
 
-  cursor_t* curs = (cursor_t*)line_buffer_undo(lb);
+  const undo_cursor_t* curs = line_buffer_undo(lb);
   ok(curs->x == 5, "stored cursor is the correct value");
   ok(curs->y == 0, "stored cursor is the correct value");
   is(get_line(lb, 0), "hello wo", "targets only the last delete block");
 
-  curs = (cursor_t*)line_buffer_undo(lb);
+  curs = line_buffer_undo(lb);
   ok(curs->x == 11, "stored cursor is the correct value");
   ok(curs->y == 0, "stored cursor is the correct value");
   is(
@@ -377,15 +396,15 @@ test_line_buffer_undo_delete_blocks (void) {
     "breaks"
   );
 
-  line_buffer_delete(lb, 10, 0, (void*)c1);
-  line_buffer_delete(lb, 8, 0, (void*)c3);
+  line_buffer_delete(lb, 10, 0, &c1);
+  line_buffer_delete(lb, 8, 0, &c3);
 
-  curs = (cursor_t*)line_buffer_undo(lb);
+  curs = line_buffer_undo(lb);
   ok(curs->x == 9, "stored cursor is the correct value");
   ok(curs->y == 0, "stored cursor is the correct value");
   is(get_line(lb, 0), "hello worl", "undo reverts the deleted block");
 
-  curs = (cursor_t*)line_buffer_undo(lb);
+  curs = line_buffer_undo(lb);
   ok(curs->x == 11, "stored cursor is the correct value");
   ok(curs->y == 0, "stored cursor is the correct value");
   is(get_line(lb, 0), "hello world", "honors index breaks even within a closed block");
@@ -396,7 +415,7 @@ test_line_buffer_undo_breaks (void) {
   line_buffer_t* lb = line_buffer_init(NULL);
   line_buffer_refresh(lb);
 
-  cursor_t *c1, *c2, *c3, *c4, *c5, *c6;
+  undo_cursor_t c1, c2, c3, c4, c5, c6;
 
   c1 = create_test_cursor(0, 0);
   c2 = create_test_cursor(1, 0);
@@ -405,39 +424,39 @@ test_line_buffer_undo_breaks (void) {
   c5 = create_test_cursor(4, 0);
   c6 = create_test_cursor(5, 0);
 
-  line_buffer_insert(lb, 0, 0, "x", (void*)c1);
-  line_buffer_insert(lb, 1, 0, "x", (void*)c2);
+  line_buffer_insert(lb, 0, 0, "x", &c1);
+  line_buffer_insert(lb, 1, 0, "x", &c2);
   piece_table_break(lb->pt);
-  line_buffer_insert(lb, 2, 0, " ", (void*)c3);
-  line_buffer_insert(lb, 3, 0, "x", (void*)c4);
-  line_buffer_insert(lb, 4, 0, "x", (void*)c5);
+  line_buffer_insert(lb, 2, 0, " ", &c3);
+  line_buffer_insert(lb, 3, 0, "x", &c4);
+  line_buffer_insert(lb, 4, 0, "x", &c5);
   piece_table_break(lb->pt);
-  line_buffer_insert(lb, 5, 0, " ", (void*)c6);
+  line_buffer_insert(lb, 5, 0, " ", &c6);
 
   ok(lb->num_lines == 1, "has one line");
   is(get_line(lb, 0), "xx xx ", "has expected starting state");
 
-  cursor_t* meta_c;
+  const undo_cursor_t* meta_c;
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   is(get_line(lb, 0), "xx xx", "undo goes to the end of the last unit");
   ok(meta_c->y == 0, "metadata cursor correct");
   ok(meta_c->x == 5, "metadata cursor correct");
   ok(lb->num_lines == 1, "still 1 line");
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   is(get_line(lb, 0), "xx", "undo goes to the end of the last unit");
   ok(meta_c->y == 0, "metadata cursor correct");
   ok(meta_c->x == 2, "metadata cursor correct");
   ok(lb->num_lines == 1, "still 1 line");
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   ok(meta_c->y == 0, "metadata cursor correct");
   ok(meta_c->x == 0, "metadata cursor correct");
   ok(lb->num_lines == 1, "still 1 line");
   is(get_line(lb, 0), "", "undo goes to the end of the last unit i.e. empty line buffer");
 
-  meta_c = (cursor_t*)line_buffer_undo(lb);
+  meta_c = line_buffer_undo(lb);
   ok(meta_c == NULL, "metadata is NULL because we're at a terminal state (undo stack is empty)");
   ok(lb->num_lines == 1, "still 1 line");
   is(get_line(lb, 0), "", "no-op because we're done");
@@ -448,7 +467,7 @@ test_line_buffer_undo_multiple_delimiters (void) {
   line_buffer_t* lb = line_buffer_init(NULL);
   line_buffer_refresh(lb);
 
-  cursor_t *c1, *c2, *c3, *c4, *c5, *c6, *c7, *c8, *c9;
+  undo_cursor_t c1, c2, c3, c4, c5, c6, c7, c8, c9;
 }
 
 static void
@@ -460,7 +479,7 @@ test_line_buffer_type_then_delete (void) {
   line_buffer_insert(lb, 2, 0, "d", NULL);
   line_buffer_delete(lb, 2, 0, NULL);
 
-  ok(array_size(lb->line_info) == 1, "has 1 line");
+  ok(has_lines(lb, 1), "has 1 line");
   ok(lb->num_lines == 1, "num_lines field is correct");
   is(get_line(lb, 0), "dd", "correct end state");
 }
@@ -477,7 +496,7 @@ test_line_buffer_type_then_delete_earlier_pos (void) {
   line_buffer_delete(lb, 1, 0, NULL);
   line_buffer_delete(lb, 0, 0, NULL);
 
-  ok(array_size(lb->line_info) == 1, "has 1 line");
+  ok(has_lines(lb, 1), "has 1 line");
   ok(lb->num_lines == 1, "num_lines field is correct");
   is(get_line(lb, 0), "d", "correct end state");
 }
@@ -489,13 +508,77 @@ test_line_buffer_insert_line_on_first (void) {
   line_buffer_insert(lb, 0, 0, "hello\n", NULL);
   line_buffer_insert(lb, 0, 0, "hello\n", NULL);
 
-  ok(array_size(lb->line_info) == 3, "has 2 lines");
+  ok(has_lines(lb, 3), "has 2 lines");
   ok(lb->num_lines == 3, "num_lines field is correct");
   is(get_line(lb, 0), "hello", "correct end state");
   is(get_line(lb, 1), "hello", "correct end state");
   is(get_line(lb, 2), "", "correct end state");
 }
 
+static void
+test_line_buffer_incremental_index (void) {
+  line_buffer_t* lb = line_buffer_init("alpha\nbeta\ngamma");
+
+  line_buffer_insert(lb, 2, 1, "x\ny\n", NULL);
+  line_buffer_insert(lb, 5, 0, "\n", NULL);
+  line_buffer_delete(lb, -1, 3, NULL);
+  line_buffer_delete(lb, 0, 0, NULL);
+
+  ok(lb->num_lines == 5, "has 5 lines after multi-line edits");
+  is(get_line(lb, 0), "lpha", "deletes a char without touching the other lines");
+  is(get_line(lb, 1), "", "splits a line at its end");
+  is(get_line(lb, 2), "bexy", "merges lines when deleting a line break");
+  is(get_line(lb, 3), "ta", "carries the tail of a split line onto the last inserted line");
+  is(get_line(lb, 4), "gamma", "shifts the untouched trailing line");
+
+  line_info_t incremental[5];
+  for (unsigned int i = 0; i < 5; i++) {
+    line_buffer_get_line_info(lb, i, &incremental[i]);
+  }
+
+  line_buffer_refresh(lb);
+
+  for (unsigned int i = 0; i < 5; i++) {
+    line_info_t* li = get_line_info(lb, i);
+    ok(
+      li->line_start == incremental[i].line_start && li->line_length == incremental[i].line_length,
+      "incremental index matches a full rebuild for line %d",
+      i
+    );
+  }
+
+  line_buffer_free(lb);
+}
+
+static void
+test_line_buffer_lazy_index (void) {
+  unsigned int num_lines = 100000;
+  unsigned int length    = num_lines * 4;
+  char*        content   = xmalloc(length);
+  char         template[] = "/tmp/tabloid-lb-XXXXXX";
+
+  for (unsigned int i = 0; i < length; i += 4) {
+    memcpy(content + i, "abc\n", 4);
+  }
+
+  int fd = mkstemp(template);
+  write(fd, content, length);
+  char* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  unlink(template);
+  free(content);
+
+  line_buffer_t* lb = line_buffer_init_mapped(mapping, length, 4);
+
+  unsigned int eager = lb->num_lines;
+  ok(eager > 4 && eager < num_lines && line_buffer_indexing(lb), "only indexes a prefix of the lines up front");
+  is(get_line(lb, 3), "abc", "renders an eagerly indexed line");
+  ok(get_line_info(lb, eager - 1)->line_length == 3, "reading the last known line waits for the full index");
+  ok(lb->num_lines == num_lines + 1 && !line_buffer_indexing(lb), "picks up every line once indexed");
+
+  line_buffer_free(lb);
+}
+
 void
 run_line_buffer_tests (void) {
   test_line_buffer();
@@ -503,6 +586,7 @@ run_line_buffer_tests (void) {
   test_line_buffer_newlines_only();
   test_line_buffer_get_line();
   test_line_buffer_get_all();
+  test_line_buffer_search();
   test_line_buffer_get_xy_from_index();
   test_line_buffer_undo();
   test_line_buffer_undo_delete_blocks();
@@ -512,4 +596,6 @@ run_line_buffer_tests (void) {
   test_line_buffer_type_then_delete();
   test_line_buffer_type_then_delete_earlier_pos();
   test_line_buffer_insert_line_on_first();
+  test_line_buffer_incremental_index();
+  test_line_buffer_lazy_index();
 }
@@ -26,7 +26,7 @@ teardown (void) {
 
 static void
 test_line_editor_insert_char (void) {
-  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", cursor_create_copy(&editor.line_ed));
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", NULL);
 
   SET_CURSOR(5, 0);
 
@@ -64,7 +64,7 @@ test_line_editor_insert_char (void) {
 
 static void
 test_line_editor_insert_newline (void) {
-  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", cursor_create_copy(&editor.line_ed));
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", NULL);
 
   is(get_line(0), "hello", "sanity check");
   ok(editor.line_ed.r->num_lines == 1, "sanity check");
@@ -93,7 +93,7 @@ test_line_editor_insert_newline (void) {
 
 static void
 test_line_editor_insert_newline_middle_word (void) {
-  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", cursor_create_copy(&editor.line_ed));
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", NULL);
 
   char buf[128];
 
@@ -126,7 +126,7 @@ test_line_editor_insert_newline_middle_word (void) {
 
 static void
 test_line_editor_delete_char (void) {
-  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", cursor_create_copy(&editor.line_ed));
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", NULL);
 
   SET_CURSOR(5, 0);
   line_editor_delete_char(&editor.line_ed);
@@ -178,7 +178,7 @@ test_line_editor_delete_char (void) {
 
 static void
 test_line_editor_delete_line_before_x (void) {
-  line_buffer_insert(editor.line_ed.r, 0, 0, "hello goodbye world", cursor_create_copy(&editor.line_ed));
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello goodbye world", NULL);
 
   SET_CURSOR(14, 0);
   line_editor_delete_line_before_x(&editor.line_ed);
@@ -199,6 +199,62 @@ test_line_editor_delete_line_before_x (void) {
   ok(editor.line_ed.curs.y == 0, "y remains at zero");
 }
 
+static void
+test_line_editor_insert_block (void) {
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello", NULL);
+
+  SET_CURSOR(5, 0);
+  line_editor_insert_char(&editor.line_ed, '!');
+  line_editor_insert_block(&editor.line_ed, " big\npasted\nblock");
+
+  is(get_line(0), "hello! big", "inserts the block's first line at the cursor");
+  is(get_line(2), "block", "inserts the remaining lines");
+  ok(editor.line_ed.r->num_lines == 3, "adds a line per newline");
+  ok(editor.line_ed.curs.x == 5 && editor.line_ed.curs.y == 2, "moves the cursor past the block");
+
+  line_editor_undo(&editor.line_ed);
+
+  is(get_line(0), "hello!", "undoes the block in one step, separately from the typing before it");
+  ok(editor.line_ed.r->num_lines == 1, "removes the block's lines");
+}
+
+static void
+test_line_editor_undo_words (void) {
+  char* s = "one two\nthree";
+  for (char* c = s; *c; c++) {
+    if (*c == '\n') {
+      line_editor_insert_newline(&editor.line_ed);
+    } else {
+      line_editor_insert_char(&editor.line_ed, *c);
+    }
+  }
+
+  line_editor_undo(&editor.line_ed);
+  is(get_line(1), "", "undoes the last word typed");
+  ok(editor.line_ed.curs.x == 0 && editor.line_ed.curs.y == 1, "puts the cursor where the word started");
+
+  line_editor_undo(&editor.line_ed);
+  is(get_line(0), "one ", "undoes the word along with the line break after it");
+  ok(editor.line_ed.r->num_lines == 1, "removes the line break");
+
+  line_editor_undo(&editor.line_ed);
+  is(get_line(0), "", "undoes the first word");
+}
+
+static void
+test_line_editor_undo_delete_line_before_x (void) {
+  line_buffer_insert(editor.line_ed.r, 0, 0, "hello world", NULL);
+  SET_CURSOR(11, 0);
+
+  line_editor_delete_char(&editor.line_ed);
+  line_editor_delete_line_before_x(&editor.line_ed);
+  is(get_line(0), "", "deletes the line");
+
+  line_editor_undo(&editor.line_ed);
+  is(get_line(0), "hello worl", "undoes the whole delete in one step");
+  ok(editor.line_ed.curs.x == 10, "puts the cursor back");
+}
+
 void
 run_line_editor_tests (void) {
   void (*functions[])() = {
@@ -207,6 +263,9 @@ run_line_editor_tests (void) {
     test_line_editor_insert_newline_middle_word,
     test_line_editor_delete_char,
     test_line_editor_delete_line_before_x,
+    test_line_editor_insert_block,
+    test_line_editor_undo_words,
+    test_line_editor_undo_delete_line_before_x,
   };
 
   for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
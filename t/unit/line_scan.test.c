@@ -0,0 +1,86 @@
+#include "line_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+#include "xmalloc.h"
+
+#define SCAN_INPUT_SZ 4096
+
+static bool
+line_breaks_equal (line_breaks_t* a, line_breaks_t* b) {
+  return a->size == b->size && (a->size == 0 || memcmp(a->offsets, b->offsets, a->size * sizeof(unsigned int)) == 0);
+}
+
+// Compares a kernel against the scalar scan over every alignment and a range
+// of lengths, so both the vector loop and its scalar tail are exercised
+static bool
+matches_scalar (line_scan_fn* scan, const char* s) {
+  for (unsigned int start = 0; start < 64; start++) {
+    for (unsigned int length = 0; length < SCAN_INPUT_SZ - start; length += 61) {
+      line_breaks_t expected;
+      line_breaks_t actual;
+      line_breaks_init(&expected);
+      line_breaks_init(&actual);
+
+      line_scan_scalar(s + start, length, 7, &expected);
+      scan(s + start, length, 7, &actual);
+
+      bool eq = line_breaks_equal(&expected, &actual);
+      line_breaks_free(&expected);
+      line_breaks_free(&actual);
+
+      if (!eq) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static void
+test_line_scan_scalar (void) {
+  line_breaks_t lb;
+  line_breaks_init(&lb);
+
+  line_scan_scalar("a\nbc\n\nd", 7, 10, &lb);
+  ok(lb.size == 3 && lb.offsets[0] == 11 && lb.offsets[1] == 14 && lb.offsets[2] == 15,
+     "finds every line break, offset by the base");
+
+  line_breaks_free(&lb);
+}
+
+static void
+test_line_scan_kernels (void) {
+  char*        s    = xmalloc(SCAN_INPUT_SZ);
+  unsigned int seed = 7;
+
+  // Mixes runs of dense and sparse line breaks
+  for (unsigned int i = 0; i < SCAN_INPUT_SZ; i++) {
+    seed = seed * 1103515245 + 12345;
+    s[i] = ((seed >> 16) % ((i / 512) % 2 ? 3 : 97)) == 0 ? '\n' : 'a' + (seed >> 8) % 26;
+  }
+
+  ok(matches_scalar(line_scan, s), "the dispatched kernel matches the scalar scan");
+#ifdef LINE_SCAN_X86
+  ok(matches_scalar(line_scan_sse2, s), "the SSE2 kernel matches the scalar scan");
+  if (__builtin_cpu_supports("avx2")) {
+    ok(matches_scalar(line_scan_avx2, s), "the AVX2 kernel matches the scalar scan");
+  } else {
+    skip(true, "AVX2 is not supported");
+  }
+#else
+  skip(true, "SSE2 needs an x86 target");
+  skip(true, "AVX2 needs an x86 target");
+#endif
+
+  free(s);
+}
+
+void
+run_line_scan_tests (void) {
+  test_line_scan_scalar();
+  test_line_scan_kernels();
+}
@@ -6,7 +6,7 @@ file_handle_t logger;
 
 int
 main () {
-  plan(2033);
+  plan(2232);
 
   run_str_search_tests();
   run_calc_tests();
@@ -21,6 +21,12 @@ main () {
   run_scanner_tests();
   run_lexer_tests();
   run_parser_tests();
+  run_line_scan_tests();
+  run_screen_tests();
+  run_frame_buffer_tests();
+  run_pool_tests();
+  run_swap_file_tests();
+  run_keypress_tests();
 
   done_testing();
 }
@@ -28,6 +28,11 @@ test_parser_basic (void) {
     {.in = "q", .command = COMMAND_QUIT, .arg = NULL, .error = NULL, .override = false},
     {.in = "q! hello", .command = COMMAND_INVALID, .arg = NULL, .error = "trailing text"},
 
+    {.in = "earlier", .command = COMMAND_EARLIER, .arg = NULL, .error = NULL, .override = false},
+    {.in = "earlier 10m", .command = COMMAND_EARLIER, .arg = "10m", .error = NULL, .override = false},
+    {.in = "later 3", .command = COMMAND_LATER, .arg = "3", .error = NULL, .override = false},
+    {.in = "later 3 4", .command = COMMAND_INVALID, .arg = NULL, .error = "trailing text"},
+
     {.in = "/", .command = PCOMMAND_SEARCH, .arg = NULL, .error = NULL, .override = false},
     {.in = "/query", .command = PCOMMAND_SEARCH, .arg = "query", .error = NULL, .override = false},
     {.in = "/query with spaces", .command = PCOMMAND_SEARCH, .arg = "query with spaces", .error = NULL, .override = false},
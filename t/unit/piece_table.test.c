@@ -1,6 +1,11 @@
 #include "piece_table.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "tests.h"
 #include "xmalloc.h"
@@ -125,10 +130,737 @@ test_piece_table_dirty (void) {
   piece_table_free(pt);
 }
 
+static unsigned int
+count_newlines (const char* s, unsigned int length) {
+  unsigned int n = 0;
+  for (unsigned int i = 0; i < length; i++) {
+    n += s[i] == '\n';
+  }
+
+  return n;
+}
+
+static void
+test_piece_table_many_pieces (void) {
+  char*        buffer    = xmalloc(4096);
+  char*        model     = xmalloc(4096);
+  unsigned int model_len = 11;
+  unsigned int seed      = 42;
+
+  memcpy(model, "hello\nworld", model_len);
+
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "hello\nworld");
+
+  for (unsigned int i = 0; i < 500; i++) {
+    seed           = seed * 1103515245 + 12345;
+    unsigned int r = seed >> 16;
+
+    if (model_len > 0 && r % 3 == 0) {
+      unsigned int index  = r % model_len;
+      unsigned int length = 1 + (r >> 8) % (model_len - index < 4 ? model_len - index : 4);
+
+      piece_table_delete(pt, index, length, PT_DELETE, NULL);
+      memmove(model + index, model + index + length, model_len - index - length);
+      model_len -= length;
+    } else {
+      unsigned int index = r % (model_len + 1);
+      char*        piece = (r & 1) ? "ab\n" : "xyz";
+
+      piece_table_insert(pt, index, piece, NULL);
+      memmove(model + index + 3, model + index, model_len - index);
+      memcpy(model + index, piece, 3);
+      model_len += 3;
+    }
+  }
+
+  model[model_len] = '\0';
+
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, model, "renders the correct string after many scattered edits");
+  ok(pt->root->subtree_length == model_len, "tree byte total tracks the sequence length");
+  ok(pt->root->subtree_newlines == count_newlines(model, model_len), "tree newline total tracks the content");
+
+  piece_table_render(pt, model_len / 2, 8, buffer);
+  ok(strncmp(buffer, model + model_len / 2, 8) == 0, "renders a slice from the middle of the sequence");
+
+  bool         starts_match = true;
+  bool         lines_match  = true;
+  unsigned int lineno       = 0;
+
+  for (unsigned int i = 0; i <= model_len; i++) {
+    if (i == 0 || model[i - 1] == '\n') {
+      starts_match = starts_match && piece_table_line_start(pt, lineno) == i;
+    }
+
+    lines_match = lines_match && piece_table_line_from_index(pt, i) == lineno;
+
+    if (i < model_len && model[i] == '\n') {
+      lineno++;
+    }
+  }
+
+  ok(piece_table_line_count(pt) == count_newlines(model, model_len) + 1, "line count tracks the content");
+  ok(starts_match, "every line start is found via the tree");
+  ok(lines_match, "every index maps to its line via the tree");
+
+  while (piece_table_can_undo(pt)) {
+    piece_table_undo(pt);
+  }
+
+  memset(buffer, 0, 4096);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "hello\nworld", "undoing every edit restores the initial string");
+  ok(pt->root->subtree_length == 11 && pt->root->subtree_newlines == 1, "tree totals are restored by undo");
+
+  while (piece_table_can_redo(pt)) {
+    piece_table_redo(pt);
+  }
+
+  memset(buffer, 0, 4096);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, model, "redoing every edit restores the final string");
+  ok(pt->root->subtree_newlines == count_newlines(model, model_len), "tree totals are restored by redo");
+
+  piece_table_free(pt);
+  free(buffer);
+  free(model);
+}
+
+static void
+test_piece_table_lines (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "one\ntwo\nthree");
+
+  piece_table_insert(pt, 4, "2a\n2b\n", NULL);
+  piece_table_delete(pt, 0, 4, PT_DELETE, NULL);
+
+  // "2a\n2b\ntwo\nthree"
+  ok(piece_table_line_count(pt) == 4, "counts lines across pieces");
+  ok(piece_table_line_start(pt, 0) == 0, "first line starts at zero");
+  ok(piece_table_line_start(pt, 2) == 6, "finds a line start in an original piece");
+  ok(piece_table_line_start(pt, 3) == 10, "finds the last line start");
+  ok(piece_table_line_from_index(pt, 2) == 0, "a line break belongs to the line it ends");
+  ok(piece_table_line_from_index(pt, 3) == 1, "maps an index in an added piece to its line");
+  ok(piece_table_line_from_index(pt, 15) == 3, "maps the end of the sequence to the last line");
+
+  piece_table_undo(pt);
+  piece_table_undo(pt);
+  ok(piece_table_line_count(pt) == 3 && piece_table_line_start(pt, 2) == 8, "line lookups follow undo");
+
+  piece_table_free(pt);
+}
+
+// Maps a copy of `content` from an unlinked temp file
+static char*
+map_content (const char* content, unsigned int length) {
+  char template[] = "/tmp/tabloid-mapped-XXXXXX";
+  int  fd         = mkstemp(template);
+  write(fd, content, length);
+
+  char* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  unlink(template);
+
+  return mapping;
+}
+
+static void
+test_piece_table_mapped (void) {
+  char  buffer[64] = {0};
+  char* content    = "mapped\ncontent";
+
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup_mapped(pt, map_content(content, strlen(content)), strlen(content), UINT_MAX);
+
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, content, "renders the mapped original buffer");
+  ok(piece_table_line_count(pt) == 2 && piece_table_line_start(pt, 1) == 7, "indexes lines in the mapped buffer");
+
+  piece_table_insert(pt, 6, " file", NULL);
+  memset(buffer, 0, 64);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "mapped file\ncontent", "inserts go to an add buffer, not the mapping");
+
+  piece_table_undo(pt);
+  memset(buffer, 0, 64);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, content, "undo restores the mapped text");
+
+  piece_table_free(pt);
+}
+
+static void
+test_piece_table_mapped_lazy_index (void) {
+  unsigned int num_lines = 200000;
+  unsigned int length    = num_lines * 8;
+  char*        content   = xmalloc(length + 1);
+
+  // "0000000\n0000001\n..."
+  for (unsigned int i = 0; i < num_lines; i++) {
+    snprintf(content + i * 8, 9, "%07u\n", i);
+  }
+
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup_mapped(pt, map_content(content, length), length, 10);
+
+  ok(piece_table_indexing(pt), "indexes the bulk of a large mapping in the background");
+  unsigned int eager = piece_table_line_count(pt);
+  ok(eager > 10 && eager < num_lines, "only a prefix of the lines is known up front");
+  ok(piece_table_line_start(pt, eager - 2) == (eager - 2) * 8, "eager line starts are exact");
+  ok(piece_table_line_count_estimate(pt) >= eager, "estimates the line count while indexing");
+
+  piece_table_index_sync(pt);
+  ok(!piece_table_indexing(pt), "syncing finishes the background index");
+  ok(piece_table_line_count(pt) == num_lines + 1, "counts every line once synced");
+  ok(piece_table_line_start(pt, num_lines - 1) == length - 8, "finds a line start from the background index");
+  piece_table_free(pt);
+
+  pt = piece_table_init();
+  piece_table_setup_mapped(pt, map_content(content, length), length, 10);
+  piece_table_insert(pt, length, "tail", NULL);
+  ok(piece_table_line_count(pt) == num_lines + 1 && piece_table_line_from_index(pt, length + 2) == num_lines,
+     "edits wait for the complete index");
+  piece_table_free(pt);
+
+  pt = piece_table_init();
+  piece_table_setup_mapped(pt, map_content(content, length), length, 10);
+  piece_table_insert(pt, 0, "x\n", NULL);
+  piece_table_break(pt);
+  piece_table_delete(pt, 2, 8, PT_DELETE, NULL);
+  ok(piece_table_indexing(pt) && piece_table_line_start(pt, 1) == 2, "edits in the indexed part don't wait for the rest");
+
+  piece_table_undo(pt);
+  piece_table_index_sync(pt);
+  ok(piece_table_line_count(pt) == num_lines + 2, "recounts the lines once synced");
+  piece_table_redo(pt);
+  ok(piece_table_line_count(pt) == num_lines + 1, "recounts the pieces the undo history holds");
+  piece_table_free(pt);
+
+  // Freeing the table mid-scan cancels the scan
+  pt = piece_table_init();
+  piece_table_setup_mapped(pt, map_content(content, length), length, 10);
+  piece_table_free(pt);
+
+  free(content);
+}
+
+static void
+test_seq_buffer_parallel_index (void) {
+  unsigned int length  = 1 << 20;
+  char*        content = xmalloc(length);
+  unsigned int seed    = 3;
+
+  for (unsigned int i = 0; i < length; i++) {
+    seed       = seed * 1103515245 + 12345;
+    content[i] = (seed >> 16) % 37 == 0 ? '\n' : 'x';
+  }
+
+  line_breaks_t expected;
+  line_breaks_init(&expected);
+  line_scan_scalar(content, length, 0, &expected);
+
+  seq_buffer_t* sb = seq_buffer_init();
+  sb->mapping      = map_content(content, length);
+  sb->length       = length;
+  seq_buffer_index_line_breaks(sb, 0, 1000);
+
+  // An odd worker count leaves uneven slices, with the remainder on the last
+  seq_buffer_index_async(sb, 7);
+  seq_buffer_index_join(sb);
+
+  ok(sb->indexed == length && !sb->indexer, "joins every worker");
+  ok(sb->line_breaks.size == expected.size &&
+       memcmp(sb->line_breaks.offsets, expected.offsets, expected.size * sizeof(unsigned int)) == 0,
+     "stitches the workers' line breaks in order");
+
+  line_breaks_free(&expected);
+  seq_buffer_free(sb);
+  free(content);
+}
+
+static void
+test_piece_table_write (void) {
+  char* rendered = xmalloc(1024);
+  char* written  = xmalloc(1024);
+
+  // A mapped original with an embedded NUL, which a strlen-based write would truncate
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup_mapped(pt, map_content("ab\0cd\nef", 8), 8, UINT_MAX);
+
+  // Enough scattered inserts to span several writev batches
+  for (unsigned int i = 0; i < 200; i++) {
+    piece_table_insert(pt, (i * 7) % (pt->seq_length + 1), i % 2 ? "x" : "y\n", NULL);
+  }
+
+  piece_table_render(pt, 0, pt->seq_length, rendered);
+
+  FILE*                   tmp  = tmpfile();
+  piece_table_snapshot_t* snap = piece_table_snapshot(pt);
+  size_t                  n_bytes;
+  ok(piece_table_snapshot_write(snap, fileno(tmp), &n_bytes) == IO_WRITE_ALL_OK, "writes every piece");
+  ok(n_bytes == pt->seq_length && atomic_load(&snap->written) == n_bytes, "reports the full byte count");
+
+  rewind(tmp);
+  size_t n_read = fread(written, 1, 1024, tmp);
+  ok(n_read == pt->seq_length && memcmp(written, rendered, n_read) == 0, "writes the same bytes as a render");
+  ok(pt->root->subtree_count > 64, "spans several writev batches");
+
+  fclose(tmp);
+  piece_table_snapshot_free(snap);
+  piece_table_free(pt);
+  free(rendered);
+  free(written);
+}
+
+static void
+test_piece_table_spans (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "hello world");
+  piece_table_insert(pt, 5, ",", NULL);
+  piece_table_insert(pt, 12, "!", NULL);
+
+  piece_table_span_iter_t it;
+  const char*             span;
+  unsigned int            length;
+  unsigned int            num_spans = 0;
+  char                    joined[32];
+  unsigned int            total     = 0;
+  bool                    in_place  = true;
+
+  // "llo, world!" starts partway into the first piece and spans all four
+  piece_table_span_iter_init(&it, pt, 2, 11);
+  while (piece_table_span_iter_next(&it, &span, &length)) {
+    piece_descriptor_t* pd;
+    unsigned int        pd_index = piece_table_desc_from_index(pt, 2 + total, &pd);
+
+    in_place = in_place && span == piece_table_desc_state(pt, pd) + (2 + total - pd_index);
+    memcpy(joined + total, span, length);
+    total += length;
+    num_spans++;
+  }
+  joined[total] = '\0';
+
+  is(joined, "llo, world!", "yields the range across piece boundaries");
+  ok(num_spans == 4, "yields one span per piece");
+  ok(in_place, "spans point into the piece buffers");
+
+  piece_table_span_iter_init(&it, pt, 4, 3);
+  total = 0;
+  while (piece_table_span_iter_next(&it, &span, &length)) {
+    memcpy(joined + total, span, length);
+    total += length;
+  }
+  joined[total] = '\0';
+  is(joined, "o, ", "stops at the end of the range");
+
+  piece_table_free(pt);
+}
+
+static void
+test_piece_table_pools (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "hello world");
+
+  ok(pt->descriptors.live == 3, "allocates the sentinels and the original piece from the pool");
+
+  piece_table_insert(pt, 5, ",", NULL);
+  // The undo tree's root is a range of its own
+  ok(pt->descriptors.live == 6 && pt->ranges.live == 2, "keeps the split piece for undo and releases scratch ranges");
+
+  for (unsigned int i = 0; i < 1000; i++) {
+    piece_table_undo(pt);
+    piece_table_insert(pt, 5, ",", NULL);
+  }
+  ok(pt->descriptors.live == 2 + 3 + 1000 * 3 + 1 && pt->ranges.live == 1002, "keeps undone edits as branches");
+
+  piece_table_history_clear(pt);
+  ok(pt->descriptors.live == 5 && pt->ranges.live == 1, "releases the pieces history holds when cleared");
+
+  char buffer[16];
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "hello, world", "reuses released pieces");
+
+  piece_table_free(pt);
+}
+
+static bool
+piece_tables_match (piece_table_t* a, piece_table_t* b, char* buf_a, char* buf_b) {
+  piece_table_render(a, 0, a->seq_length, buf_a);
+  piece_table_render(b, 0, b->seq_length, buf_b);
+  return a->seq_length == b->seq_length && strcmp(buf_a, buf_b) == 0;
+}
+
+// Edits two tables alike, compacting one of them as it goes, then walks both
+// back and forth through their history
+static void
+test_piece_table_compact_history (void) {
+  piece_table_t* pt  = piece_table_init();
+  piece_table_t* ref = piece_table_init();
+  piece_table_setup(pt, "the quick brown fox jumps over the lazy dog");
+  piece_table_setup(ref, "the quick brown fox jumps over the lazy dog");
+
+  char*        buf_a     = xmalloc(8192);
+  char*        buf_b     = xmalloc(8192);
+  unsigned int cursor    = 10;
+  unsigned int n_removed = 0;
+
+  srand(18);
+  for (unsigned int i = 0; i < 600; i++) {
+    unsigned int op = rand() % 10;
+
+    if (op < 5) {
+      // Typing; consecutive inserts extend the same piece
+      piece_table_insert(pt, cursor, "ab", NULL);
+      piece_table_insert(ref, cursor, "ab", NULL);
+      cursor += 2;
+    } else if (op < 8 && pt->seq_length > 4) {
+      unsigned int index = rand() % (pt->seq_length - 3);
+      piece_table_delete(pt, index, 3, PT_DELETE, NULL);
+      piece_table_delete(ref, index, 3, PT_DELETE, NULL);
+      cursor = index;
+    } else {
+      cursor = rand() % (pt->seq_length + 1);
+    }
+
+    if (i % 50 == 49) {
+      if (i % 100 == 99) {
+        piece_table_undo(pt);
+        piece_table_undo(ref);
+      }
+
+      n_removed += piece_table_compact(pt, true);
+      piece_table_break(ref);
+    }
+  }
+
+  ok(n_removed > 0 && piece_tables_match(pt, ref, buf_a, buf_b), "compacts without changing the text");
+
+  bool matches = true;
+  while (matches && piece_table_can_undo(ref)) {
+    piece_table_undo(pt);
+    piece_table_undo(ref);
+    matches = piece_tables_match(pt, ref, buf_a, buf_b) && piece_table_can_undo(pt) == piece_table_can_undo(ref);
+  }
+  ok(matches, "undoes every edit made before compacting");
+
+  while (matches && piece_table_can_redo(ref)) {
+    piece_table_redo(pt);
+    piece_table_redo(ref);
+    matches = piece_tables_match(pt, ref, buf_a, buf_b);
+  }
+  ok(matches, "redoes every edit made before compacting");
+
+  free(buf_a);
+  free(buf_b);
+  piece_table_free(pt);
+  piece_table_free(ref);
+}
+
+static void
+test_piece_table_compact_merges (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "0123456789abcdefghijklmnopqrstuvwxyz");
+
+  // Each delete leaves a small piece of the original behind
+  for (unsigned int i = 1; i < 18; i++) {
+    piece_table_delete(pt, i, 1, PT_DELETE, NULL);
+  }
+  piece_table_insert(pt, 4, "++", NULL);
+  piece_table_break(pt);
+  piece_table_insert(pt, 6, "--", NULL);
+
+  char         before[64];
+  char         after[64];
+  unsigned int n_pieces = piece_table_piece_count(pt);
+
+  piece_table_render(pt, 0, pt->seq_length, before);
+
+  // With its history released, nothing holds the table's pieces in place
+  piece_table_history_clear(pt);
+
+  ok(piece_table_compact(pt, false) == 1 && piece_table_piece_count(pt) == n_pieces - 1, "merges adjacent slices of a buffer");
+
+  piece_table_compact(pt, true);
+  piece_table_render(pt, 0, pt->seq_length, after);
+
+  ok(piece_table_piece_count(pt) == 1, "repacks runs of small pieces");
+  is(after, before, "keeps the text intact");
+  ok(piece_table_line_count(pt) == 1, "keeps the line counts");
+
+  piece_table_free(pt);
+}
+
+static void
+test_piece_table_add_chunks (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "");
+
+  piece_table_insert(pt, 0, "first", NULL);
+
+  piece_descriptor_t* pd;
+  piece_table_desc_from_index(pt, 0, &pd);
+  const char* first = piece_table_desc_state(pt, pd);
+
+  for (unsigned int i = 0; i < 20000; i++) {
+    piece_table_insert(pt, pt->seq_length, "0123456789", NULL);
+  }
+
+  piece_table_desc_from_index(pt, 0, &pd);
+  ok(piece_table_desc_state(pt, pd) == first && memcmp(first, "first", 5) == 0, "never moves text already added");
+  ok(array_size(pt->buffer_list) == 5, "appends to fixed-size chunks");
+
+  char* big = xmalloc(100001);
+  memset(big, 'x', 100000);
+  big[100000] = '\0';
+  piece_table_insert(pt, 0, big, NULL);
+  piece_table_insert(pt, 0, "y", NULL);
+
+  seq_buffer_t* sb = array_get(pt->buffer_list, 5);
+  ok(sb->length == 100000 && sb->max_size == 100000, "gives a piece larger than a chunk its own");
+  ok(pt->add_buffer_id == 6, "starts a new chunk after an oversized one");
+
+  free(big);
+  piece_table_free(pt);
+}
+
+// Edits two tables alike, one of them with almost no room for history, then
+// walks both back and forth through it
+static void
+test_piece_table_history_meta_budget (void) {
+  piece_table_t* pt  = piece_table_init();
+  piece_table_t* ref = piece_table_init();
+  piece_table_setup(pt, "the quick brown fox jumps over the lazy dog");
+  piece_table_setup(ref, "the quick brown fox jumps over the lazy dog");
+  piece_table_set_history_meta_budget(pt, 1);
+
+  char*        buf_a  = xmalloc(8192);
+  char*        buf_b  = xmalloc(8192);
+  unsigned int cursor = 4;
+
+  srand(20);
+  for (unsigned int i = 0; i < 400; i++) {
+    unsigned int op = rand() % 10;
+
+    if (op < 5) {
+      piece_table_insert(pt, cursor, "xyz", NULL);
+      piece_table_insert(ref, cursor, "xyz", NULL);
+      cursor += 3;
+    } else if (op < 8 && pt->seq_length > 4) {
+      unsigned int index = rand() % (pt->seq_length - 2);
+      piece_table_delete(pt, index, 2, PT_DELETE, NULL);
+      piece_table_delete(ref, index, 2, PT_DELETE, NULL);
+      cursor = index;
+    } else {
+      cursor = rand() % (pt->seq_length + 1);
+    }
+
+    // Compacting moves piece boundaries under the spilled history
+    if (i % 100 == 99) {
+      piece_table_compact(pt, true);
+      piece_table_break(ref);
+    }
+  }
+
+  unsigned int depth = piece_table_dirty_mark(ref);
+
+  ok(pt->history.size == 1 && piece_table_history_spilled(pt) == depth - 1,
+     "spills all but the latest edit past its budget");
+  ok(piece_table_history_meta_size(pt) < piece_table_history_meta_size(ref), "keeps less history in memory");
+  ok(piece_table_dirty_mark(pt) == depth, "counts spilled history towards the dirty mark");
+
+  bool matches = piece_tables_match(pt, ref, buf_a, buf_b);
+  while (matches && piece_table_can_undo(ref)) {
+    piece_table_undo(pt);
+    piece_table_undo(ref);
+    matches = piece_tables_match(pt, ref, buf_a, buf_b);
+  }
+  ok(matches && piece_table_history_spilled(pt) == 0 && piece_table_undo(pt) == NULL, "reloads spilled history to undo");
+  ok(!piece_table_dirty(pt), "is clean once everything is undone");
+
+  while (matches && piece_table_can_redo(ref)) {
+    piece_table_redo(pt);
+    piece_table_redo(ref);
+    matches = piece_tables_match(pt, ref, buf_a, buf_b);
+  }
+  ok(matches, "redoes reloaded history");
+
+  free(buf_a);
+  free(buf_b);
+  piece_table_free(pt);
+  piece_table_free(ref);
+}
+
+static void
+test_piece_table_undo_groups (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "hello world");
+
+  char          buffer[64];
+  undo_cursor_t c1 = {3, 0};
+  undo_cursor_t c2 = {9, 0};
+
+  piece_table_group_begin(pt);
+  piece_table_insert(pt, 0, "one ", &c1);
+  piece_table_group_begin(pt);
+  piece_table_delete(pt, 9, 6, PT_DELETE, &c2);
+  piece_table_group_end(pt);
+  piece_table_insert(pt, 9, "there", &c2);
+  piece_table_group_end(pt);
+  piece_table_insert(pt, 14, "!", &c2);
+
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "one hellothere!", "applies every edit in the group");
+
+  piece_table_undo(pt);
+  const undo_cursor_t* curs = piece_table_undo(pt);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "hello world", "undoes a group in one step");
+  ok(curs && curs->x == 3 && curs->y == 0, "restores the cursor from before the group");
+
+  piece_table_redo(pt);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "one hellothere", "redoes a group in one step");
+
+  piece_table_insert(pt, 0, ">", NULL);
+  curs = piece_table_undo(pt);
+  ok(curs && curs->x == 0 && curs->y == 0, "records a zero cursor when none is given");
+
+  piece_table_free(pt);
+}
+
+static void
+test_piece_table_undo_tree (void) {
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "abc");
+
+  char buffer[64];
+
+  piece_table_insert(pt, 3, "1", NULL);
+  piece_table_break(pt);
+  piece_table_insert(pt, 4, "2", NULL);
+  piece_table_undo(pt);
+  piece_table_insert(pt, 4, "X", NULL);
+
+  piece_table_undo(pt);
+  piece_table_redo(pt);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc1X", "redoes the latest branch");
+
+  piece_table_travel_steps(pt, -1);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc12", "keeps the branch an edit was made over");
+
+  piece_table_travel_steps(pt, 1);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc1X", "steps forward across branches");
+
+  piece_table_travel_steps(pt, -10);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  ok(strcmp(buffer, "abc") == 0 && !piece_table_can_undo(pt) && !piece_table_dirty(pt), "stops at the oldest state");
+
+  for (unsigned int i = 0; i < pt->history.size; i++) {
+    pt->history.nodes[pt->history.start + i]->time = 100 * (i + 1);
+  }
+
+  piece_table_travel_time(pt, 250);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc12", "goes to the state current at a given time");
+
+  piece_table_travel_time(pt, 50);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc", "goes to the oldest state for a time before any edit");
+
+  piece_table_free(pt);
+}
+
+static void
+test_piece_table_undo_file (void) {
+  char template[] = "/tmp/tabloid-undo-XXXXXX";
+  char buffer[64];
+
+  close(mkstemp(template));
+  unlink(template);
+
+  piece_table_t* pt = piece_table_init();
+  piece_table_setup(pt, "abc");
+  piece_table_history_load(pt, template, 1);
+
+  piece_table_insert(pt, 3, "1", NULL);
+  piece_table_break(pt);
+  piece_table_insert(pt, 4, "2", NULL);
+  piece_table_undo(pt);
+  piece_table_insert(pt, 4, "X", NULL);
+  piece_table_free(pt);
+
+  pt = piece_table_init();
+  piece_table_setup(pt, "abc");
+  ok(piece_table_history_load(pt, template, 1), "restores history for the text it started from");
+
+  piece_table_redo(pt);
+  piece_table_redo(pt);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc1X", "restores the latest branch");
+
+  piece_table_travel_steps(pt, -1);
+  piece_table_render(pt, 0, pt->seq_length, buffer);
+  is(buffer, "abc12", "restores the other branches");
+  piece_table_free(pt);
+
+  // Same text, but the file was written since
+  pt = piece_table_init();
+  piece_table_setup(pt, "abc");
+  ok(!piece_table_history_load(pt, template, 2), "ignores history saved for another version of the file");
+
+  piece_table_free(pt);
+  unlink(template);
+
+  // One edit, whose lengths are then garbled past the end of the file
+  pt = piece_table_init();
+  piece_table_setup(pt, "abc");
+  piece_table_history_load(pt, template, 1);
+  piece_table_insert(pt, 3, "1", NULL);
+  piece_table_free(pt);
+
+  struct stat st;
+  stat(template, &st);
+
+  // The magic, a save and the edit, then the byte it inserted
+  size_t record_sz = (st.st_size - 8 - 1) / 2;
+  char   garbage[256];
+  int    fd        = open(template, O_WRONLY);
+
+  memset(garbage, 0xff, sizeof(garbage));
+  pwrite(fd, garbage, record_sz - 16, 8 + record_sz + 16);
+  close(fd);
+
+  pt = piece_table_init();
+  piece_table_setup(pt, "abc");
+  ok(piece_table_history_load(pt, template, 1) && piece_table_undo(pt) == NULL, "drops edits longer than the undo file");
+
+  piece_table_free(pt);
+  unlink(template);
+}
+
 void
 run_piece_table_tests (void) {
   test_piece_table();
   test_piece_table_no_initial();
   test_piece_table_empty_initial();
   test_piece_table_dirty();
+  test_piece_table_many_pieces();
+  test_piece_table_lines();
+  test_piece_table_mapped();
+  test_piece_table_mapped_lazy_index();
+  test_seq_buffer_parallel_index();
+  test_piece_table_write();
+  test_piece_table_spans();
+  test_piece_table_pools();
+  test_piece_table_compact_history();
+  test_piece_table_compact_merges();
+  test_piece_table_add_chunks();
+  test_piece_table_history_meta_budget();
+  test_piece_table_undo_groups();
+  test_piece_table_undo_tree();
+  test_piece_table_undo_file();
 }
@@ -0,0 +1,51 @@
+#include "pool.h"
+
+#include <stdint.h>
+
+#include "tests.h"
+
+typedef struct {
+  char   tag;
+  double value;
+} pool_test_elem_t;
+
+static void
+test_pool_alloc (void) {
+  pool_t pool;
+  pool_init(&pool, sizeof(pool_test_elem_t));
+
+  pool_test_elem_t* elems[100];
+  bool              aligned = true;
+
+  for (unsigned int i = 0; i < 100; i++) {
+    elems[i]        = pool_alloc(&pool);
+    elems[i]->tag   = i;
+    elems[i]->value = i;
+    aligned         = aligned && (uintptr_t)elems[i] % _Alignof(max_align_t) == 0;
+  }
+
+  bool intact = true;
+  for (unsigned int i = 0; i < 100; i++) {
+    intact = intact && elems[i]->tag == (char)i && elems[i]->value == i;
+  }
+
+  ok(intact && aligned, "hands out distinct, aligned objects across slabs");
+  ok(pool.live == 100, "counts live objects");
+
+  pool_release(&pool, elems[10]);
+  pool_release(&pool, elems[20]);
+
+  pool_test_elem_t* a = pool_alloc(&pool);
+  pool_test_elem_t* b = pool_alloc(&pool);
+
+  ok(a == elems[20] && b == elems[10], "reuses released objects first");
+  ok(pool.live == 100, "counts released objects");
+
+  pool_free(&pool);
+  ok(pool.slabs == NULL && pool.live == 0, "frees every slab at once");
+}
+
+void
+run_pool_tests (void) {
+  test_pool_alloc();
+}
@@ -9,13 +9,26 @@
 
 #define RESET_BUFFERS()   \
   memset(slice, 0, 1024); \
-  buffer_free(buf);       \
-  buf = buffer_init(NULL)
+  frame_buffer_reset(buf)
+
+// Copies bytes `start` through `end_inclusive` of the frame into `dest`, and
+// terminates it. A range past the frame's end leaves `dest` empty.
+static void
+frame_slice (frame_buffer_t *buf, size_t start, size_t end_inclusive, char *dest) {
+  dest[0] = '\0';
+
+  if (end_inclusive < frame_buffer_size(buf) && start <= end_inclusive) {
+    memcpy(dest, frame_buffer_state(buf) + start, end_inclusive - start + 1);
+    dest[end_inclusive - start + 1] = '\0';
+  }
+}
 
 static void
 setup (void) {
   editor_init(&editor);
-  editor.win.rows = 40;
+  editor.win.rows       = 40;
+  editor.conf.undo_file = false;
+  editor.conf.swap_file = false;
   editor_open("./t/fixtures/file.txt");
 }
 
@@ -29,13 +42,13 @@ static void
 test_basic_draw (void) {
   ok(editor.line_ed.r->num_lines == 38, "sanity check");
 
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
   window_draw_rows(buf);
 
   ok(editor.line_ed.curs.x == 0, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 0, "cursor at cell zero");
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     ESC_SEQ_COLOR(3) "  1 " ESC_SEQ_NORM_COLOR ESC_SEQ_BG_COLOR(238) "amateuros                                     "
     ESC_SEQ_NORM_COLOR ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  2 bash" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
@@ -79,12 +92,12 @@ test_basic_draw (void) {
     "each line is rendered correctly"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 static void
 test_basic_insert (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   CALL_N_TIMES(3, cursor_move_right(&editor.line_ed));
   line_editor_insert_char(&editor.line_ed,'x');
@@ -112,7 +125,7 @@ test_basic_insert (void) {
   ok(editor.line_ed.curs.x == 4, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 29, "cursor at cell zero");
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     "  1 amaxteuros" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  2 bash" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  3 bxolt" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
@@ -157,12 +170,12 @@ test_basic_insert (void) {
     "expected state after various edits and cursor changes"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 static void
 test_basic_horizontal_viewport_shift (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   SET_CURSOR(4, 27);
   CALL_N_TIMES(2, cursor_move_up(&editor.line_ed));
@@ -179,7 +192,7 @@ test_basic_horizontal_viewport_shift (void) {
   ok(editor.line_ed.curs.x == 85, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 25, "cursor at cell zero");
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     "  1 " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  2 " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  3 " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
@@ -224,12 +237,12 @@ test_basic_horizontal_viewport_shift (void) {
     "expected state after moving off the main window view"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 static void
 test_basic_shift_back_viewport (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   SET_CURSOR(4, 27);
   CALL_N_TIMES(2, cursor_move_up(&editor.line_ed));
@@ -250,7 +263,7 @@ test_basic_shift_back_viewport (void) {
   ok(editor.line_ed.curs.y == 25, "cursor at cell zero");
 
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     "  1 amateuros" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  2 bash" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  3 bolt" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
@@ -295,12 +308,12 @@ test_basic_shift_back_viewport (void) {
     "expected state after jumping back to the main viewport and inserting a char"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 static void
 test_basic_select (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   SET_CURSOR(0, 27);
   CALL_N_TIMES(2, cursor_move_up(&editor.line_ed));
@@ -317,7 +330,7 @@ test_basic_select (void) {
   window_draw_rows(buf);
 
   char slice[1024];
-  buffer_slice(buf, 393, 535, slice);
+  frame_slice(buf, 393, 535, slice);
 
   ok(editor.line_ed.curs.x == 4, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 25, "cursor at cell zero");
@@ -337,7 +350,7 @@ test_basic_select (void) {
   cursor_select_down(&editor.line_ed);
 
   window_draw_rows(buf);
-  buffer_slice(buf, 393, 578, slice);
+  frame_slice(buf, 393, 578, slice);
 
   ok(editor.line_ed.curs.x == 4, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 26, "cursor at cell zero");
@@ -361,7 +374,7 @@ test_basic_select (void) {
   ok(editor.line_ed.curs.x == 86, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 25, "cursor at cell zero");
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     "  1 " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  2 " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
     "  3 " ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR CRLF
@@ -416,7 +429,7 @@ test_basic_select (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 393, 564, slice);
+  frame_slice(buf, 393, 564, slice);
 
   ok(editor.line_ed.curs.x == 4, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 24, "cursor at cell zero");
@@ -431,7 +444,7 @@ test_basic_select (void) {
     "lines"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 // Edge case/bugfix: if the anchor line selection starts AFTER the subsequent
@@ -439,7 +452,7 @@ test_basic_select (void) {
 // line (beyond the line length).
 static void
 test_edge_case_1_select (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   cursor_select_clear(&editor.line_ed);
 
@@ -461,7 +474,7 @@ test_edge_case_1_select (void) {
   window_draw_rows(buf);
 
   char slice[1024];
-  buffer_slice(buf, 393, 578, slice);
+  frame_slice(buf, 393, 578, slice);
 
   ok(editor.line_ed.curs.x == 7, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 26, "cursor at cell zero");
@@ -476,12 +489,12 @@ test_edge_case_1_select (void) {
     "selects across lines properly despite varying line lengths"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 static void
 test_basic_undo (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   cursor_select_clear(&editor.line_ed);
   SET_CURSOR(0, 26);
@@ -500,7 +513,7 @@ test_basic_undo (void) {
   window_draw_rows(buf);
 
   char slice[1024];
-  buffer_slice(buf, 369, 516, slice);
+  frame_slice(buf, 369, 516, slice);
 
   ok(editor.line_ed.curs.x == 3, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 23, "cursor at cell zero");
@@ -520,7 +533,7 @@ test_basic_undo (void) {
   line_editor_undo(&editor.line_ed);
 
   window_draw_rows(buf);
-  buffer_slice(buf, 369, 516, slice);
+  frame_slice(buf, 369, 516, slice);
 
   ok(editor.line_ed.curs.x == 0, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 23, "cursor at cell zero");
@@ -540,7 +553,7 @@ test_basic_undo (void) {
   line_editor_undo(&editor.line_ed);
 
   window_draw_rows(buf);
-  buffer_slice(buf, 369, 505, slice);
+  frame_slice(buf, 369, 505, slice);
 
   ok(editor.line_ed.curs.x == 6, "cursor at cell zero");
   ok(editor.line_ed.curs.y == 25, "cursor at cell zero");
@@ -555,12 +568,12 @@ test_basic_undo (void) {
     "undo works"
   );
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
 }
 
 void
 test_complex_undo (void) {
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   SET_CURSOR(0, 25);
 
@@ -588,7 +601,7 @@ test_complex_undo (void) {
   window_draw_rows(buf);
 
   char slice[1024];
-  buffer_slice(buf, 198, 305, slice);
+  frame_slice(buf, 198, 305, slice);
 
   ok(editor.line_ed.curs.x == 85, "correct cursor pos");
   ok(editor.line_ed.curs.y == 24, "correct cursor pos");
@@ -610,7 +623,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 369, 543, slice);
+  frame_slice(buf, 369, 543, slice);
 
   ok(editor.line_ed.curs.x == 0, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -631,7 +644,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 369, 539, slice);
+  frame_slice(buf, 369, 539, slice);
 
   ok(editor.line_ed.curs.x == 5, "correct cursor pos");
   ok(editor.line_ed.curs.y == 24, "correct cursor pos");
@@ -653,7 +666,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 407, 502, slice);
+  frame_slice(buf, 407, 502, slice);
 
   ok(editor.line_ed.curs.x == 10, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -672,7 +685,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 407, 502, slice);
+  frame_slice(buf, 407, 502, slice);
 
   ok(editor.line_ed.curs.x == 16, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -691,7 +704,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 407, 502, slice);
+  frame_slice(buf, 407, 502, slice);
 
   ok(editor.line_ed.curs.x == 20, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -710,7 +723,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 407, 502, slice);
+  frame_slice(buf, 407, 502, slice);
 
   ok(editor.line_ed.curs.x == 25, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -729,7 +742,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 407, 502, slice);
+  frame_slice(buf, 407, 502, slice);
 
   ok(editor.line_ed.curs.x == 32, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -748,7 +761,7 @@ test_complex_undo (void) {
   window_scroll();
 
   window_draw_rows(buf);
-  buffer_slice(buf, 407, 502, slice);
+  frame_slice(buf, 407, 502, slice);
 
   ok(editor.line_ed.curs.x == 0, "correct cursor pos");
   ok(editor.line_ed.curs.y == 25, "correct cursor pos");
@@ -0,0 +1,87 @@
+#include "screen.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "keypress.h"
+#include "tests.h"
+
+// Loads `frame` and returns what the flush would write to the terminal
+static char*
+flush (screen_t* screen, const char* frame) {
+  frame_buffer_t* out = frame_buffer_init();
+
+  screen_load(screen, frame, strlen(frame));
+  screen_flush(screen, out);
+
+  char* s = s_copy(frame_buffer_state(out));
+  frame_buffer_free(out);
+  return s;
+}
+
+static void
+test_screen_damage (void) {
+  screen_t screen;
+  screen_init(&screen, 2, 4);
+
+  char* s = flush(&screen, "ab");
+  is(s, ESC_SEQ_NORM_COLOR ESC_SEQ_CLEAR_SCREEN ESC_SEQ "[1;1Hab", "the first frame repaints the screen");
+  free(s);
+
+  s = flush(&screen, "ab");
+  is(s, "", "an unchanged frame writes nothing");
+  free(s);
+
+  s = flush(&screen, "ax" CRLF "cd");
+  is(s, ESC_SEQ "[1;2Hx" ESC_SEQ "[2;1Hcd", "writes only the changed cells");
+  free(s);
+
+  s = flush(&screen, CRLF "cd");
+  is(s, ESC_SEQ "[1;1H" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "erases cells that became blank");
+  free(s);
+
+  screen_free(&screen);
+}
+
+static void
+test_screen_attributes (void) {
+  screen_t screen;
+  screen_init(&screen, 2, 4);
+  free(flush(&screen, ""));
+
+  char* s = flush(&screen, ESC_SEQ_COLOR(3) "a" ESC_SEQ_NORM_COLOR "b");
+  is(s, ESC_SEQ "[1;1H" ESC_SEQ "[0;38;5;3ma" ESC_SEQ "[0mb", "switches attributes only between cells");
+  free(s);
+
+  s = flush(&screen, ESC_SEQ_BG_COLOR(238) "a" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR);
+  is(s, ESC_SEQ "[1;1H" ESC_SEQ "[0;48;5;238ma   " ESC_SEQ_NORM_COLOR, "erases with the current background");
+  free(s);
+
+  s = flush(&screen, "abcdef");
+  is(s, ESC_SEQ "[1;1Habcd" ESC_SEQ "[2;1Hef", "wraps at the last column");
+  free(s);
+
+  screen_free(&screen);
+}
+
+static void
+test_screen_tabs (void) {
+  screen_t screen;
+  screen_init(&screen, 2, 16);
+  free(flush(&screen, "\tab"));
+
+  // The tab spans however many columns the terminal expands it to
+  char* s = flush(&screen, "\tabX");
+  is(s, ESC_SEQ "[1;1H\tabX" ESC_SEQ_ERASE_LN_RIGHT_OF_CURSOR, "rewrites rows with tabs whole");
+  free(s);
+
+  screen_free(&screen);
+}
+
+void
+run_screen_tests (void) {
+  test_screen_damage();
+  test_screen_tabs();
+  test_screen_attributes();
+}
@@ -1,6 +1,7 @@
 #include "status_bar.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "const.h"
 #include "cursor.h"
@@ -9,9 +10,7 @@
 #include "tests.h"
 #include "window.h"
 
-#define RESET_BUFFERS() \
-  buffer_free(buf);     \
-  buf = buffer_init(NULL)
+#define RESET_BUFFERS() frame_buffer_reset(buf)
 
 unsigned int
 tty_get_window_size (unsigned int *rows, unsigned int *cols) {
@@ -23,6 +22,8 @@ tty_get_window_size (unsigned int *rows, unsigned int *cols) {
 static void
 setup (void) {
   editor_init(&editor);
+  editor.conf.undo_file = false;
+  editor.conf.swap_file = false;
   editor_open("./t/fixtures/file.txt");
 }
 
@@ -38,11 +39,11 @@ test_basic_draw_status_bar (void) {
   ok(editor.line_ed.curs.x == 0, "sanity check");
   ok(editor.line_ed.curs.y == 0, "sanity check");
 
-  buffer_t *buf = buffer_init(NULL);
+  frame_buffer_t *buf = frame_buffer_init();
 
   window_draw_status_bar(buf);
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     ESC_SEQ_INVERT_COLOR " | EDIT | file.txt                  | Ln 1, Col 1 " ESC_SEQ_NORM_COLOR,
     "draws the status bar with edit mode"
   );
@@ -52,7 +53,7 @@ test_basic_draw_status_bar (void) {
   editor.mode = COMMAND_MODE;
   window_draw_status_bar(buf);
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     ESC_SEQ_INVERT_COLOR " | COMMAND | file.txt               | Ln 1, Col 1 " ESC_SEQ_NORM_COLOR,
     "draws the status bar with command mode"
   );
@@ -64,7 +65,7 @@ test_basic_draw_status_bar (void) {
   cursor_move_end(&editor.line_ed);
   window_draw_status_bar(buf);
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     ESC_SEQ_INVERT_COLOR " | EDIT | file.txt                  | Ln 2, Col 5 " ESC_SEQ_NORM_COLOR,
     "draws the status bar correctly"
   );
@@ -75,7 +76,7 @@ test_basic_draw_status_bar (void) {
   window_draw_status_bar(buf);
 
   is(
-    buffer_state(buf),
+    frame_buffer_state(buf),
     ESC_SEQ_INVERT_COLOR " | EDIT | file.txt*                 | Ln 2, Col 6 " ESC_SEQ_NORM_COLOR,
     "draws the status bar correctly"
   );
@@ -84,7 +85,37 @@ test_basic_draw_status_bar (void) {
 
   // TODO: filename truncate+ellipses if necessary
 
-  buffer_free(buf);
+  frame_buffer_free(buf);
+}
+
+static void
+test_draw_status_bar_history (void) {
+  frame_buffer_t *buf = frame_buffer_init();
+
+  line_buffer_set_history_meta_budget(editor.line_ed.r, 1);
+  line_editor_insert_char(&editor.line_ed, 'x');
+  line_buffer_break(editor.line_ed.r);
+  line_editor_insert_char(&editor.line_ed, 'y');
+  window_draw_status_bar(buf);
+
+  is(
+    frame_buffer_state(buf),
+    ESC_SEQ_INVERT_COLOR " | EDIT | file.txt*                 | Ln 1, Col 3 " ESC_SEQ_NORM_COLOR,
+    "leaves out the undo history when there is no room for it"
+  );
+
+  RESET_BUFFERS();
+
+  editor.win.cols = 80;
+  window_draw_status_bar(buf);
+
+  ok(
+    strstr(frame_buffer_state(buf), "| Undo ") != NULL &&
+    strstr(frame_buffer_state(buf), ", 1 on disk | Ln 1, Col 3 ") != NULL,
+    "shows the undo history once some of it is on disk"
+  );
+
+  frame_buffer_free(buf);
 }
 
 /* clang-format on */
@@ -93,6 +124,7 @@ void
 run_status_bar_tests (void) {
   void (*functions[])() = {
     test_basic_draw_status_bar,
+    test_draw_status_bar_history,
   };
 
   for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
@@ -1,5 +1,7 @@
 #include "str_search.h"
 
+#include <limits.h>
+
 #include "tests.h"
 
 #define ENTRY(arr, k, v) arr[k] = v
@@ -32,10 +34,12 @@ test_str_search_basic (void) {
 
   FOR_EACH_TEST({
     string_finder_t sf;
+    unsigned int    index;
     string_finder_init(&sf, tc.pattern);
-    ssize_t actual = string_finder_next(&sf, tc.text, 0);
+    int actual = string_finder_next(&sf, tc.text, 0, &index) ? (int)index : -1;
 
     eq_num(actual, tc.expect, "first index of '%s' is %d (got %d)", tc.pattern, tc.expect, actual);
+    string_finder_free(&sf);
   });
 }
 
@@ -124,18 +128,78 @@ test_str_search_tables (void) {
       // eq_num(want, got, "search tables (suffix) got=%d, want=%d\n");
       todo_end();
     }
+
+    string_finder_free(&sf);
   });
 }
 
+static void
+test_str_search_nth (void) {
+  string_finder_t sf;
+  unsigned int    index;
+  string_finder_init(&sf, "pat");
+
+  ok(string_finder_next(&sf, "x paet ap a toh pattern pattern tap", 0, &index) && index == 16, "finds the first match");
+  ok(string_finder_next(&sf, "x paet ap a toh pattern pattern tap", 1, &index) && index == 24, "finds the second match");
+  ok(!string_finder_next(&sf, "x paet ap a toh pattern pattern tap", 2, &index), "finds no third match");
+
+  string_finder_free(&sf);
+}
+
+static void
+test_str_search_spans (void) {
+  char*           spans[] = {"xxab", "c", "", "d", "abcdab", "cd", "a", "b", "cxabc"};
+  unsigned int    found[8];
+  unsigned int    n       = 0;
+  unsigned int    index;
+  string_finder_t sf;
+
+  string_finder_init(&sf, "abcd");
+  string_finder_start(&sf, 0);
+
+  for (unsigned int i = 0; i < sizeof(spans) / sizeof(spans[0]); i++) {
+    while (string_finder_feed(&sf, spans[i], strlen(spans[i]), &index) && n < 8) {
+      found[n++] = index;
+    }
+  }
+
+  ok(n == 3 && found[0] == 2 && found[1] == 6 && found[2] == 10, "finds matches that straddle spans");
+
+  string_finder_start(&sf, 100);
+  ok(!string_finder_feed(&sf, "abc", 3, &index) && string_finder_feed(&sf, "dab", 3, &index) && index == 100, "counts from the start index");
+
+  string_finder_free(&sf);
+}
+
+static void
+test_str_search_near_index_limit (void) {
+  unsigned int    found[4];
+  unsigned int    n = 0;
+  unsigned int    index;
+  string_finder_t sf;
+
+  string_finder_init(&sf, "abcd");
+  string_finder_start(&sf, UINT_MAX - 13);
+
+  // Ends the text at UINT_MAX, where a skip carries the window past it
+  while (string_finder_feed(&sf, "xxab", 4, &index) && n < 4) {
+    found[n++] = index;
+  }
+
+  while (string_finder_feed(&sf, "cdxxabcdx", 9, &index) && n < 4) {
+    found[n++] = index;
+  }
+
+  ok(n == 2 && found[0] == UINT_MAX - 11 && found[1] == UINT_MAX - 5, "finds matches in spans ending at the last index");
+
+  string_finder_free(&sf);
+}
+
 void
 run_str_search_tests (void) {
   test_str_search_basic();
   test_str_search_tables();
-  // TODO: Finish
-  // string_finder_t sf;
-  // string_finder_init(&sf, "pat");
-  // int actual = string_finder_next(&sf, "x paet ap a toh pattern pattern tap", 0);
-  // printf("1: %d\n", actual);
-  // actual = string_finder_next(&sf, "x paet ap a toh pattern pattern tap", 1);
-  // printf("2: %d\n", actual);
+  test_str_search_nth();
+  test_str_search_spans();
+  test_str_search_near_index_limit();
 }
@@ -0,0 +1,207 @@
+#include "swap_file.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tests.h"
+
+static const swap_file_base_t base_a = {.dev = 1, .ino = 2, .size = 3, .mtime_sec = 4, .mtime_nsec = 5};
+static const swap_file_base_t base_b = {.dev = 1, .ino = 2, .size = 4, .mtime_sec = 6, .mtime_nsec = 7};
+
+static char*
+swap_file_test_path (void) {
+  char template[] = "/tmp/tabloid-swap-XXXXXX";
+
+  close(mkstemp(template));
+  unlink(template);
+  return s_copy(template);
+}
+
+static void
+test_swap_file_recover (void) {
+  char*            path = swap_file_test_path();
+  char             expected[64];
+  char             actual[64];
+  int              n;
+  swap_file_status status;
+  piece_table_t*   pt   = piece_table_init();
+
+  piece_table_setup(pt, "abc");
+  swap_file_t* swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  ok(swap != NULL && n == 0, "starts a swap file");
+
+  piece_table_insert(pt, 3, "def", NULL);
+  piece_table_break(pt);
+  piece_table_delete(pt, 0, 2, PT_DELETE, NULL);
+  piece_table_break(pt);
+  piece_table_insert(pt, 1, "\nxyz", NULL);
+  piece_table_undo(pt);
+  piece_table_render(pt, 0, pt->seq_length, expected);
+
+  // No clean exit; the swap file stays
+  swap_file_close(swap, false);
+  piece_table_free(pt);
+
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abc");
+  swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_render(pt, 0, pt->seq_length, actual);
+  ok(n == 4, "recovers each change, undo included");
+  is(actual, expected, "recovers the text");
+
+  struct stat st;
+  ok(stat(path, &st) == 0 && st.st_size > 0, "logs the recovered changes before returning");
+
+  swap_file_close(swap, false);
+  piece_table_free(pt);
+
+  // Recovered changes were logged again
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abc");
+  swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_render(pt, 0, pt->seq_length, actual);
+  is(actual, expected, "recovers again after another crash");
+
+  swap_file_close(swap, true);
+  piece_table_free(pt);
+  ok(access(path, F_OK) == -1, "removes the swap file on a clean exit");
+
+  free(path);
+}
+
+static void
+test_swap_file_nul (void) {
+  char*            path = swap_file_test_path();
+  char             actual[64];
+  int              n;
+  swap_file_status status;
+  piece_table_t*   pt   = piece_table_init();
+
+  piece_table_setup(pt, "abc");
+  swap_file_t* swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_insert_n(pt, 1, "x\0y", 3, NULL);
+  swap_file_close(swap, false);
+  piece_table_free(pt);
+
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abc");
+  swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_render(pt, 0, pt->seq_length, actual);
+  ok(pt->seq_length == 6 && memcmp(actual, "ax\0ybc", 6) == 0, "recovers text with NUL bytes in it");
+
+  swap_file_close(swap, true);
+  piece_table_free(pt);
+  free(path);
+}
+
+static void
+test_swap_file_base (void) {
+  char*            path = swap_file_test_path();
+  char             actual[64];
+  int              n;
+  swap_file_status status;
+  piece_table_t*   pt   = piece_table_init();
+
+  piece_table_setup(pt, "abc");
+  swap_file_t* swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_insert(pt, 3, "1", NULL);
+  swap_file_close(swap, false);
+  piece_table_free(pt);
+
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abcd");
+  swap = swap_file_open(path, &base_b, 1000, pt, &n, &status);
+  piece_table_render(pt, 0, pt->seq_length, actual);
+  ok(n == 0 && s_equals(actual, "abcd"), "ignores changes made over a different file");
+
+  char* aside = s_fmt("%s~", path);
+  ok(status == SWAP_FILE_MOVED_ASIDE && access(aside, F_OK) == 0, "moves the other file's swap file aside");
+
+  swap_file_close(swap, true);
+  piece_table_free(pt);
+
+  // Still there to recover from
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abc");
+  swap = swap_file_open(aside, &base_a, 1000, pt, &n, &status);
+  piece_table_render(pt, 0, pt->seq_length, actual);
+  is(actual, "abc1", "keeps the changes in the swap file moved aside");
+
+  swap_file_close(swap, true);
+  piece_table_free(pt);
+  free(aside);
+  free(path);
+}
+
+static void
+test_swap_file_in_use (void) {
+  char*            path = swap_file_test_path();
+  int              n;
+  swap_file_status status;
+  piece_table_t*   pt   = piece_table_init();
+  piece_table_t*   pt2  = piece_table_init();
+
+  piece_table_setup(pt, "abc");
+  piece_table_setup(pt2, "abc");
+  swap_file_t* swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_insert(pt, 3, "1", NULL);
+
+  ok(swap_file_open(path, &base_a, 1000, pt2, &n, &status) == NULL && status == SWAP_FILE_IN_USE, "leaves a swap file held by another session alone");
+  ok(pt2->seq_length == 3, "recovers nothing from a swap file in use");
+
+  swap_file_close(swap, true);
+  piece_table_free(pt);
+  piece_table_free(pt2);
+  free(path);
+}
+
+static void
+test_swap_file_saved (void) {
+  char*            path = swap_file_test_path();
+  char             actual[64];
+  int              n;
+  swap_file_status status;
+  piece_table_t*   pt   = piece_table_init();
+
+  piece_table_setup(pt, "abc");
+  swap_file_t* swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  piece_table_insert(pt, 3, "1", NULL);
+
+  // Saved as "abc1", while "2" was typed
+  unsigned int mark = swap_file_mark(swap);
+  piece_table_insert(pt, 4, "2", NULL);
+  swap_file_saved(swap, mark, &base_b);
+  swap_file_close(swap, false);
+  piece_table_free(pt);
+
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abc1");
+  swap = swap_file_open(path, &base_b, 1000, pt, &n, &status);
+  piece_table_render(pt, 0, pt->seq_length, actual);
+  ok(n == 1, "recovers only the changes since the save");
+  is(actual, "abc12", "recovers the text over the saved file");
+
+  // Saved with nothing changed since; the log starts over
+  swap_file_saved(swap, swap_file_mark(swap), &base_a);
+  swap_file_close(swap, false);
+  piece_table_free(pt);
+
+  pt   = piece_table_init();
+  piece_table_setup(pt, "abc12");
+  swap = swap_file_open(path, &base_a, 1000, pt, &n, &status);
+  ok(n == 0, "has nothing to recover after a clean save");
+
+  swap_file_close(swap, true);
+  piece_table_free(pt);
+  free(path);
+}
+
+void
+run_swap_file_tests (void) {
+  test_swap_file_recover();
+  test_swap_file_nul();
+  test_swap_file_base();
+  test_swap_file_in_use();
+  test_swap_file_saved();
+}
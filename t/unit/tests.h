@@ -20,5 +20,11 @@ void run_scanner_tests(void);
 void run_lexer_tests(void);
 void run_parser_tests(void);
 void run_str_search_tests(void);
+void run_line_scan_tests(void);
+void run_screen_tests(void);
+void run_frame_buffer_tests(void);
+void run_pool_tests(void);
+void run_swap_file_tests(void);
+void run_keypress_tests(void);
 
 #endif /* TESTS_H */